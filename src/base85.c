@@ -1,22 +1,41 @@
 /* Copyright 2015 Judson Weissert; See LICENSE file. */
 
 #include "base85.h"
+#include "tune.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define dimof(x) (sizeof(x) / sizeof(*x))
 
-/// Base85 decode array. Zero indicates an invalid entry.
-/// @see base85_decode_init()
-#if defined (B85_ZEROMQ)
-#define B85_G_DECODE g_z85_decode
+/// Static tracing probes (USDT, provider "base85"). A probe is a single nop
+/// until a tracer such as bpftrace attaches to it. Without sys/sdt.h (or with
+/// the B85_ENABLE_PROBES CMake option off) they compile to nothing.
+#if defined (B85_HAVE_SDT)
+#include <sys/sdt.h>
+#define B85_PROBE2(name, a, b) DTRACE_PROBE2 (base85, name, a, b)
+#define B85_PROBE3(name, a, b, c) DTRACE_PROBE3 (base85, name, a, b, c)
+#define B85_PROBE4(name, a, b, c, d) DTRACE_PROBE4 (base85, name, a, b, c, d)
 #else
-#define B85_G_DECODE g_ascii85_decode
+#define B85_PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define B85_PROBE3(name, a, b, c) \
+  do { (void) (a); (void) (b); (void) (c); } while (0)
+#define B85_PROBE4(name, a, b, c, d) \
+  do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
 #endif
 
-static uint8_t B85_G_DECODE[256];
+#if defined (__GNUC__)
+#define B85_ALWAYS_INLINE inline __attribute__ ((always_inline))
+#else
+#define B85_ALWAYS_INLINE inline
+#endif
 
 static const uint8_t B85_HEADER0 = '<';
 static const uint8_t B85_HEADER1 = '~';
@@ -36,7 +55,39 @@ typedef enum
   B85_S_END
 } b85_state_t;
 
-/// State transitions for handling ascii85 header/footer.
+/// Internal context flags (see base85_context_t::flags).
+typedef enum
+{
+  /// The output is never read; instead of growing the output buffer, it is
+  /// recycled once full.
+  B85_F_DISCARD = 1 << 0,
+
+  /// The output buffer is provided by the caller and is never reallocated.
+  B85_F_FIXED_OUTPUT = 1 << 1,
+
+  /// The output buffer is the input buffer (see B85_DECODE_INPLACE()).
+  B85_F_IN_PLACE = 1 << 2,
+
+  /// The decoder is at the start of a line (see B85_CONTEXT_SET_LINE_LENGTH()).
+  B85_F_LINE_START = 1 << 3,
+
+  /// Complete groups are emitted as characters of the alphabet returned by
+  /// base85_transcode_alphabet() instead of bytes (see B85_TRANSCODE()).
+  B85_F_TRANSCODE = 1 << 4,
+
+  /// Maintain a checksum of the binary data (see B85_CONTEXT_SET_CHECKSUM()).
+  B85_F_CHECKSUM = 1 << 5,
+
+  /// Direction of the stream, set by the first call that processes input
+  /// (transcoding counts as decoding). The hold of an encoder has room for
+  /// fewer bytes than a decoder uses, so a context must be reset before it
+  /// changes direction (see base85_context_direction()).
+  B85_F_ENCODER = 1 << 6,
+  B85_F_DECODER = 1 << 7,
+} b85_flag_t;
+
+/// State transitions for handling ascii85 header/footer. Alphabets that are
+/// not framed never leave B85_S_NO_HEADER.
 static bool
 base85_handle_state (uint8_t c, struct base85_context_t *ctx)
 {
@@ -44,7 +95,7 @@ base85_handle_state (uint8_t c, struct base85_context_t *ctx)
   switch (*state)
   {
   case B85_S_START:
-    if (B85_HEADER0 == c)
+    if (B85_HEADER0 == c && ctx->alphabet->framed)
     {
       *state = B85_S_HEADER0;
       return true;
@@ -64,8 +115,9 @@ base85_handle_state (uint8_t c, struct base85_context_t *ctx)
     }
 
     // Important, have to add B85_HEADER0 char to the hold.
-    // NOTE: Assumes that B85_HEADER0 is in the alphabet.
-    ctx->hold[ctx->pos++] = B85_G_DECODE[B85_HEADER0] - 1;
+    // NOTE: Assumes that B85_HEADER0 is in the alphabet (as required for
+    // framed alphabets by B85_ALPHABET_INIT()).
+    ctx->hold[ctx->pos++] = ctx->alphabet->decode[B85_HEADER0] - 1;
     *state = B85_S_NO_HEADER;
     return false;
 
@@ -105,6 +157,11 @@ B85_DEBUG_ERROR_STRING (b85_result_t val)
     "B85_E_BAD_FOOTER",
     "B85_E_LOGIC_ERROR",
     "B85_E_API_MISUSE",
+    "B85_E_BUFFER_TOO_SMALL",
+    "B85_E_FILTER",
+    "B85_E_BAD_INDEX",
+    "B85_E_BAD_STATE",
+    "B85_E_IO",
   };
 
   if (val >= 0 && val < dimof (m))
@@ -124,6 +181,11 @@ B85_ERROR_STRING (b85_result_t val)
     "Missing or invalid footer", // B85_E_BAD_FOOTER
     "Logic error", // B85_E_LOGIC_ERROR
     "API misuse", // B85_E_API_MISUSE
+    "Buffer too small", // B85_E_BUFFER_TOO_SMALL
+    "Filter error", // B85_E_FILTER
+    "Invalid index", // B85_E_BAD_INDEX
+    "Invalid context state", // B85_E_BAD_STATE
+    "I/O error", // B85_E_IO
   };
 
   if (val >= 0 && val < dimof (m))
@@ -132,57 +194,121 @@ B85_ERROR_STRING (b85_result_t val)
   return "Unspecified error";
 }
 
-#if defined (B85_ZEROMQ)
-#define B85_G_ENCODE g_z85_encode
-
 /// ZeroMQ (Z85) alphabet.
-static const uint8_t B85_G_ENCODE[] = {
-  '0', '1', '2', '3', '4', '5', '6', '7',
-  '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
-  'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
-  'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
-  'w', 'x', 'y', 'z', 'A', 'B', 'C', 'D',
-  'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L',
-  'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T',
-  'U', 'V', 'W', 'X', 'Y', 'Z', '.', '-',
-  ':', '+', '=', '^', '!', '/', '*', '?',
-  '&', '<', '>', '(', ')', '[', ']', '{',
+#define B85_Z85_CHARS \
+  '0', '1', '2', '3', '4', '5', '6', '7', \
+  '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', \
+  'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', \
+  'o', 'p', 'q', 'r', 's', 't', 'u', 'v', \
+  'w', 'x', 'y', 'z', 'A', 'B', 'C', 'D', \
+  'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', \
+  'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', \
+  'U', 'V', 'W', 'X', 'Y', 'Z', '.', '-', \
+  ':', '+', '=', '^', '!', '/', '*', '?', \
+  '&', '<', '>', '(', ')', '[', ']', '{', \
   '}', '@', '%', '$', '#'
+
+/// Ascii85 alphabet.
+#define B85_ASCII85_CHARS \
+  '!', '"', '#', '$', '%', '&', '\'', '(', \
+  ')', '*', '+', ',', '-', '.', '/', '0', \
+  '1', '2', '3', '4', '5', '6', '7', '8', \
+  '9', ':', ';', '<', '=', '>', '?', '@', \
+  'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', \
+  'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', \
+  'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', \
+  'Y', 'Z', '[', '\\', ']', '^', '_', '`', \
+  'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', \
+  'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', \
+  'q', 'r', 's', 't', 'u'
+
+/// RFC 1924 alphabet (also used by git binary patches and Python's
+/// base64.b85encode()).
+#define B85_RFC1924_CHARS \
+  '0', '1', '2', '3', '4', '5', '6', '7', \
+  '8', '9', 'A', 'B', 'C', 'D', 'E', 'F', \
+  'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', \
+  'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', \
+  'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', \
+  'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', \
+  'm', 'n', 'o', 'p', 'q', 'r', 's', 't', \
+  'u', 'v', 'w', 'x', 'y', 'z', '!', '#', \
+  '$', '%', '&', '(', ')', '*', '+', '-', \
+  ';', '<', '=', '>', '?', '@', '^', '_', \
+  '`', '{', '|', '}', '~'
+
+/// Kernels selected by base85_alphabet_t::kernel. The built-in alphabets get
+/// kernels that refer to their constant tables directly, and have their zero
+/// group shortcut compiled in.
+enum
+{
+  B85_K_GENERIC = 0,
+  B85_K_ASCII85,
+  B85_K_Z85,
+  B85_K_RFC1924,
+  B85_K_END
 };
 
-#else
+/// Decode table (digit plus one, by character) of the 85 characters given.
+#define B85_DECODE_TABLE(...) B85_DECODE_TABLE_ (__VA_ARGS__)
+#define B85_DECODE_TABLE_( \
+  c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11, c12, c13, c14, c15, c16, \
+  c17, c18, c19, c20, c21, c22, c23, c24, c25, c26, c27, c28, c29, c30, c31, \
+  c32, c33, c34, c35, c36, c37, c38, c39, c40, c41, c42, c43, c44, c45, c46, \
+  c47, c48, c49, c50, c51, c52, c53, c54, c55, c56, c57, c58, c59, c60, c61, \
+  c62, c63, c64, c65, c66, c67, c68, c69, c70, c71, c72, c73, c74, c75, c76, \
+  c77, c78, c79, c80, c81, c82, c83, c84 \
+) { \
+  [c0] = 1, [c1] = 2, [c2] = 3, [c3] = 4, [c4] = 5, [c5] = 6, [c6] = 7, \
+  [c7] = 8, [c8] = 9, [c9] = 10, [c10] = 11, [c11] = 12, [c12] = 13, \
+  [c13] = 14, [c14] = 15, [c15] = 16, [c16] = 17, [c17] = 18, [c18] = 19, \
+  [c19] = 20, [c20] = 21, [c21] = 22, [c22] = 23, [c23] = 24, [c24] = 25, \
+  [c25] = 26, [c26] = 27, [c27] = 28, [c28] = 29, [c29] = 30, [c30] = 31, \
+  [c31] = 32, [c32] = 33, [c33] = 34, [c34] = 35, [c35] = 36, [c36] = 37, \
+  [c37] = 38, [c38] = 39, [c39] = 40, [c40] = 41, [c41] = 42, [c42] = 43, \
+  [c43] = 44, [c44] = 45, [c45] = 46, [c46] = 47, [c47] = 48, [c48] = 49, \
+  [c49] = 50, [c50] = 51, [c51] = 52, [c52] = 53, [c53] = 54, [c54] = 55, \
+  [c55] = 56, [c56] = 57, [c57] = 58, [c58] = 59, [c59] = 60, [c60] = 61, \
+  [c61] = 62, [c62] = 63, [c63] = 64, [c64] = 65, [c65] = 66, [c66] = 67, \
+  [c67] = 68, [c68] = 69, [c69] = 70, [c70] = 71, [c71] = 72, [c72] = 73, \
+  [c73] = 74, [c74] = 75, [c75] = 76, [c76] = 77, [c77] = 78, [c78] = 79, \
+  [c79] = 80, [c80] = 81, [c81] = 82, [c82] = 83, [c83] = 84, [c84] = 85 \
+}
 
-#define B85_G_ENCODE g_ascii85_encode
-/// Ascii85 alphabet.
-static const uint8_t B85_G_ENCODE[] = {
-  '!', '"', '#', '$', '%', '&', '\'', '(',
-  ')', '*', '+', ',', '-', '.', '/', '0',
-  '1', '2', '3', '4', '5', '6', '7', '8',
-  '9', ':', ';', '<', '=', '>', '?', '@',
-  'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
-  'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
-  'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
-  'Y', 'Z', '[', '\\', ']', '^', '_', '`',
-  'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h',
-  'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p',
-  'q', 'r', 's', 't', 'u', 
+/// Built-in alphabets, constant data so that they need no initialization.
+/// Z85 keeps the <~ ~> framing for compatibility with earlier versions.
+static const struct base85_alphabet_t g_ascii85 = {
+  .encode = { B85_ASCII85_CHARS },
+  .decode = B85_DECODE_TABLE (B85_ASCII85_CHARS),
+  .zero_char = 'z',
+  .framed = 1,
+  .kernel = B85_K_ASCII85,
+};
+static const struct base85_alphabet_t g_z85 = {
+  .encode = { B85_Z85_CHARS },
+  .decode = B85_DECODE_TABLE (B85_Z85_CHARS),
+  .framed = 1,
+  .kernel = B85_K_Z85,
+};
+static const struct base85_alphabet_t g_rfc1924 = {
+  .encode = { B85_RFC1924_CHARS },
+  .decode = B85_DECODE_TABLE (B85_RFC1924_CHARS),
+  .kernel = B85_K_RFC1924,
 };
 
+/// B85_G_DEFAULT is the alphabet of this build: the alphabet of new contexts,
+/// and of the functions that do not take a context.
+#if defined (B85_ZEROMQ)
+#define B85_G_DEFAULT g_z85
+#else
+#define B85_G_DEFAULT g_ascii85
 #endif
 
-/// Initializer for B85_G_DECODE (may be called multiple times).
-static void
-base85_decode_init ()
+/// Returns the alphabet that B85_TRANSCODE() converts @a alphabet to.
+static const struct base85_alphabet_t *
+base85_transcode_alphabet (const struct base85_alphabet_t *alphabet)
 {
-  if (B85_G_DECODE[B85_G_ENCODE[0]])
-    return;
-
-  // NOTE: Assumes B85_G_DECODE[] was implicitly initialized with zeros.
-  for (size_t i = 0; i < dimof (B85_G_ENCODE); ++i)
-  {
-    uint8_t c = B85_G_ENCODE[i];
-    B85_G_DECODE[c] = i + 1;
-  }
+  return B85_K_ASCII85 == alphabet->kernel ? &g_z85 : &g_ascii85;
 }
 
 /// True if @a state is "critical", i.e. when whitespace is important.
@@ -213,6 +339,418 @@ base85_can_skip (uint8_t c, b85_state_t state)
   return !base85_critical_state (state) && base85_whitespace (c);
 }
 
+/// Maximum number of input bytes handled by one whitespace compaction pass.
+#define B85_COMPACT_BLOCK 1024
+
+/// Slack needed after the output of a compaction kernel (whole vectors are
+/// stored).
+#define B85_COMPACT_SLACK 16
+
+/// Whitespace compaction kernel: copies the @a cb_b bytes at @a b to @a out,
+/// dropping whitespace, and returns the number of bytes written. @a out must
+/// have room for cb_b + B85_COMPACT_SLACK bytes.
+typedef size_t (*base85_compact_fn) (
+  const uint8_t *b, size_t cb_b, uint8_t *out
+);
+
+static size_t
+base85_compact_generic (const uint8_t *b, size_t cb_b, uint8_t *out)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < cb_b; ++i)
+  {
+    out[n] = b[i];
+    n += !base85_whitespace (b[i]);
+  }
+  return n;
+}
+
+#if defined (__SSE2__)
+
+/// Returns a mask with bit i set if byte i of @a x is whitespace.
+static inline unsigned
+base85_whitespace_mask (__m128i x)
+{
+  __m128i m = _mm_or_si128 (
+    _mm_or_si128 (
+      _mm_cmpeq_epi8 (x, _mm_set1_epi8 (' ')),
+      _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\n'))
+    ),
+    _mm_or_si128 (
+      _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\r')),
+      _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\t'))
+    )
+  );
+  return _mm_movemask_epi8 (m);
+}
+
+/// SSE2 compaction: clean 16 byte blocks are copied as a whole, the others
+/// byte by byte (without branches).
+static size_t
+base85_compact_sse2 (const uint8_t *b, size_t cb_b, uint8_t *out)
+{
+  size_t n = 0;
+  size_t i = 0;
+  for (; i + 16 <= cb_b; i += 16)
+  {
+    __m128i x = _mm_loadu_si128 ((const __m128i *) (b + i));
+    _mm_storeu_si128 ((__m128i *) (out + n), x);
+
+    unsigned mask = base85_whitespace_mask (x);
+    if (!mask)
+    {
+      n += 16;
+      continue;
+    }
+
+    for (int j = 0; j < 16; ++j)
+    {
+      out[n] = b[i + j];
+      n += !((mask >> j) & 1);
+    }
+  }
+
+  return n + base85_compact_generic (b + i, cb_b - i, out + n);
+}
+
+#if defined (__GNUC__)
+#define B85_HAVE_SSSE3_COMPACT
+#endif
+
+#endif
+
+#if defined (B85_HAVE_SSSE3_COMPACT)
+#include <tmmintrin.h>
+
+/// Shuffle indices that move the bytes of an 8 byte lane whose bits are not
+/// set in the table index to the front of the lane.
+static uint8_t g_compact_shuffle[256][8];
+
+__attribute__ ((target ("ssse3"))) static size_t
+base85_compact_ssse3 (const uint8_t *b, size_t cb_b, uint8_t *out)
+{
+  size_t n = 0;
+  size_t i = 0;
+  for (; i + 16 <= cb_b; i += 16)
+  {
+    __m128i x = _mm_loadu_si128 ((const __m128i *) (b + i));
+    unsigned mask = base85_whitespace_mask (x);
+    if (!mask)
+    {
+      _mm_storeu_si128 ((__m128i *) (out + n), x);
+      n += 16;
+      continue;
+    }
+
+    unsigned lo = mask & 0xff;
+    unsigned hi = mask >> 8;
+    __m128i lo_shuffle
+      = _mm_loadl_epi64 ((const __m128i *) g_compact_shuffle[lo]);
+    __m128i hi_shuffle
+      = _mm_loadl_epi64 ((const __m128i *) g_compact_shuffle[hi]);
+
+    _mm_storel_epi64 ((__m128i *) (out + n), _mm_shuffle_epi8 (x, lo_shuffle));
+    n += 8 - __builtin_popcount (lo);
+    _mm_storel_epi64 (
+      (__m128i *) (out + n),
+      _mm_shuffle_epi8 (_mm_srli_si128 (x, 8), hi_shuffle)
+    );
+    n += 8 - __builtin_popcount (hi);
+  }
+
+  return n + base85_compact_generic (b + i, cb_b - i, out + n);
+}
+
+#endif
+
+#if defined (__SSE2__)
+static base85_compact_fn base85_compact = base85_compact_sse2;
+#else
+static base85_compact_fn base85_compact = base85_compact_generic;
+#endif
+
+/// Compaction kernels by b85_compact_kernel_t (NULL if not available in this
+/// build), and the kernel selected for B85_COMPACT_AUTO.
+static base85_compact_fn g_compact_kernels[B85_COMPACT_END] = {
+  [B85_COMPACT_GENERIC] = base85_compact_generic,
+#if defined (__SSE2__)
+  [B85_COMPACT_SSE2] = base85_compact_sse2,
+#endif
+};
+static b85_compact_kernel_t g_compact_auto;
+static b85_compact_kernel_t g_compact_kernel = B85_COMPACT_AUTO;
+
+/// Selects the best compaction kernel for the host.
+static void
+base85_compact_init ()
+{
+#if defined (B85_HAVE_SSSE3_COMPACT)
+  for (unsigned mask = 0; mask < 256; ++mask)
+  {
+    size_t n = 0;
+    for (uint8_t j = 0; j < 8; ++j)
+    {
+      if (!((mask >> j) & 1))
+        g_compact_shuffle[mask][n++] = j;
+    }
+    while (n < 8)
+      g_compact_shuffle[mask][n++] = 0x80;
+  }
+
+  if (__builtin_cpu_supports ("ssse3"))
+    g_compact_kernels[B85_COMPACT_SSSE3] = base85_compact_ssse3;
+#endif
+
+  for (int k = B85_COMPACT_END; --k > B85_COMPACT_AUTO; )
+  {
+    if (g_compact_kernels[k])
+    {
+      g_compact_auto = (b85_compact_kernel_t) k;
+      break;
+    }
+  }
+  base85_compact = g_compact_kernels[g_compact_auto];
+}
+
+/// Running checksums are updated in slices of this many input bytes, right
+/// before (encoding) or after (decoding) the slice is processed, while the
+/// binary data is still in cache.
+#define B85_CHECKSUM_SLICE 4096
+
+/// CRC-32C (Castagnoli) kernel: updates the raw (not inverted) CRC @a crc
+/// with @a cb_b bytes from @a b.
+typedef uint32_t (*base85_crc32c_fn) (
+  uint32_t crc, const uint8_t *b, size_t cb_b
+);
+
+/// Table for base85_crc32c_generic(), see base85_checksum_init().
+static uint32_t g_crc32c_table[256];
+
+static uint32_t
+base85_crc32c_generic (uint32_t crc, const uint8_t *b, size_t cb_b)
+{
+  while (cb_b--)
+    crc = g_crc32c_table[(crc ^ *b++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined (__SSE2__) && defined (__GNUC__)
+#define B85_HAVE_SSE42_CRC32C
+#include <nmmintrin.h>
+
+__attribute__ ((target ("sse4.2"))) static uint32_t
+base85_crc32c_sse42 (uint32_t crc, const uint8_t *b, size_t cb_b)
+{
+#if defined (__x86_64__)
+  uint64_t crc64 = crc;
+  for (; cb_b >= 8; cb_b -= 8, b += 8)
+  {
+    uint64_t v;
+    memcpy (&v, b, sizeof (v));
+    crc64 = _mm_crc32_u64 (crc64, v);
+  }
+  crc = (uint32_t) crc64;
+#endif
+
+  for (; cb_b >= 4; cb_b -= 4, b += 4)
+  {
+    uint32_t v;
+    memcpy (&v, b, sizeof (v));
+    crc = _mm_crc32_u32 (crc, v);
+  }
+
+  while (cb_b--)
+    crc = _mm_crc32_u8 (crc, *b++);
+  return crc;
+}
+#endif
+
+#if defined (__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+static uint32_t
+base85_crc32c_armv8 (uint32_t crc, const uint8_t *b, size_t cb_b)
+{
+  for (; cb_b >= 8; cb_b -= 8, b += 8)
+  {
+    uint64_t v;
+    memcpy (&v, b, sizeof (v));
+    crc = __crc32cd (crc, v);
+  }
+
+  while (cb_b--)
+    crc = __crc32cb (crc, *b++);
+  return crc;
+}
+
+static base85_crc32c_fn base85_crc32c_raw = base85_crc32c_armv8;
+#else
+static base85_crc32c_fn base85_crc32c_raw = base85_crc32c_generic;
+#endif
+
+/// Selects the best CRC-32C kernel for the host.
+static void
+base85_checksum_init ()
+{
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; ++j)
+      crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    g_crc32c_table[i] = crc;
+  }
+
+#if defined (B85_HAVE_SSE42_CRC32C)
+  if (__builtin_cpu_supports ("sse4.2"))
+    base85_crc32c_raw = base85_crc32c_sse42;
+#endif
+}
+
+/// Adds @a cb_b bytes from @a b to the running checksum of @a ctx.
+static inline void
+base85_checksum_update (
+  struct base85_context_t *ctx, const uint8_t *b, size_t cb_b
+)
+{
+  ctx->checksum = ~base85_crc32c_raw (~ctx->checksum, b, cb_b);
+}
+
+/// Fills in the tables of @a alphabet from its 85 characters @a chars.
+static void
+base85_alphabet_tables (
+  struct base85_alphabet_t *alphabet, const uint8_t *chars
+)
+{
+  memcpy (alphabet->encode, chars, dimof (alphabet->encode));
+  memset (alphabet->decode, 0, sizeof (alphabet->decode));
+  for (size_t i = 0; i < dimof (alphabet->encode); ++i)
+    alphabet->decode[chars[i]] = i + 1;
+}
+
+/// Selects the compaction kernel @a kernel (B85_SET_COMPACT_KERNEL() without
+/// the initialization).
+static b85_result_t
+base85_set_compact_kernel (b85_compact_kernel_t kernel)
+{
+  if (kernel < B85_COMPACT_AUTO || kernel >= B85_COMPACT_END)
+    return B85_E_API_MISUSE;
+
+  b85_compact_kernel_t k = B85_COMPACT_AUTO == kernel ? g_compact_auto : kernel;
+  if (!g_compact_kernels[k])
+    return B85_E_API_MISUSE;
+
+  base85_compact = g_compact_kernels[k];
+  g_compact_kernel = kernel;
+  return B85_E_OK;
+}
+
+/// Guards base85_init().
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+
+/// Selects the kernels for this CPU, and the compaction kernel of its cached
+/// tuning, if there is one.
+static void
+base85_init (void)
+{
+  base85_compact_init ();
+  base85_checksum_init ();
+
+  struct b85_tuning_t tuning;
+  if (B85_E_OK == B85_TUNING_LOAD (NULL, &tuning))
+    (void) base85_set_compact_kernel (tuning.compact);
+}
+
+/// Initializer for the library (may be called multiple times, from any
+/// thread).
+static void
+base85_decode_init ()
+{
+  pthread_once (&g_init_once, base85_init);
+}
+
+b85_result_t
+B85_SET_COMPACT_KERNEL (b85_compact_kernel_t kernel)
+{
+  base85_decode_init ();
+  return base85_set_compact_kernel (kernel);
+}
+
+b85_compact_kernel_t
+B85_GET_COMPACT_KERNEL (void)
+{
+  base85_decode_init ();
+  return B85_COMPACT_AUTO == g_compact_kernel ? g_compact_auto
+    : g_compact_kernel;
+}
+
+const uint8_t *
+B85_GET_ALPHABET (void)
+{
+  base85_decode_init ();
+  return B85_G_DEFAULT.encode;
+}
+
+const uint8_t *
+B85_GET_DECODE_TABLE (void)
+{
+  base85_decode_init ();
+  return B85_G_DEFAULT.decode;
+}
+
+const struct base85_alphabet_t *
+B85_ALPHABET_ASCII85 (void)
+{
+  base85_decode_init ();
+  return &g_ascii85;
+}
+
+const struct base85_alphabet_t *
+B85_ALPHABET_Z85 (void)
+{
+  base85_decode_init ();
+  return &g_z85;
+}
+
+const struct base85_alphabet_t *
+B85_ALPHABET_RFC1924 (void)
+{
+  base85_decode_init ();
+  return &g_rfc1924;
+}
+
+b85_result_t
+B85_ALPHABET_INIT (
+  struct base85_alphabet_t *alphabet, const char *chars, char zero_char,
+  int framed
+)
+{
+  if (!alphabet || !chars)
+    return B85_E_API_MISUSE;
+
+  uint8_t seen[256] = { 0 };
+  for (size_t i = 0; i < dimof (alphabet->encode); ++i)
+  {
+    uint8_t c = (uint8_t) chars[i];
+    if (!c || seen[c]++ || base85_whitespace (c))
+      return B85_E_API_MISUSE;
+  }
+
+  // The zero group character and the frame must be told apart from digits.
+  uint8_t z = (uint8_t) zero_char;
+  if (z && (seen[z] || base85_whitespace (z)))
+    return B85_E_API_MISUSE;
+
+  if (framed && (seen[B85_FOOTER0] || !seen[B85_HEADER0] || B85_FOOTER0 == z))
+    return B85_E_API_MISUSE;
+
+  base85_decode_init ();
+  base85_alphabet_tables (alphabet, (const uint8_t *) chars);
+  alphabet->zero_char = z;
+  alphabet->framed = !!framed;
+  alphabet->kernel = B85_K_GENERIC;
+  return B85_E_OK;
+}
+
 /// Returns the number of free bytes in the context's output buffer.
 static ptrdiff_t
 base85_context_bytes_remaining (struct base85_context_t *ctx)
@@ -220,39 +758,74 @@ base85_context_bytes_remaining (struct base85_context_t *ctx)
   return (ctx->out + ctx->out_cb) - ctx->out_pos;
 }
 
-/// Increases the size of the context's output buffer.
+/// Reallocates the context's output buffer to exactly @a size bytes.
+/// @pre @a size is at least the number of bytes currently in use.
 static b85_result_t
-base85_context_grow (struct base85_context_t *ctx)
+base85_context_resize (struct base85_context_t *ctx, size_t size)
 {
-  // How much additional memory to request if an allocation fails.
-  static const size_t SMALL_DELTA = 256;
-
-  // TODO: Refine size, and fallback strategy.
-  size_t size = ctx->out_cb * 2;
   ptrdiff_t offset = ctx->out_pos - ctx->out;
   uint8_t *buffer = realloc (ctx->out, size);
   if (!buffer)
-  {
-    // Try a smaller allocation.
-    buffer = realloc (ctx->out, ctx->out_cb + SMALL_DELTA);
-    if (!buffer)
-      return B85_E_BAD_ALLOC;
-  }
+    return B85_E_BAD_ALLOC;
 
+  B85_PROBE3 (context__grow, ctx, ctx->out_cb, size);
   ctx->out = buffer;
   ctx->out_cb = size;
   ctx->out_pos = ctx->out + offset;
   return B85_E_OK;
 }
 
+/// Increases the size of the context's output buffer so that at least
+/// @a request bytes are available.
+static b85_result_t
+base85_context_grow (struct base85_context_t *ctx, size_t request)
+{
+  // How much additional memory to request if an allocation fails.
+  static const size_t SMALL_DELTA = 256;
+
+  size_t needed = (ctx->out_pos - ctx->out) + request;
+  size_t size = ctx->out_cb * 2;
+  if (size < needed)
+    size = needed;
+
+  if (B85_E_OK == base85_context_resize (ctx, size))
+    return B85_E_OK;
+
+  // Try a smaller allocation.
+  return base85_context_resize (ctx, needed + SMALL_DELTA);
+}
+
 /// Makes sure there is at least @a request bytes available in @a ctx.
 static b85_result_t
 base85_context_request_memory (struct base85_context_t *ctx, size_t request)
 {
-  if (base85_context_bytes_remaining (ctx) >= request)
+  if (base85_context_bytes_remaining (ctx) >= (ptrdiff_t) request)
+    return B85_E_OK;
+
+  if ((ctx->flags & B85_F_DISCARD) && request <= ctx->out_cb)
+  {
+    ctx->out_pos = ctx->out;
     return B85_E_OK;
+  }
+
+  // Neither a caller's buffer nor a discarding context's scratch buffer may
+  // be reallocated.
+  if (ctx->flags & (B85_F_FIXED_OUTPUT | B85_F_DISCARD))
+    return B85_E_BUFFER_TOO_SMALL;
+
+  return base85_context_grow (ctx, request);
+}
 
-  return base85_context_grow (ctx);
+/// Marks @a ctx as an encoder or a decoder (@a direction is B85_F_ENCODER or
+/// B85_F_DECODER). Fails if it was used, or restored, the other way.
+static b85_result_t
+base85_context_direction (struct base85_context_t *ctx, uint8_t direction)
+{
+  if (ctx->flags & (B85_F_ENCODER | B85_F_DECODER) & ~direction)
+    return B85_E_BAD_STATE;
+
+  ctx->flags |= direction;
+  return B85_E_OK;
 }
 
 uint8_t *
@@ -271,6 +844,12 @@ B85_GET_PROCESSED (struct base85_context_t *ctx)
   return ctx ? ctx->processed : 0;
 }
 
+uint32_t
+B85_GET_CHECKSUM (struct base85_context_t *ctx)
+{
+  return ctx ? ctx->checksum : 0;
+}
+
 void
 B85_CLEAR_OUTPUT (struct base85_context_t *ctx)
 {
@@ -295,6 +874,10 @@ B85_CONTEXT_INIT (struct base85_context_t *ctx)
   ctx->processed = 0;
   ctx->pos = 0;
   ctx->state = B85_S_START;
+  ctx->flags = B85_F_LINE_START;
+  ctx->line_length = 0;
+  ctx->checksum = 0;
+  ctx->alphabet = &B85_G_DEFAULT;
 
   ctx->out = malloc (INITIAL_BUFFER_SIZE);
   if (!ctx->out)
@@ -302,84 +885,542 @@ B85_CONTEXT_INIT (struct base85_context_t *ctx)
 
   ctx->out_pos = ctx->out;
   ctx->out_cb = INITIAL_BUFFER_SIZE;
+  B85_PROBE2 (context__init, ctx, ctx->out_cb);
   return B85_E_OK;
 }
 
-void
-B85_CONTEXT_RESET (struct base85_context_t *ctx)
+b85_result_t
+B85_CONTEXT_INIT_FIXED (
+  struct base85_context_t *ctx, uint8_t *out, size_t out_cb
+)
 {
-  if (!ctx)
-    return;
+  base85_decode_init ();
 
-  // Do not reset out or out_cb.
+  if (!ctx || (out_cb && !out))
+    return B85_E_API_MISUSE;
 
-  ctx->out_pos = ctx->out;
-  ctx->processed = 0;
-  ctx->pos = 0;
-  ctx->state = B85_S_START;
+  *ctx = (struct base85_context_t) {
+    .out = out,
+    .out_pos = out,
+    .out_cb = out_cb,
+    .state = B85_S_START,
+    .flags = B85_F_LINE_START | B85_F_FIXED_OUTPUT,
+    .alphabet = &B85_G_DEFAULT,
+  };
+  B85_PROBE2 (context__init, ctx, ctx->out_cb);
+  return B85_E_OK;
 }
 
-void
-B85_CONTEXT_DESTROY (struct base85_context_t *ctx)
+b85_result_t
+B85_CONTEXT_RESERVE (struct base85_context_t *ctx, size_t cb)
+{
+  if (!ctx)
+    return B85_E_API_MISUSE;
+
+  if (base85_context_bytes_remaining (ctx) >= (ptrdiff_t) cb)
+    return B85_E_OK;
+
+  if (ctx->flags & B85_F_FIXED_OUTPUT)
+    return B85_E_BUFFER_TOO_SMALL;
+
+  return base85_context_resize (ctx, (ctx->out_pos - ctx->out) + cb);
+}
+
+void
+B85_CONTEXT_RESET (struct base85_context_t *ctx)
+{
+  if (!ctx)
+    return;
+
+  // Do not reset out or out_cb.
+
+  ctx->out_pos = ctx->out;
+  ctx->processed = 0;
+  ctx->pos = 0;
+  ctx->state = B85_S_START;
+  ctx->flags |= B85_F_LINE_START;
+  ctx->flags &= ~(B85_F_TRANSCODE | B85_F_ENCODER | B85_F_DECODER);
+  ctx->checksum = 0;
+}
+
+b85_result_t
+B85_CONTEXT_SET_CHECKSUM (struct base85_context_t *ctx, int enabled)
+{
+  if (!ctx)
+    return B85_E_API_MISUSE;
+
+  if (enabled)
+    ctx->flags |= B85_F_CHECKSUM;
+  else
+    ctx->flags &= ~B85_F_CHECKSUM;
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_CONTEXT_SET_ALPHABET (
+  struct base85_context_t *ctx, const struct base85_alphabet_t *alphabet
+)
+{
+  if (!ctx || !alphabet || alphabet->kernel >= B85_K_END || ctx->processed)
+    return B85_E_API_MISUSE;
+
+  ctx->alphabet = alphabet;
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_CONTEXT_SET_LINE_LENGTH (struct base85_context_t *ctx, size_t line_length)
+{
+  if (!ctx)
+    return B85_E_API_MISUSE;
+
+  ctx->line_length = line_length;
+  return B85_E_OK;
+}
+
+/// Saved context state header: magic, version.
+static const uint8_t B85_STATE_MAGIC[] = { 'B', '8', '5', 'C', 2 };
+
+/// Context flags that are part of the saved state. The others describe the
+/// output buffer.
+static const uint8_t B85_STATE_FLAGS = B85_F_LINE_START | B85_F_TRANSCODE
+  | B85_F_CHECKSUM | B85_F_ENCODER | B85_F_DECODER;
+
+/// Alphabet tags of the saved state, by kernel. Custom alphabets cannot be
+/// told apart from each other.
+static const uint8_t B85_STATE_ALPHABETS[B85_K_END] = {
+  [B85_K_GENERIC] = 'C',
+  [B85_K_ASCII85] = 'A',
+  [B85_K_Z85] = 'Z',
+  [B85_K_RFC1924] = 'R',
+};
+
+/// Stores the low @a n bytes of @a v at @a b, least significant first.
+static uint8_t *
+base85_put_le (uint64_t v, size_t n, uint8_t *b)
+{
+  for (size_t i = 0; i < n; ++i, v >>= 8)
+    *b++ = v & 0xff;
+  return b;
+}
+
+/// Reads an @a n byte little endian value from @a b.
+static uint64_t
+base85_get_le (const uint8_t **b, size_t n)
+{
+  uint64_t v = 0;
+  for (size_t i = n; i--; )
+    v = v << 8 | (*b)[i];
+  *b += n;
+  return v;
+}
+
+b85_result_t
+B85_CONTEXT_SAVE (
+  const struct base85_context_t *ctx, uint8_t b[B85_CONTEXT_STATE_SIZE]
+)
+{
+  if (!ctx || !b)
+    return B85_E_API_MISUSE;
+
+  memcpy (b, B85_STATE_MAGIC, dimof (B85_STATE_MAGIC));
+  b += dimof (B85_STATE_MAGIC);
+  *b++ = B85_STATE_ALPHABETS[ctx->alphabet->kernel];
+  *b++ = ctx->flags & B85_STATE_FLAGS;
+  *b++ = ctx->state;
+  *b++ = (uint8_t) ctx->pos;
+  memcpy (b, ctx->hold, sizeof (ctx->hold));
+  b += sizeof (ctx->hold);
+  b = base85_put_le (ctx->processed, 8, b);
+  b = base85_put_le (ctx->line_length, 8, b);
+  base85_put_le (ctx->checksum, 4, b);
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_CONTEXT_RESTORE (
+  struct base85_context_t *ctx, const uint8_t b[B85_CONTEXT_STATE_SIZE]
+)
+{
+  if (!ctx || !b)
+    return B85_E_API_MISUSE;
+
+  if (memcmp (b, B85_STATE_MAGIC, dimof (B85_STATE_MAGIC)))
+    return B85_E_BAD_STATE;
+  b += dimof (B85_STATE_MAGIC);
+
+  // An encoder holds at most 3 bytes, a decoder at most 4 digits, and a
+  // context that has not processed anything holds nothing.
+  uint8_t alphabet = *b++;
+  uint8_t flags = *b++;
+  uint8_t state = *b++;
+  uint8_t pos = *b++;
+  uint8_t direction = flags & (B85_F_ENCODER | B85_F_DECODER);
+  size_t max_pos = B85_F_ENCODER == direction ? 3
+    : B85_F_DECODER == direction ? 4 : 0;
+  if (B85_STATE_ALPHABETS[ctx->alphabet->kernel] != alphabet
+    || (flags & ~B85_STATE_FLAGS) || state >= B85_S_END || pos > max_pos)
+  {
+    return B85_E_BAD_STATE;
+  }
+
+  uint8_t hold[sizeof (ctx->hold)];
+  memcpy (hold, b, sizeof (hold));
+  b += sizeof (hold);
+  uint64_t processed = base85_get_le (&b, 8);
+  uint64_t line_length = base85_get_le (&b, 8);
+  uint32_t checksum = (uint32_t) base85_get_le (&b, 4);
+  if (processed > SIZE_MAX || line_length > SIZE_MAX)
+    return B85_E_BAD_STATE;
+
+  memcpy (ctx->hold, hold, sizeof (hold));
+  ctx->pos = pos;
+  ctx->processed = (size_t) processed;
+  ctx->state = state;
+  ctx->flags = (ctx->flags & ~B85_STATE_FLAGS) | flags;
+  ctx->line_length = (size_t) line_length;
+  ctx->checksum = checksum;
+  ctx->out_pos = ctx->out;
+  return B85_E_OK;
+}
+
+void
+B85_CONTEXT_DESTROY (struct base85_context_t *ctx)
 {
   if (!ctx)
     return;
 
+  B85_PROBE3 (context__destroy, ctx, ctx->out_cb, ctx->processed);
   uint8_t *out = ctx->out;
   ctx->out = NULL;
   ctx->out_pos = NULL;
   ctx->out_cb = 0;
-  free (out);
+  if (!(ctx->flags & B85_F_FIXED_OUTPUT))
+    free (out);
+}
+
+/// Returns the length of the run of @a c bytes at the start of @a b.
+static size_t
+base85_byte_run (const uint8_t *b, size_t cb_b, uint8_t c)
+{
+  size_t i = 0;
+
+#if defined (__SSE2__)
+  const __m128i x = _mm_set1_epi8 ((char) c);
+  for (; i + 16 <= cb_b; i += 16)
+  {
+    __m128i y = _mm_loadu_si128 ((const __m128i *) (b + i));
+    unsigned mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (x, y));
+    if (0xffff != mask)
+      return i + __builtin_ctz (~mask);
+  }
+#endif
+
+  while (i < cb_b && c == b[i])
+    ++i;
+  return i;
+}
+
+/// Reads a big-endian 32-bit value from @a b.
+static inline uint32_t
+base85_load_be32 (const uint8_t *b)
+{
+  return (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16
+    | (uint32_t) b[2] << 8 | (uint32_t) b[3];
+}
+
+/// Writes @a v to @a b as a big-endian 32-bit value.
+static inline void
+base85_store_be32 (uint32_t v, uint8_t *b)
+{
+  b[0] = (v >> 24) & 0xff;
+  b[1] = (v >> 16) & 0xff;
+  b[2] = (v >> 8) & 0xff;
+  b[3] = v & 0xff;
+}
+
+/// Encodes @a v as exactly 5 characters of the @a encode table, stored in
+/// @a out.
+static B85_ALWAYS_INLINE void
+base85_encode_word (uint32_t v, const uint8_t *encode, uint8_t *out)
+{
+  for (int c = 4; c >= 0; --c)
+  {
+    out[c] = encode[v % 85];
+    v /= 85;
+  }
 }
 
 static b85_result_t
 base85_encode_strict (struct base85_context_t *ctx)
 {
-  uint8_t *h = ctx->hold;
-  uint32_t v = h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+  uint32_t v = base85_load_be32 (ctx->hold);
 
   ctx->pos = 0;
 
   b85_result_t rv = B85_E_UNSPECIFIED;
 
-#if !defined (B85_ZEROMQ)
-  if (!v)
+  if (!v && ctx->alphabet->zero_char)
   {
     rv = base85_context_request_memory (ctx, 1);
     if (rv)
       return rv;
-    *ctx->out_pos = B85_ZERO_CHAR;
+    *ctx->out_pos = ctx->alphabet->zero_char;
     ctx->out_pos++;
     return B85_E_OK;
   }
-#endif
 
   rv = base85_context_request_memory (ctx, 5);
   if (rv)
     return rv;
 
-  for (int c = 4; c >= 0; --c)
-  {
-    ctx->out_pos[c] = B85_G_ENCODE[v % 85];
-    v /= 85;
-  }
+  base85_encode_word (v, ctx->alphabet->encode, ctx->out_pos);
   ctx->out_pos += 5;
   return B85_E_OK;
 }
 
-b85_result_t
-B85_ENCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+/// Encodes @a n complete groups from @a b to @a out with the @a encode table,
+/// abbreviating zero groups to @a zero_char unless it is zero. Returns the end
+/// of the output.
+static B85_ALWAYS_INLINE uint8_t *
+base85_encode_groups (
+  const uint8_t *b, size_t n, uint8_t *out, const uint8_t *encode,
+  uint8_t zero_char
+)
 {
-  if (!ctx || (cb_b && !b))
-    return B85_E_API_MISUSE;
+  for (size_t i = 0; i < n; )
+  {
+    uint32_t v = base85_load_be32 (b);
 
-  if (!cb_b)
-    return B85_E_OK;
+    if (zero_char && !v)
+    {
+      // Sparse input tends to come in long runs of zero groups.
+      size_t run = base85_byte_run (b, (n - i) * 4, 0) / 4;
+      memset (out, zero_char, run);
+      out += run;
+      b += run * 4;
+      i += run;
+      continue;
+    }
 
-  while (cb_b--)
+    base85_encode_word (v, encode, out);
+    out += 5;
+    b += 4;
+    ++i;
+  }
+  return out;
+}
+
+/// Decodes up to @a n complete groups from @a b into @a out with the @a decode
+/// table. Stops at the first group that contains a byte outside of the
+/// alphabet (whitespace, 'z', '~', invalid characters) or that overflows.
+/// Returns the number of groups decoded.
+static B85_ALWAYS_INLINE size_t
+base85_decode_checked (
+  const uint8_t *b, size_t n, uint8_t *out, const uint8_t *decode
+)
+{
+  size_t i = 0;
+  for (; i < n; ++i, b += 5, out += 4)
+  {
+    uint32_t d0 = decode[b[0]];
+    uint32_t d1 = decode[b[1]];
+    uint32_t d2 = decode[b[2]];
+    uint32_t d3 = decode[b[3]];
+    uint32_t d4 = decode[b[4]];
+    if (!d0 || !d1 || !d2 || !d3 || !d4)
+      break;
+
+    // The decode table is offset by one (zero marks invalid entries).
+    uint64_t v = (((((uint64_t) d0 * 85 + d1) * 85 + d2) * 85 + d3) * 85 + d4)
+      - (1 + 85 + 85 * 85 + 85 * 85 * 85 + 85 * 85 * 85 * 85);
+    if (v > 0xffffffff)
+      break;
+
+    base85_store_be32 ((uint32_t) v, out);
+  }
+  return i;
+}
+
+/// Number of groups per validity check of base85_decode_groups(). Small, so
+/// that little work is repeated when a batch stops early at a 'z' group or at
+/// the footer.
+#define B85_DECODE_BATCH 16
+
+/// Decodes @a n complete groups from @a b into @a out without branching on
+/// the input: invalid characters (whose decode table entry is zero, so that
+/// the digit wraps around) and overflowing groups are only accumulated, and
+/// the output of such groups is garbage. Returns true if all groups were
+/// valid.
+static B85_ALWAYS_INLINE bool
+base85_decode_batch (
+  const uint8_t *b, size_t n, uint8_t *out, const uint8_t *decode
+)
+{
+  uint32_t digits = 0;
+  uint64_t words = 0;
+  for (size_t i = 0; i < n; ++i, b += 5, out += 4)
+  {
+    uint32_t d0 = decode[b[0]] - 1;
+    uint32_t d1 = decode[b[1]] - 1;
+    uint32_t d2 = decode[b[2]] - 1;
+    uint32_t d3 = decode[b[3]] - 1;
+    uint32_t d4 = decode[b[4]] - 1;
+    digits |= d0 | d1 | d2 | d3 | d4;
+
+    uint64_t v = (((((uint64_t) d0 * 85 + d1) * 85 + d2) * 85 + d3) * 85 + d4);
+    words |= v;
+    base85_store_be32 ((uint32_t) v, out);
+  }
+
+  // Valid digits are below 128, and valid groups fit in 32 bits.
+  return !(digits >> 7) && !(words >> 32);
+}
+
+/// Decodes like base85_decode_checked(), one batch of B85_DECODE_BATCH groups
+/// at a time. Only a batch that contains an error (or any other character
+/// that stops a bulk kernel) is decoded again by base85_decode_checked(), to
+/// find the group where decoding stops.
+/// @pre The input is not overwritten by the output (not in place).
+static B85_ALWAYS_INLINE size_t
+base85_decode_groups (
+  const uint8_t *b, size_t n, uint8_t *out, const uint8_t *decode
+)
+{
+  for (size_t i = 0; i < n; i += B85_DECODE_BATCH)
+  {
+    size_t m = n - i < B85_DECODE_BATCH ? n - i : B85_DECODE_BATCH;
+    if (!base85_decode_batch (b + i * 5, m, out + i * 4, decode))
+      return i + base85_decode_checked (b + i * 5, m, out + i * 4, decode);
+  }
+  return n;
+}
+
+/// Bulk kernels of an alphabet, see base85_encode_groups() and
+/// base85_decode_groups().
+typedef uint8_t *(*base85_encode_fn) (
+  const uint8_t *b, size_t n, uint8_t *out,
+  const struct base85_alphabet_t *alphabet
+);
+typedef size_t (*base85_decode_fn) (
+  const uint8_t *b, size_t n, uint8_t *out,
+  const struct base85_alphabet_t *alphabet
+);
+
+/// Defines the kernels of a built-in alphabet, which use the tables of the
+/// constant @a table and the constant @a zero_char instead of those of the
+/// alphabet passed in.
+#define B85_DEFINE_KERNELS(name, table, zero_char) \
+static uint8_t * \
+base85_encode_##name ( \
+  const uint8_t *b, size_t n, uint8_t *out, \
+  const struct base85_alphabet_t *alphabet \
+) \
+{ \
+  (void) alphabet; \
+  return base85_encode_groups (b, n, out, table.encode, zero_char); \
+} \
+\
+static size_t \
+base85_decode_##name ( \
+  const uint8_t *b, size_t n, uint8_t *out, \
+  const struct base85_alphabet_t *alphabet \
+) \
+{ \
+  (void) alphabet; \
+  return base85_decode_groups (b, n, out, table.decode); \
+}
+
+B85_DEFINE_KERNELS (ascii85, g_ascii85, B85_ZERO_CHAR)
+B85_DEFINE_KERNELS (z85, g_z85, 0)
+B85_DEFINE_KERNELS (rfc1924, g_rfc1924, 0)
+
+static uint8_t *
+base85_encode_generic (
+  const uint8_t *b, size_t n, uint8_t *out,
+  const struct base85_alphabet_t *alphabet
+)
+{
+  return base85_encode_groups (
+    b, n, out, alphabet->encode, alphabet->zero_char
+  );
+}
+
+static size_t
+base85_decode_generic (
+  const uint8_t *b, size_t n, uint8_t *out,
+  const struct base85_alphabet_t *alphabet
+)
+{
+  return base85_decode_groups (b, n, out, alphabet->decode);
+}
+
+/// Decode kernel for in place decoding: base85_decode_groups() may have to
+/// read a batch again after its output has overwritten it.
+static size_t
+base85_decode_inplace (
+  const uint8_t *b, size_t n, uint8_t *out,
+  const struct base85_alphabet_t *alphabet
+)
+{
+  return base85_decode_checked (b, n, out, alphabet->decode);
+}
+
+static const struct
+{
+  base85_encode_fn encode;
+  base85_decode_fn decode;
+} g_kernels[B85_K_END] = {
+  [B85_K_GENERIC] = { base85_encode_generic, base85_decode_generic },
+  [B85_K_ASCII85] = { base85_encode_ascii85, base85_decode_ascii85 },
+  [B85_K_Z85] = { base85_encode_z85, base85_decode_z85 },
+  [B85_K_RFC1924] = { base85_encode_rfc1924, base85_decode_rfc1924 },
+};
+
+/// Encodes as many complete groups as possible directly from @a b, bypassing
+/// the hold. Returns the number of bytes consumed.
+/// @pre The hold is empty.
+static size_t
+base85_encode_bulk (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+{
+  size_t n = cb_b / 4;
+  if (!n)
+    return 0;
+
+  // On failure, leave the input to base85_encode_strict() so that the error
+  // is reported from there.
+  if (base85_context_request_memory (ctx, n * 5))
+    return 0;
+
+  const struct base85_alphabet_t *alphabet = ctx->alphabet;
+  ctx->out_pos = g_kernels[alphabet->kernel].encode (
+    b, n, ctx->out_pos, alphabet
+  );
+  ctx->processed += n * 4;
+  return n * 4;
+}
+
+/// Encodes @a cb_b bytes from @a b. Groups that straddle calls are assembled
+/// in the hold, everything else goes through base85_encode_bulk().
+static b85_result_t
+base85_encode_input (
+  const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
+)
+{
+  while (cb_b)
   {
+    if (!ctx->pos)
+    {
+      size_t n = base85_encode_bulk (b, cb_b, ctx);
+      b += n;
+      cb_b -= n;
+      if (!cb_b)
+        break;
+    }
+
     ctx->hold[ctx->pos++] = *b++;
     ctx->processed++;
+    cb_b--;
     if (4 == ctx->pos)
     {
       b85_result_t rv = base85_encode_strict (ctx);
@@ -391,13 +1432,114 @@ B85_ENCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
   return B85_E_OK;
 }
 
+/// base85_encode_input(), plus the checksum of the input if enabled.
+static b85_result_t
+base85_encode_bytes (
+  const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
+)
+{
+  b85_result_t rv = base85_context_direction (ctx, B85_F_ENCODER);
+  if (rv)
+    return rv;
+
+  if (!(ctx->flags & B85_F_CHECKSUM))
+    return base85_encode_input (b, cb_b, ctx);
+
+  while (cb_b)
+  {
+    // Only the bytes that were consumed count, also on failure.
+    size_t slice = cb_b < B85_CHECKSUM_SLICE ? cb_b : B85_CHECKSUM_SLICE;
+    size_t processed = ctx->processed;
+    rv = base85_encode_input (b, slice, ctx);
+    base85_checksum_update (ctx, b, ctx->processed - processed);
+    if (rv)
+      return rv;
+    b += slice;
+    cb_b -= slice;
+  }
+
+  return B85_E_OK;
+}
+
+/// Fires the error probe if @a rv is an error, and returns @a rv.
+static inline b85_result_t
+base85_trace_result (const struct base85_context_t *ctx, b85_result_t rv)
+{
+  if (rv)
+    B85_PROBE3 (error, ctx, rv, ctx->processed);
+  return rv;
+}
+
+/// Returns the total length of the @a iovcnt buffers in @a iov, or
+/// SIZE_MAX if the array is malformed or the total does not fit (with room
+/// for a partial group in the hold).
+static size_t
+base85_iov_length (const struct iovec *iov, int iovcnt)
+{
+  if (iovcnt < 0 || (iovcnt && !iov))
+    return SIZE_MAX;
+
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i)
+  {
+    if (iov[i].iov_len && !iov[i].iov_base)
+      return SIZE_MAX;
+    if (iov[i].iov_len > SIZE_MAX - 8 - total)
+      return SIZE_MAX;
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+b85_result_t
+B85_ENCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+{
+  if (!ctx || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  if (!cb_b)
+    return B85_E_OK;
+
+  B85_PROBE2 (encode__start, ctx, cb_b);
+  b85_result_t rv = base85_encode_bytes (b, cb_b, ctx);
+  B85_PROBE4 (encode__done, ctx, rv, ctx->processed, ctx->out_pos - ctx->out);
+  return base85_trace_result (ctx, rv);
+}
+
+b85_result_t
+B85_ENCODEV (
+  const struct iovec *iov, int iovcnt, struct base85_context_t *ctx
+)
+{
+  size_t total = base85_iov_length (iov, iovcnt);
+  if (!ctx || SIZE_MAX == total)
+    return B85_E_API_MISUSE;
+
+  // Reserve the output for the whole chain up front, so that fragment
+  // boundaries do not cause additional reallocations.
+  b85_result_t rv = base85_context_request_memory (
+    ctx, (total + ctx->pos) / 4 * 5
+  );
+  if (rv)
+    return rv;
+
+  B85_PROBE2 (encode__start, ctx, total);
+  for (int i = 0; i < iovcnt && B85_E_OK == rv; ++i)
+    rv = base85_encode_bytes (iov[i].iov_base, iov[i].iov_len, ctx);
+  B85_PROBE4 (encode__done, ctx, rv, ctx->processed, ctx->out_pos - ctx->out);
+  return base85_trace_result (ctx, rv);
+}
+
 b85_result_t
 B85_ENCODE_LAST (struct base85_context_t *ctx)
 {
   if (!ctx)
     return B85_E_API_MISUSE;
 
-  b85_result_t rv = B85_E_UNSPECIFIED;
+  b85_result_t rv = base85_context_direction (ctx, B85_F_ENCODER);
+  if (rv)
+    return rv;
+
   size_t pos = ctx->pos;
   if (!pos)
   {
@@ -407,27 +1549,58 @@ B85_ENCODE_LAST (struct base85_context_t *ctx)
     return rv;
   }
 
+  // The trailing partial group is never abbreviated to 'z', it always emits
+  // pos + 1 characters (followed by a NUL terminator).
+  rv = base85_context_request_memory (ctx, pos + 2);
+  if (rv)
+    return rv;
+
   for (size_t i = pos; i < 4; ++i)
     ctx->hold[i] = 0;
 
-  rv = base85_encode_strict (ctx);
-  if (B85_E_OK == rv)
+  uint8_t group[5];
+  base85_encode_word (
+    base85_load_be32 (ctx->hold), ctx->alphabet->encode, group
+  );
+  memcpy (ctx->out_pos, group, pos + 1);
+  ctx->out_pos += pos + 1;
+  *ctx->out_pos = 0;
+  ctx->pos = 0;
+  return B85_E_OK;
+}
+
+/// Writes the group @a v (digits @a d) in the @a target alphabet to @a out.
+/// Only complete groups (@a cb_digits == 5) are abbreviated to the zero group
+/// character. Returns the number of characters written.
+static inline size_t
+base85_transcode_group (
+  uint32_t v, const uint8_t *d, size_t cb_digits,
+  const struct base85_alphabet_t *target, uint8_t *out
+)
+{
+  if (!v && 5 == cb_digits && target->zero_char)
   {
-    ctx->out_pos -= 4 - pos;
-    *ctx->out_pos = 0;
+    *out = target->zero_char;
+    return 1;
   }
-  return rv;
+
+  for (size_t i = 0; i < cb_digits; ++i)
+    out[i] = target->encode[d[i]];
+  return cb_digits;
 }
 
-/// Decodes exactly 5 bytes from the decode context.
+/// Decodes exactly 5 bytes from the decode context, and emits the first
+/// @a cb_out (at most 4) bytes of the result. When transcoding, the
+/// corresponding cb_out + 1 characters are emitted instead.
 static b85_result_t
-base85_decode_strict (struct base85_context_t *ctx)
+base85_decode_strict (struct base85_context_t *ctx, size_t cb_out)
 {
   uint32_t v = 0;
   uint8_t *b = ctx->hold;
+  bool transcode = ctx->flags & B85_F_TRANSCODE;
 
   b85_result_t rv = B85_E_UNSPECIFIED;
-  rv = base85_context_request_memory (ctx, 4);
+  rv = base85_context_request_memory (ctx, cb_out + transcode);
   if (rv)
     return rv;
 
@@ -440,27 +1613,141 @@ base85_decode_strict (struct base85_context_t *ctx)
 
   v += b[4];
 
-  for (int c = 24; c >= 0; c -= 8)
+  if (transcode)
   {
-    *(ctx->out_pos) = (v >> c) & 0xff;
-    ctx->out_pos++;
+    ctx->out_pos += base85_transcode_group (
+      v, b, cb_out + 1, base85_transcode_alphabet (ctx->alphabet),
+      ctx->out_pos
+    );
+  }
+  else if (4 == cb_out)
+  {
+    base85_store_be32 (v, ctx->out_pos);
+    ctx->out_pos += 4;
+  }
+  else
+  {
+    for (size_t i = 0; i < cb_out; ++i)
+      ctx->out_pos[i] = (v >> (24 - 8 * i)) & 0xff;
+    ctx->out_pos += cb_out;
   }
 
   ctx->pos = 0;
   return B85_E_OK;
 }
 
-b85_result_t
-B85_DECODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+/// True if whole groups can be decoded directly from the input, i.e. the hold
+/// is empty and no header/footer transition is pending.
+static inline bool
+base85_bulk_state (const struct base85_context_t *ctx)
 {
-  if (!ctx || (cb_b && !b))
-    return B85_E_API_MISUSE;
+  return !ctx->pos
+    && (B85_S_NO_HEADER == ctx->state || B85_S_HEADER == ctx->state);
+}
 
-  if (!cb_b)
-    return B85_E_OK;
+/// Maximum number of groups handled by one pass of a bulk kernel. Keeps the
+/// output of a pass small enough to stay in cache, and bounds the memory that
+/// is requested at once.
+#define B85_BULK_GROUPS 1024
+
+/// Transcoding counterpart of base85_decode_groups(): converts up to @a n
+/// complete groups from @a b in the @a source alphabet to the @a target
+/// alphabet at @a *out, and advances @a *out. Returns the number of groups
+/// converted.
+static size_t
+base85_transcode_block (
+  const uint8_t *b, size_t n, const struct base85_alphabet_t *source,
+  const struct base85_alphabet_t *target, uint8_t **out
+)
+{
+  uint8_t *o = *out;
+  size_t i = 0;
+  for (; i < n; ++i, b += 5)
+  {
+    uint8_t d[5];
+    for (int c = 0; c < 5; ++c)
+      d[c] = source->decode[b[c]];
+    if (!d[0] || !d[1] || !d[2] || !d[3] || !d[4])
+      break;
+
+    for (int c = 0; c < 5; ++c)
+      d[c]--;
+
+    uint64_t v = (((((uint64_t) d[0] * 85 + d[1]) * 85 + d[2]) * 85 + d[3])
+      * 85 + d[4]);
+    if (v > 0xffffffff)
+      break;
+
+    o += base85_transcode_group ((uint32_t) v, d, 5, target, o);
+  }
+
+  *out = o;
+  return i;
+}
+
+/// Decodes as many complete groups as possible directly from @a b. The group
+/// that stops the bulk kernel is left for the per-character path, which
+/// also takes care of reporting errors. Returns the number of bytes consumed.
+/// @pre base85_bulk_state (ctx)
+static size_t
+base85_decode_bulk (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+{
+  bool transcode = ctx->flags & B85_F_TRANSCODE;
+  const struct base85_alphabet_t *alphabet = ctx->alphabet;
+  base85_decode_fn decode = (ctx->flags & B85_F_IN_PLACE)
+    ? base85_decode_inplace : g_kernels[alphabet->kernel].decode;
+  size_t width = transcode ? 5 : 4;
+  size_t consumed = 0;
+  size_t n = cb_b / 5;
+  while (n)
+  {
+    size_t block = n < B85_BULK_GROUPS ? n : B85_BULK_GROUPS;
+
+    // Use whatever space is available before asking for more. The group
+    // count is only an upper bound (the input may contain whitespace or the
+    // footer), so this keeps a buffer that was sized with
+    // B85_CONTEXT_RESERVE() from being grown.
+    size_t avail = base85_context_bytes_remaining (ctx) / width;
+    if (avail < block)
+    {
+      if (avail)
+        block = avail;
+      else if (base85_context_request_memory (ctx, block * width))
+        break;
+    }
 
+    size_t done;
+    if (transcode)
+    {
+      done = base85_transcode_block (
+        b + consumed, block, alphabet, base85_transcode_alphabet (alphabet),
+        &ctx->out_pos
+      );
+    }
+    else
+    {
+      done = decode (b + consumed, block, ctx->out_pos, alphabet);
+      ctx->out_pos += done * 4;
+    }
+    consumed += done * 5;
+    n -= done;
+    if (done != block)
+      break;
+  }
+
+  ctx->processed += consumed;
+  return consumed;
+}
+
+/// Decodes @a cb_b bytes from @a b, alternating between base85_decode_bulk()
+/// and the per-character state machine.
+static b85_result_t
+base85_decode_scalar (
+  const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
+)
+{
   b85_result_t rv = B85_E_UNSPECIFIED;
-  while (cb_b--)
+  while (cb_b)
   {
     // Skip all input if a valid footer has already been found.
     if (B85_S_FOOTER == ctx->state)
@@ -469,8 +1756,18 @@ B85_DECODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
     if (B85_S_INVALID == ctx->state)
       return B85_E_BAD_FOOTER;
 
+    if (base85_bulk_state (ctx))
+    {
+      size_t n = base85_decode_bulk (b, cb_b, ctx);
+      b += n;
+      cb_b -= n;
+      if (!cb_b)
+        break;
+    }
+
     uint8_t c = *b++;
     ctx->processed++;
+    cb_b--;
 
     if (base85_can_skip (c, (b85_state_t) ctx->state))
       continue;
@@ -478,60 +1775,1179 @@ B85_DECODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
     if (base85_handle_state (c, ctx))
       continue;
 
-#if !defined (B85_ZEROMQ)
-    // Special case for 'z'.
-    if (B85_ZERO_CHAR == c && !ctx->pos)
+    uint8_t x = ctx->alphabet->decode[c];
+    if (!x--)
     {
-      rv = base85_context_request_memory (ctx, 4);
-      if (rv)
+      // Special case for 'z' (not a digit), consecutive 'z' groups are filled
+      // in bulk.
+      uint8_t zero_char = ctx->alphabet->zero_char;
+      if (zero_char != c || !zero_char || ctx->pos)
+        return B85_E_INVALID_CHAR;
+
+      size_t run = 1 + base85_byte_run (b, cb_b, zero_char);
+      if (ctx->flags & B85_F_TRANSCODE)
+      {
+        const struct base85_alphabet_t *target
+          = base85_transcode_alphabet (ctx->alphabet);
+        size_t width = target->zero_char ? 1 : 5;
+        rv = base85_context_request_memory (ctx, run * width);
+        if (rv)
+          return rv;
+
+        memset (
+          ctx->out_pos, target->zero_char ? target->zero_char
+            : target->encode[0],
+          run * width
+        );
+        ctx->out_pos += run * width;
+      }
+      else
+      {
+        // The scratch buffer of a discarding context is never grown, and its
+        // contents do not matter.
+        size_t cb = run * 4;
+        if ((ctx->flags & B85_F_DISCARD) && cb > ctx->out_cb)
+          cb = ctx->out_cb / 4 * 4;
+
+        rv = base85_context_request_memory (ctx, cb);
+        if (rv)
+          return rv;
+
+        memset (ctx->out_pos, 0, cb);
+        ctx->out_pos += cb;
+      }
+      ctx->processed += run - 1;
+      b += run - 1;
+      cb_b -= run - 1;
+      continue;
+    }
+
+    ctx->hold[ctx->pos++] = x;
+    if (5 == ctx->pos)
+    {
+      rv = base85_decode_strict (ctx, 4);
+      if (rv)
         return rv;
+    }
+  }
+
+  return B85_E_OK;
+}
+
+/// Returns the length of the separator (LF or CRLF) that follows a line of
+/// exactly ctx->line_length characters at the start of @a b, or zero if the
+/// input does not match the prediction (or is too short to tell).
+static size_t
+base85_predict_line (
+  const uint8_t *b, size_t cb_b, const struct base85_context_t *ctx
+)
+{
+  size_t n = ctx->line_length;
+  if (cb_b > n && '\n' == b[n])
+    return 1;
+  if (cb_b > n + 1 && '\r' == b[n] && '\n' == b[n + 1])
+    return 2;
+  return 0;
+}
+
+/// Decodes @a cb_b bytes from @a b. Between the header and the footer, the
+/// input is processed in blocks that are stripped of whitespace by the
+/// compaction kernel first, so base85_decode_bulk() sees whole groups even in
+/// line wrapped input. Blocks end before any '~', which always goes through
+/// the header/footer state machine.
+static b85_result_t
+base85_decode_input (
+  const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
+)
+{
+  // In place, the block may already be overwritten by the time an error has
+  // to be located, see below.
+  if (ctx->flags & B85_F_IN_PLACE)
+    return base85_decode_scalar (b, cb_b, ctx);
+
+  uint8_t compact[B85_COMPACT_BLOCK + B85_COMPACT_SLACK];
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  while (cb_b)
+  {
+    bool bulk_state
+      = B85_S_NO_HEADER == ctx->state || B85_S_HEADER == ctx->state;
+
+    // Fixed line length hint: the line body is decoded as is, and only the
+    // predicted separator is checked. Any mismatch (including lines that
+    // straddle calls) falls back to the general path up to the next LF.
+    if (ctx->line_length && bulk_state && (ctx->flags & B85_F_LINE_START))
+    {
+      size_t sep = base85_predict_line (b, cb_b, ctx);
+      if (sep)
+      {
+        rv = base85_decode_scalar (b, ctx->line_length, ctx);
+        if (rv)
+          return rv;
+        b += ctx->line_length;
+        cb_b -= ctx->line_length;
+
+        // The footer was in the line, the separator is regular input then.
+        if (B85_S_NO_HEADER != ctx->state && B85_S_HEADER != ctx->state)
+          continue;
+
+        ctx->processed += sep;
+        b += sep;
+        cb_b -= sep;
+        continue;
+      }
+
+      ctx->flags &= ~B85_F_LINE_START;
+    }
+
+    if (!bulk_state)
+    {
+      if (B85_S_FOOTER == ctx->state || B85_S_INVALID == ctx->state)
+        return base85_decode_scalar (b, cb_b, ctx);
 
-      memset (ctx->out_pos, 0, 4);
-      ctx->out_pos += 4;
+      // Header transitions, one byte at a time.
+      rv = base85_decode_scalar (b, 1, ctx);
+      if (rv)
+        return rv;
+      b++;
+      cb_b--;
       continue;
     }
-#endif
 
-    uint8_t x = B85_G_DECODE[c];
-    if (!x--)
-      return B85_E_INVALID_CHAR;
+    size_t block = cb_b < B85_COMPACT_BLOCK ? cb_b : B85_COMPACT_BLOCK;
+    const uint8_t *tilde
+      = ctx->alphabet->framed ? memchr (b, B85_FOOTER0, block) : NULL;
+    if (tilde)
+      block = tilde - b;
 
-    ctx->hold[ctx->pos++] = x;
-    if (5 == ctx->pos)
+    // Resynchronize with the line length hint at the next LF.
+    if (ctx->line_length)
     {
-      rv = base85_decode_strict (ctx);
+      const uint8_t *lf = memchr (b, '\n', block);
+      if (lf)
+      {
+        block = lf + 1 - b;
+        ctx->flags |= B85_F_LINE_START;
+      }
+    }
+
+    if (!block)
+    {
+      rv = base85_decode_scalar (b, 1, ctx);
       if (rv)
         return rv;
+      b++;
+      cb_b--;
+      continue;
+    }
+
+    size_t n = base85_compact (b, block, compact);
+    if (n == block)
+    {
+      rv = base85_decode_scalar (b, block, ctx);
+    }
+    else
+    {
+      // Positions within the compacted block do not match the input, so on
+      // failure the block is rolled back and decoded again from the input to
+      // locate the error.
+      uint8_t hold[5];
+      memcpy (hold, ctx->hold, sizeof (hold));
+      size_t pos = ctx->pos;
+      size_t processed = ctx->processed;
+      ptrdiff_t offset = ctx->out_pos - ctx->out;
+
+      rv = base85_decode_scalar (compact, n, ctx);
+      if (rv)
+      {
+        memcpy (ctx->hold, hold, sizeof (hold));
+        ctx->pos = pos;
+        ctx->processed = processed;
+        ctx->out_pos = ctx->out + offset;
+        rv = base85_decode_scalar (b, block, ctx);
+      }
+      else
+      {
+        ctx->processed += block - n;
+      }
     }
+
+    if (rv)
+      return rv;
+    b += block;
+    cb_b -= block;
   }
 
   return B85_E_OK;
 }
 
+/// base85_decode_input(), plus the checksum of the output if enabled (only
+/// when decoding to binary, not when transcoding).
+static b85_result_t
+base85_decode_bytes (
+  const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
+)
+{
+  b85_result_t rv = base85_context_direction (ctx, B85_F_DECODER);
+  if (rv)
+    return rv;
+
+  if ((ctx->flags & (B85_F_CHECKSUM | B85_F_TRANSCODE)) != B85_F_CHECKSUM)
+    return base85_decode_input (b, cb_b, ctx);
+
+  while (cb_b)
+  {
+    size_t slice = cb_b < B85_CHECKSUM_SLICE ? cb_b : B85_CHECKSUM_SLICE;
+    ptrdiff_t offset = ctx->out_pos - ctx->out;
+    rv = base85_decode_input (b, slice, ctx);
+    base85_checksum_update (
+      ctx, ctx->out + offset, (ctx->out_pos - ctx->out) - offset
+    );
+    if (rv)
+      return rv;
+    b += slice;
+    cb_b -= slice;
+  }
+
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_DECODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+{
+  if (!ctx || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  if (!cb_b)
+    return B85_E_OK;
+
+  B85_PROBE2 (decode__start, ctx, cb_b);
+  b85_result_t rv = base85_decode_bytes (b, cb_b, ctx);
+  B85_PROBE4 (decode__done, ctx, rv, ctx->processed, ctx->out_pos - ctx->out);
+  return base85_trace_result (ctx, rv);
+}
+
+b85_result_t
+B85_DECODEV (
+  const struct iovec *iov, int iovcnt, struct base85_context_t *ctx
+)
+{
+  size_t total = base85_iov_length (iov, iovcnt);
+  if (!ctx || SIZE_MAX == total)
+    return B85_E_API_MISUSE;
+
+  // Upper bound for the output (ignoring 'z'), so that fragment boundaries
+  // do not cause additional reallocations.
+  b85_result_t rv = base85_context_request_memory (
+    ctx, (total + ctx->pos) / 5 * 4
+  );
+  if (rv)
+    return rv;
+
+  B85_PROBE2 (decode__start, ctx, total);
+  for (int i = 0; i < iovcnt && B85_E_OK == rv; ++i)
+    rv = base85_decode_bytes (iov[i].iov_base, iov[i].iov_len, ctx);
+  B85_PROBE4 (decode__done, ctx, rv, ctx->processed, ctx->out_pos - ctx->out);
+  return base85_trace_result (ctx, rv);
+}
+
 b85_result_t
 B85_DECODE_LAST (struct base85_context_t *ctx)
 {
   if (!ctx)
     return B85_E_API_MISUSE;
 
+  b85_result_t rv = base85_context_direction (ctx, B85_F_DECODER);
+  if (rv)
+    return base85_trace_result (ctx, rv);
+
   if (B85_S_START == ctx->state)
     return B85_E_OK;
 
   if ((B85_S_FOOTER != ctx->state) && (B85_S_NO_HEADER != ctx->state))
-    return B85_E_BAD_FOOTER;
+    return base85_trace_result (ctx, B85_E_BAD_FOOTER);
 
   size_t pos = ctx->pos;
 
   if (!pos)
     return B85_E_OK;
 
+  // Pad with the highest digit (the hold stores digits, not characters).
   for (int i = pos; i < 5; ++i)
-    ctx->hold[i] = B85_G_ENCODE[dimof (B85_G_ENCODE) - 1];
+    ctx->hold[i] = dimof (ctx->alphabet->encode) - 1;
+
+  rv = base85_decode_strict (ctx, pos - 1);
+  if (B85_E_OK == rv
+    && (ctx->flags & (B85_F_CHECKSUM | B85_F_TRANSCODE)) == B85_F_CHECKSUM)
+  {
+    base85_checksum_update (ctx, ctx->out_pos - (pos - 1), pos - 1);
+  }
+  return base85_trace_result (ctx, rv);
+}
+
+b85_result_t
+B85_VALIDATE (const uint8_t *b, size_t cb_b, size_t *processed)
+{
+  base85_decode_init ();
+
+  if (cb_b && !b)
+    return B85_E_API_MISUSE;
+
+  // The regular decoder runs against a scratch buffer that is recycled, so
+  // nothing is allocated and every rule is applied exactly as in B85_DECODE().
+  uint8_t scratch[B85_BULK_GROUPS * 4];
+  struct base85_context_t ctx = {
+    .out = scratch,
+    .out_pos = scratch,
+    .out_cb = sizeof (scratch),
+    .state = B85_S_START,
+    .flags = B85_F_DISCARD,
+    .alphabet = &B85_G_DEFAULT,
+  };
+
+  b85_result_t rv = base85_decode_bytes (b, cb_b, &ctx);
+  if (B85_E_OK == rv)
+    rv = B85_DECODE_LAST (&ctx);
+
+  if (processed)
+    *processed = ctx.processed;
+  return rv;
+}
+
+/// Returns the length of the run of characters of the @a decode table at the
+/// start of @a b.
+static size_t
+base85_digit_run (const uint8_t *b, size_t cb_b, const uint8_t *decode)
+{
+  size_t i = 0;
+  while (i < cb_b && decode[b[i]])
+    ++i;
+  return i;
+}
 
-  b85_result_t rv = base85_decode_strict (ctx);
+/// Records the checkpoints of @a index that fall on the @a n groups that follow
+/// the first @a groups groups. The first of them ends at encoded offset @a end,
+/// and each further one @a stride bytes later.
+static b85_result_t
+base85_index_add (
+  struct base85_index_t *index, size_t groups, size_t n, size_t end,
+  size_t stride
+)
+{
+  size_t per = index->interval / 4;
+  for (size_t target = (index->count + 1) * per; target <= groups + n;
+    target += per)
+  {
+    if (index->count == index->cap)
+    {
+      size_t cap = index->cap ? index->cap * 2 : 64;
+      size_t *offsets = realloc (index->offsets, cap * sizeof (*offsets));
+      if (!offsets)
+        return B85_E_BAD_ALLOC;
+      index->offsets = offsets;
+      index->cap = cap;
+    }
+    index->offsets[index->count++] = end + stride * (target - groups - 1);
+  }
+
+  return B85_E_OK;
+}
+
+/// Counts the bytes produced by decoding the complete stream in @a b, see
+/// B85_DECODED_LENGTH(). If @a in_place is true, also verifies that decoding
+/// over the input itself never overtakes the read position (only a 'z' group
+/// produces more bytes than it consumes). If @a index is not NULL, its
+/// checkpoints are recorded along the way.
+static b85_result_t
+base85_count_decoded (
+  const uint8_t *b, size_t cb_b, bool in_place, struct base85_index_t *index,
+  size_t *length
+)
+{
+  // Mirrors base85_decode_bytes(), but only counts complete groups; ctx.pos
+  // tracks the position within the current group.
+  const struct base85_alphabet_t *alphabet = &B85_G_DEFAULT;
+  struct base85_context_t ctx = {
+    .state = B85_S_START,
+    .alphabet = alphabet,
+  };
+  const uint8_t *begin = b;
+  size_t groups = 0;
+  while (cb_b)
+  {
+    if (B85_S_FOOTER == ctx.state)
+      break;
+
+    if (B85_S_INVALID == ctx.state)
+      return B85_E_BAD_FOOTER;
+
+    if (B85_S_NO_HEADER == ctx.state || B85_S_HEADER == ctx.state)
+    {
+      size_t n = base85_digit_run (b, cb_b, alphabet->decode);
+      if (index && (ctx.pos + n) / 5)
+      {
+        index->framed = B85_S_HEADER == ctx.state;
+        b85_result_t rv = base85_index_add (
+          index, groups, (ctx.pos + n) / 5, (b - begin) + 5 - ctx.pos, 5
+        );
+        if (rv)
+          return rv;
+      }
+      groups += (ctx.pos + n) / 5;
+      ctx.pos = (ctx.pos + n) % 5;
+      b += n;
+      cb_b -= n;
+      if (!cb_b)
+        break;
+    }
+
+    uint8_t c = *b++;
+    cb_b--;
+
+    if (base85_can_skip (c, (b85_state_t) ctx.state))
+      continue;
+
+    if (base85_handle_state (c, &ctx))
+      continue;
+
+    if (alphabet->zero_char && alphabet->zero_char == c && !ctx.pos)
+    {
+      // The last 'z' of a run is the one closest to overtaking.
+      size_t run = base85_byte_run (b, cb_b, alphabet->zero_char);
+      if (index)
+      {
+        index->framed = B85_S_HEADER == ctx.state;
+        b85_result_t rv = base85_index_add (
+          index, groups, 1 + run, b - begin, 1
+        );
+        if (rv)
+          return rv;
+      }
+      groups += 1 + run;
+      b += run;
+      cb_b -= run;
+      if (in_place && (size_t) (b - begin) < groups * 4)
+        return B85_E_BUFFER_TOO_SMALL;
+      continue;
+    }
+
+    if (!alphabet->decode[c])
+      return B85_E_INVALID_CHAR;
+
+    if (5 == ++ctx.pos)
+    {
+      if (index)
+      {
+        index->framed = B85_S_HEADER == ctx.state;
+        b85_result_t rv = base85_index_add (index, groups, 1, b - begin, 1);
+        if (rv)
+          return rv;
+      }
+      ctx.pos = 0;
+      groups++;
+    }
+  }
+
+  if (B85_S_START != ctx.state && B85_S_FOOTER != ctx.state
+    && B85_S_NO_HEADER != ctx.state)
+  {
+    return B85_E_BAD_FOOTER;
+  }
+
+  *length = groups * 4 + (ctx.pos ? ctx.pos - 1 : 0);
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_DECODED_LENGTH (const uint8_t *b, size_t cb_b, size_t *length)
+{
+  base85_decode_init ();
+
+  if (!length || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  return base85_count_decoded (b, cb_b, false, NULL, length);
+}
+
+b85_result_t
+B85_INDEX_BUILD (
+  const uint8_t *b, size_t cb_b, size_t interval, struct base85_index_t *index
+)
+{
+  base85_decode_init ();
+
+  if (!index || (cb_b && !b) || !interval || interval % 4)
+    return B85_E_API_MISUSE;
+
+  *index = (struct base85_index_t) {
+    .interval = interval,
+    .encoded_length = cb_b,
+  };
+
+  b85_result_t rv = base85_count_decoded (
+    b, cb_b, false, index, &index->decoded_length
+  );
+  if (rv)
+    B85_INDEX_DESTROY (index);
+  return rv;
+}
+
+/// Serialized index header: magic, version, flags.
+static const uint8_t B85_INDEX_MAGIC[] = { 'B', '8', '5', 'I', 1 };
+
+/// Serialized index flags.
+enum
+{
+  B85_INDEX_FRAMED = 1 << 0,
+  B85_INDEX_Z85 = 1 << 1,
+};
+
+#if defined (B85_ZEROMQ)
+#define B85_INDEX_ALPHABET B85_INDEX_Z85
+#else
+#define B85_INDEX_ALPHABET 0
+#endif
+
+/// Appends @a v to @a b as an unsigned LEB128 value, if it fits in @a cb.
+/// @a pos is advanced in any case.
+static void
+base85_put_varint (uint64_t v, uint8_t *b, size_t cb, size_t *pos)
+{
+  do
+  {
+    uint8_t c = v & 0x7f;
+    v >>= 7;
+    if (*pos < cb)
+      b[*pos] = c | (v ? 0x80 : 0);
+    ++*pos;
+  } while (v);
+}
+
+/// Reads an unsigned LEB128 value from @a b at @a pos.
+static bool
+base85_get_varint (const uint8_t *b, size_t cb, size_t *pos, size_t *v)
+{
+  uint64_t x = 0;
+  for (unsigned shift = 0; *pos < cb && shift < 64; shift += 7)
+  {
+    uint8_t c = b[(*pos)++];
+    x |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80))
+    {
+      if (x > SIZE_MAX)
+        return false;
+      *v = (size_t) x;
+      return true;
+    }
+  }
+  return false;
+}
+
+b85_result_t
+B85_INDEX_SAVE (
+  const struct base85_index_t *index, uint8_t *b, size_t cb, size_t *cb_out
+)
+{
+  if (!index || !cb_out || (cb && !b))
+    return B85_E_API_MISUSE;
+
+  size_t pos = 0;
+  for (size_t i = 0; i < dimof (B85_INDEX_MAGIC); ++i, ++pos)
+  {
+    if (pos < cb)
+      b[pos] = B85_INDEX_MAGIC[i];
+  }
+
+  uint8_t flags = (index->framed ? B85_INDEX_FRAMED : 0) | B85_INDEX_ALPHABET;
+  if (pos < cb)
+    b[pos] = flags;
+  ++pos;
+
+  base85_put_varint (index->interval, b, cb, &pos);
+  base85_put_varint (index->encoded_length, b, cb, &pos);
+  base85_put_varint (index->decoded_length, b, cb, &pos);
+  base85_put_varint (index->count, b, cb, &pos);
+  for (size_t k = 0; k < index->count; ++k)
+  {
+    size_t prev = k ? index->offsets[k - 1] : 0;
+    base85_put_varint (index->offsets[k] - prev, b, cb, &pos);
+  }
+
+  *cb_out = pos;
+  return pos <= cb ? B85_E_OK : B85_E_BUFFER_TOO_SMALL;
+}
+
+b85_result_t
+B85_INDEX_LOAD (const uint8_t *b, size_t cb, struct base85_index_t *index)
+{
+  if (!index || (cb && !b))
+    return B85_E_API_MISUSE;
+
+  *index = (struct base85_index_t) { .offsets = NULL };
+
+  size_t pos = dimof (B85_INDEX_MAGIC) + 1;
+  if (cb < pos || memcmp (b, B85_INDEX_MAGIC, dimof (B85_INDEX_MAGIC))
+    || (b[pos - 1] & ~B85_INDEX_FRAMED) != B85_INDEX_ALPHABET)
+  {
+    return B85_E_BAD_INDEX;
+  }
+
+  index->framed = !!(b[pos - 1] & B85_INDEX_FRAMED);
+
+  size_t count;
+  if (!base85_get_varint (b, cb, &pos, &index->interval)
+    || !base85_get_varint (b, cb, &pos, &index->encoded_length)
+    || !base85_get_varint (b, cb, &pos, &index->decoded_length)
+    || !base85_get_varint (b, cb, &pos, &count)
+    || !index->interval || index->interval % 4
+    || count != index->decoded_length / index->interval
+    || count > cb - pos)
+  {
+    return B85_E_BAD_INDEX;
+  }
+
+  if (count)
+  {
+    index->offsets = malloc (count * sizeof (*index->offsets));
+    if (!index->offsets)
+      return B85_E_BAD_ALLOC;
+    index->cap = count;
+  }
+
+  size_t offset = 0;
+  for (; index->count < count; ++index->count)
+  {
+    size_t delta;
+    if (!base85_get_varint (b, cb, &pos, &delta)
+      || delta > index->encoded_length - offset)
+    {
+      B85_INDEX_DESTROY (index);
+      return B85_E_BAD_INDEX;
+    }
+    offset += delta;
+    index->offsets[index->count] = offset;
+  }
+
+  return B85_E_OK;
+}
+
+void
+B85_INDEX_DESTROY (struct base85_index_t *index)
+{
+  if (!index)
+    return;
+
+  free (index->offsets);
+  index->offsets = NULL;
+  index->count = 0;
+  index->cap = 0;
+}
+
+b85_result_t
+B85_DECODE_RANGE (
+  const uint8_t *b, size_t cb_b, const struct base85_index_t *index,
+  size_t offset, size_t length, struct base85_context_t *ctx
+)
+{
+  // The checkpoints of the index were counted with the default alphabet.
+  if (!ctx || !index || (cb_b && !b) || &B85_G_DEFAULT != ctx->alphabet)
+    return B85_E_API_MISUSE;
+
+  B85_CONTEXT_RESET (ctx);
+
+  if (index->encoded_length != cb_b)
+    return B85_E_BAD_INDEX;
+
+  if (offset > index->decoded_length)
+    return B85_E_API_MISUSE;
+
+  if (length > index->decoded_length - offset)
+    length = index->decoded_length - offset;
+
+  // Resume from the last checkpoint at or before @a offset. Checkpoints are
+  // at group boundaries, so the hold is empty and only the framing state has
+  // to be restored.
+  size_t k = offset / index->interval;
+  if (k > index->count)
+    k = index->count;
+
+  size_t start = 0;
+  if (k)
+  {
+    start = index->offsets[k - 1];
+    if (start > cb_b)
+      return B85_E_BAD_INDEX;
+
+    ctx->state = index->framed ? B85_S_HEADER : B85_S_NO_HEADER;
+    ctx->flags &= ~B85_F_LINE_START;
+    ctx->processed = start;
+  }
+
+  size_t skip = offset - k * index->interval;
+  size_t need = skip + length;
+  b85_result_t rv = base85_context_request_memory (ctx, need);
   if (rv)
     return rv;
 
-  ctx->out_pos -= 5 - pos;
+  // Feed roughly as much input as the rest of the range requires, so that
+  // decoding stops shortly after the end of the range.
+  size_t have;
+  while ((have = ctx->out_pos - ctx->out) < need && start < cb_b)
+  {
+    size_t chunk = (need - have) / 4 * 5 + B85_COMPACT_BLOCK;
+    if (chunk > cb_b - start)
+      chunk = cb_b - start;
+
+    rv = base85_decode_bytes (b + start, chunk, ctx);
+    if (rv)
+      return rv;
+    start += chunk;
+  }
+
+  // The range extends into the final partial group.
+  if (have < need)
+  {
+    rv = B85_DECODE_LAST (ctx);
+    if (rv)
+      return rv;
+  }
+
+  if ((size_t) (ctx->out_pos - ctx->out) < need)
+    return B85_E_BAD_INDEX;
+
+  memmove (ctx->out, ctx->out + skip, length);
+  ctx->out_pos = ctx->out + length;
   return B85_E_OK;
 }
+
+/// A group that B85_ENCODE_PATCH() encodes again.
+struct base85_patch_t
+{
+  /// The old characters of the group, [pos, end) of the stream.
+  size_t pos;
+  size_t end;
+
+  /// Change of the stream length, zero if the group keeps its width (and its
+  /// whitespace).
+  ptrdiff_t delta;
+
+  /// The new characters.
+  uint8_t chars[5];
+  uint8_t width;
+};
+
+/// Position of B85_ENCODE_PATCH() in the stream: the encoded offset where
+/// group @a group begins (whitespace included).
+struct base85_patch_cursor_t
+{
+  size_t group;
+  size_t pos;
+  bool started;
+};
+
+/// Orders ranges by offset.
+static int
+base85_range_compare (const void *a, const void *b)
+{
+  const struct base85_range_t *ra = a;
+  const struct base85_range_t *rb = b;
+  return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+/// Finds group @a g of the stream in @a b, starting from @a cursor or from the
+/// nearest checkpoint of @a index, whichever is closer. The characters of the
+/// group are at [*@a pos, *@a end), @a width of them significant. The cursor
+/// is left at the next group.
+static b85_result_t
+base85_patch_find (
+  const uint8_t *b, size_t cb_b, const struct base85_index_t *index,
+  struct base85_patch_cursor_t *cursor, size_t g, size_t *pos, size_t *end,
+  size_t *width
+)
+{
+  const struct base85_alphabet_t *alphabet = &B85_G_DEFAULT;
+  size_t per = index->interval / 4;
+  size_t k = g / per;
+  if (k > index->count)
+    k = index->count;
+
+  if (!cursor->started || cursor->group < k * per)
+  {
+    size_t p = 0;
+    if (k)
+      p = index->offsets[k - 1];
+    else
+    {
+      // The header is looked for directly: index->framed is only known once
+      // the stream has a complete group.
+      while (p < cb_b && base85_whitespace (b[p]))
+        ++p;
+      if (alphabet->framed && cb_b - p >= 2 && B85_HEADER0 == b[p]
+        && B85_HEADER1 == b[p + 1])
+      {
+        p += 2;
+      }
+    }
+    if (p > cb_b)
+      return B85_E_BAD_INDEX;
+
+    *cursor = (struct base85_patch_cursor_t) {
+      .group = k * per,
+      .pos = p,
+      .started = true,
+    };
+  }
+
+  size_t full = index->decoded_length / 4;
+  for (;;)
+  {
+    size_t p = cursor->pos;
+    while (p < cb_b && base85_whitespace (b[p]))
+      ++p;
+    if (p == cb_b)
+      return B85_E_BAD_INDEX;
+
+    size_t start = p;
+    size_t n;
+    if (cursor->group < full && alphabet->zero_char
+      && alphabet->zero_char == b[p])
+    {
+      n = 1;
+      ++p;
+    }
+    else
+    {
+      n = cursor->group < full ? 5 : index->decoded_length % 4 + 1;
+      for (size_t i = 0; i < n; ++p)
+      {
+        if (p == cb_b)
+          return B85_E_BAD_INDEX;
+        if (alphabet->decode[b[p]])
+          ++i;
+        else if (!base85_whitespace (b[p]))
+          return B85_E_BAD_INDEX;
+      }
+    }
+
+    cursor->pos = p;
+    if (cursor->group++ == g)
+    {
+      *pos = start;
+      *end = p;
+      *width = n;
+      return B85_E_OK;
+    }
+  }
+}
+
+b85_result_t
+B85_ENCODE_PATCH (
+  uint8_t *b, size_t cb_b, size_t cb_cap, struct base85_index_t *index,
+  const uint8_t *data, size_t cb_data, const struct base85_range_t *ranges,
+  size_t n, size_t *cb_out
+)
+{
+  base85_decode_init ();
+
+  if (!cb_out || !index || (cb_b && !b) || (cb_data && !data)
+    || (n && !ranges))
+  {
+    return B85_E_API_MISUSE;
+  }
+
+  if (index->encoded_length != cb_b || !index->interval
+    || index->interval % 4)
+  {
+    return B85_E_BAD_INDEX;
+  }
+
+  if (cb_data != index->decoded_length)
+    return B85_E_API_MISUSE;
+
+  // The ranges as group ranges, sorted and merged.
+  struct base85_range_t *groups = malloc ((n ? n : 1) * sizeof (*groups));
+  struct base85_patch_t *patches = NULL;
+  if (!groups)
+    return B85_E_BAD_ALLOC;
+
+  b85_result_t rv = B85_E_OK;
+  size_t m = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (ranges[i].offset > cb_data
+      || ranges[i].length > cb_data - ranges[i].offset)
+    {
+      rv = B85_E_API_MISUSE;
+      goto exit;
+    }
+    if (!ranges[i].length)
+      continue;
+
+    size_t first = ranges[i].offset / 4;
+    groups[m++] = (struct base85_range_t) {
+      .offset = first,
+      .length = (ranges[i].offset + ranges[i].length + 3) / 4 - first,
+    };
+  }
+  qsort (groups, m, sizeof (*groups), base85_range_compare);
+
+  size_t merged = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < m; ++i)
+  {
+    struct base85_range_t *last = merged ? &groups[merged - 1] : NULL;
+    size_t end = groups[i].offset + groups[i].length;
+    if (last && groups[i].offset <= last->offset + last->length)
+    {
+      if (end > last->offset + last->length)
+      {
+        count += end - (last->offset + last->length);
+        last->length = end - last->offset;
+      }
+      continue;
+    }
+    groups[merged++] = groups[i];
+    count += groups[i].length;
+  }
+
+  patches = malloc ((count ? count : 1) * sizeof (*patches));
+  if (!patches)
+  {
+    rv = B85_E_BAD_ALLOC;
+    goto exit;
+  }
+
+  // Encodes the groups and measures the change, before anything is written.
+  const struct base85_alphabet_t *alphabet = &B85_G_DEFAULT;
+  struct base85_patch_cursor_t cursor = { .started = false };
+  size_t full = cb_data / 4;
+  ptrdiff_t total = 0;
+  size_t np = 0;
+  for (size_t i = 0; i < merged; ++i)
+  {
+    for (size_t g = groups[i].offset;
+      g < groups[i].offset + groups[i].length; ++g)
+    {
+      struct base85_patch_t *patch = &patches[np++];
+      size_t width;
+      rv = base85_patch_find (
+        b, cb_b, index, &cursor, g, &patch->pos, &patch->end, &width
+      );
+      if (rv)
+        goto exit;
+
+      if (g < full)
+      {
+        uint32_t v = base85_load_be32 (data + g * 4);
+        if (!v && alphabet->zero_char)
+        {
+          patch->chars[0] = alphabet->zero_char;
+          patch->width = 1;
+        }
+        else
+        {
+          base85_encode_word (v, alphabet->encode, patch->chars);
+          patch->width = 5;
+        }
+      }
+      else
+      {
+        uint8_t hold[4] = { 0 };
+        memcpy (hold, data + g * 4, cb_data % 4);
+        base85_encode_word (
+          base85_load_be32 (hold), alphabet->encode, patch->chars
+        );
+        patch->width = cb_data % 4 + 1;
+      }
+
+      patch->delta = patch->width == width ? 0
+        : (ptrdiff_t) patch->width - (ptrdiff_t) (patch->end - patch->pos);
+      total += patch->delta;
+    }
+  }
+
+  *cb_out = cb_b + total;
+  if (*cb_out > cb_cap)
+  {
+    rv = B85_E_BUFFER_TOO_SMALL;
+    goto exit;
+  }
+
+  // Moves the stretches between the groups that change width: first those
+  // that move right, from the last one, then those that move left, from the
+  // first one, so that none is overwritten before it has moved.
+  ptrdiff_t shift = total;
+  size_t to = cb_b;
+  for (size_t i = np; i--; )
+  {
+    if (!patches[i].delta)
+      continue;
+    size_t from = patches[i].end;
+    if (shift > 0)
+      memmove (b + from + shift, b + from, to - from);
+    shift -= patches[i].delta;
+    to = patches[i].pos;
+  }
+
+  shift = 0;
+  size_t from = 0;
+  for (size_t i = 0; i <= np; ++i)
+  {
+    if (i < np && !patches[i].delta)
+      continue;
+    to = i < np ? patches[i].pos : cb_b;
+    if (shift < 0)
+      memmove (b + from + shift, b + from, to - from);
+    if (i < np)
+    {
+      shift += patches[i].delta;
+      from = patches[i].end;
+    }
+  }
+
+  // Writes the groups at their new positions. A group that keeps its width
+  // keeps its whitespace, too.
+  shift = 0;
+  for (size_t i = 0; i < np; ++i)
+  {
+    struct base85_patch_t *patch = &patches[i];
+    uint8_t *w = b + patch->pos + shift;
+    if (patch->delta || patch->end - patch->pos == patch->width)
+      memcpy (w, patch->chars, patch->width);
+    else
+    {
+      for (size_t j = 0; j < patch->width; ++w)
+      {
+        if (!base85_whitespace (*w))
+          *w = patch->chars[j++];
+      }
+    }
+    shift += patch->delta;
+  }
+
+  shift = 0;
+  for (size_t k = 0, i = 0; k < index->count; ++k)
+  {
+    while (i < np && patches[i].end <= index->offsets[k])
+      shift += patches[i++].delta;
+    index->offsets[k] += shift;
+  }
+  index->encoded_length = *cb_out;
+
+exit:
+  free (groups);
+  free (patches);
+  return rv;
+}
+
+b85_result_t
+B85_ENCODE_INPLACE (uint8_t *b, size_t cb_b, size_t cb_cap, size_t *cb_out)
+{
+  if (!cb_out || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  size_t full = cb_b / 4;
+  size_t tail = cb_b % 4;
+  size_t bound = full * 5 + (tail ? tail + 1 : 0);
+  if (cb_cap < bound)
+    return B85_E_BUFFER_TOO_SMALL;
+
+  // Groups are encoded from last to first, right aligned at @a bound. Group k
+  // is read before its output is written, and the output never reaches below
+  // 5 * k, i.e. never into the input of groups 0 .. k - 1.
+  uint8_t *w = b + bound;
+  if (tail)
+  {
+    uint8_t hold[4] = { 0 };
+    uint8_t group[5];
+    memcpy (hold, b + full * 4, tail);
+    base85_encode_word (base85_load_be32 (hold), B85_G_DEFAULT.encode, group);
+    w -= tail + 1;
+    memcpy (w, group, tail + 1);
+  }
+
+  for (size_t k = full; k--; )
+  {
+    uint32_t v = base85_load_be32 (b + k * 4);
+
+    if (!v && B85_G_DEFAULT.zero_char)
+    {
+      *--w = B85_G_DEFAULT.zero_char;
+      continue;
+    }
+
+    w -= 5;
+    base85_encode_word (v, B85_G_DEFAULT.encode, w);
+  }
+
+  *cb_out = (b + bound) - w;
+  memmove (b, w, *cb_out);
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_DECODE_INPLACE (uint8_t *b, size_t cb_b, size_t *cb_out)
+{
+  base85_decode_init ();
+
+  if (!cb_out || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  // Every other group consumes at least as many bytes as it produces, so the
+  // write position can only overtake the read position with 'z' groups.
+  if (B85_G_DEFAULT.zero_char && memchr (b, B85_G_DEFAULT.zero_char, cb_b))
+  {
+    size_t length;
+    b85_result_t rv = base85_count_decoded (b, cb_b, true, NULL, &length);
+    if (rv)
+      return rv;
+  }
+
+  struct base85_context_t ctx = {
+    .out = b,
+    .out_pos = b,
+    .out_cb = cb_b,
+    .state = B85_S_START,
+    .flags = B85_F_FIXED_OUTPUT | B85_F_IN_PLACE,
+    .alphabet = &B85_G_DEFAULT,
+  };
+
+  b85_result_t rv = base85_decode_bytes (b, cb_b, &ctx);
+  if (B85_E_OK == rv)
+    rv = B85_DECODE_LAST (&ctx);
+
+  *cb_out = ctx.out_pos - ctx.out;
+  return rv;
+}
+
+b85_result_t
+B85_TRANSCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx)
+{
+  if (!ctx || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  ctx->flags |= B85_F_TRANSCODE;
+
+  if (!cb_b)
+    return B85_E_OK;
+
+  return base85_decode_bytes (b, cb_b, ctx);
+}
+
+b85_result_t
+B85_TRANSCODE_LAST (struct base85_context_t *ctx)
+{
+  if (!ctx)
+    return B85_E_API_MISUSE;
+
+  ctx->flags |= B85_F_TRANSCODE;
+
+  b85_result_t rv = B85_DECODE_LAST (ctx);
+  if (rv)
+    return rv;
+
+  // NUL terminate, like B85_ENCODE_LAST().
+  rv = base85_context_request_memory (ctx, 1);
+  if (B85_E_OK == rv)
+    *ctx->out_pos = 0;
+  return rv;
+}
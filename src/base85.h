@@ -12,18 +12,63 @@
 #define B85_NAME(name) ascii85_##name
 #endif
 
+/// B85_TRANSCODE() reads the alphabet of its context, and writes Z85 if that
+/// is Ascii85, or Ascii85 otherwise. The names describe a context with the
+/// default alphabet of this build.
+#if defined (B85_ZEROMQ)
+#define B85_TRANSCODE z85_to_ascii85
+#define B85_TRANSCODE_LAST z85_to_ascii85_last
+#else
+#define B85_TRANSCODE ascii85_to_z85
+#define B85_TRANSCODE_LAST ascii85_to_z85_last
+#endif
+
+#define B85_GET_ALPHABET B85_NAME (get_alphabet)
+#define B85_GET_DECODE_TABLE B85_NAME (get_decode_table)
+#define B85_ALPHABET_ASCII85 B85_NAME (alphabet_ascii85)
+#define B85_ALPHABET_Z85 B85_NAME (alphabet_z85)
+#define B85_ALPHABET_RFC1924 B85_NAME (alphabet_rfc1924)
+#define B85_ALPHABET_INIT B85_NAME (alphabet_init)
+#define B85_SET_COMPACT_KERNEL B85_NAME (set_compact_kernel)
+#define B85_GET_COMPACT_KERNEL B85_NAME (get_compact_kernel)
 #define B85_DEBUG_ERROR_STRING B85_NAME (debug_error_string)
 #define B85_ERROR_STRING B85_NAME (error_string)
 #define B85_GET_OUTPUT B85_NAME (get_output)
 #define B85_GET_PROCESSED B85_NAME (get_processed)
+#define B85_GET_CHECKSUM B85_NAME (get_checksum)
 #define B85_CLEAR_OUTPUT B85_NAME (clear_output)
 #define B85_CONTEXT_INIT B85_NAME (context_init)
+#define B85_CONTEXT_INIT_FIXED B85_NAME (context_init_fixed)
+#define B85_CONTEXT_RESERVE B85_NAME (context_reserve)
 #define B85_CONTEXT_RESET B85_NAME (context_reset)
+#define B85_CONTEXT_SET_ALPHABET B85_NAME (context_set_alphabet)
+#define B85_CONTEXT_SET_LINE_LENGTH B85_NAME (context_set_line_length)
+#define B85_CONTEXT_SET_CHECKSUM B85_NAME (context_set_checksum)
+#define B85_CONTEXT_SAVE B85_NAME (context_save)
+#define B85_CONTEXT_RESTORE B85_NAME (context_restore)
 #define B85_CONTEXT_DESTROY B85_NAME (context_destroy)
 #define B85_ENCODE B85_NAME (encode)
+#define B85_ENCODEV B85_NAME (encodev)
 #define B85_ENCODE_LAST B85_NAME (encode_last)
 #define B85_DECODE B85_NAME (decode)
+#define B85_DECODEV B85_NAME (decodev)
 #define B85_DECODE_LAST B85_NAME (decode_last)
+#define B85_VALIDATE B85_NAME (validate)
+#define B85_DECODED_LENGTH B85_NAME (decoded_length)
+#define B85_ENCODE_INPLACE B85_NAME (encode_inplace)
+#define B85_DECODE_INPLACE B85_NAME (decode_inplace)
+#define B85_INDEX_BUILD B85_NAME (index_build)
+#define B85_INDEX_SAVE B85_NAME (index_save)
+#define B85_INDEX_LOAD B85_NAME (index_load)
+#define B85_INDEX_DESTROY B85_NAME (index_destroy)
+#define B85_DECODE_RANGE B85_NAME (decode_range)
+#define B85_ENCODE_PATCH B85_NAME (encode_patch)
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct iovec;
 
 /// Base85 result values.
 typedef enum
@@ -53,10 +98,112 @@ typedef enum
   /// Indicates API misuse by a client.
   B85_E_API_MISUSE,
 
+  /// A caller provided buffer is too small for the output.
+  B85_E_BUFFER_TOO_SMALL,
+
+  /// A filter stage failed to process its input (e.g. corrupt zlib data).
+  B85_E_FILTER,
+
+  /// A decode index is malformed, or was built for different input.
+  B85_E_BAD_INDEX,
+
+  /// Saved context state is malformed, or was saved with another alphabet.
+  B85_E_BAD_STATE,
+
+  /// A file could not be read or written.
+  B85_E_IO,
+
   /// End marker
   B85_E_END
 } b85_result_t;
 
+/// Describes a base85 dialect. The built-in dialects are returned by
+/// B85_ALPHABET_ASCII85(), B85_ALPHABET_Z85() and B85_ALPHABET_RFC1924(),
+/// others are set up with B85_ALPHABET_INIT().
+struct base85_alphabet_t
+{
+  /// The 85 characters, in digit order.
+  uint8_t encode[85];
+
+  /// For each of the 256 byte values, its digit plus one, or zero if the byte
+  /// is not in the alphabet.
+  uint8_t decode[256];
+
+  /// Character that abbreviates an all-zero group (Ascii85 'z'), or zero.
+  uint8_t zero_char;
+
+  /// Nonzero if the data may be framed by "<~" and "~>".
+  uint8_t framed;
+
+  /// Internal, selects the kernels specialized for a built-in alphabet.
+  uint8_t kernel;
+};
+
+/// Gets the 85 characters of the default alphabet of this build, in digit
+/// order.
+const uint8_t *
+B85_GET_ALPHABET (void);
+
+/// Gets the decode table of the default alphabet of this build, see
+/// base85_alphabet_t::decode.
+const uint8_t *
+B85_GET_DECODE_TABLE (void);
+
+/// Gets the Ascii85 alphabet ('z' groups, "<~" "~>" framing).
+const struct base85_alphabet_t *
+B85_ALPHABET_ASCII85 (void);
+
+/// Gets the Z85 alphabet ("<~" "~>" framing, as in earlier versions).
+const struct base85_alphabet_t *
+B85_ALPHABET_Z85 (void);
+
+/// Gets the RFC 1924 alphabet, as used by git binary patches and Python's
+/// base64.b85encode() (no zero groups, no framing).
+const struct base85_alphabet_t *
+B85_ALPHABET_RFC1924 (void);
+
+/// Sets up @a alphabet from the 85 distinct characters @a chars (none of them
+/// whitespace). A nonzero @a zero_char (not in @a chars) abbreviates all-zero
+/// groups. If @a framed is nonzero, "<~" and "~>" frame the data, which
+/// requires '<' to be in @a chars and '~' not to be.
+/// Returns B85_E_API_MISUSE if the characters do not meet these rules.
+b85_result_t
+B85_ALPHABET_INIT (
+  struct base85_alphabet_t *alphabet, const char *chars, char zero_char,
+  int framed
+);
+
+/// Whitespace compaction kernels of the decoder (used for line wrapped input
+/// without a line length hint). @see B85_SET_COMPACT_KERNEL()
+typedef enum
+{
+  /// The fastest kernel the CPU supports, by static heuristics.
+  B85_COMPACT_AUTO = 0,
+
+  /// Portable C.
+  B85_COMPACT_GENERIC,
+
+  /// SSE2, whitespace free blocks of 16 bytes are copied at once.
+  B85_COMPACT_SSE2,
+
+  /// SSSE3, every block of 16 bytes is compacted with shuffles.
+  B85_COMPACT_SSSE3,
+
+  /// End marker
+  B85_COMPACT_END
+} b85_compact_kernel_t;
+
+/// Selects the whitespace compaction kernel of all contexts. Returns
+/// B85_E_API_MISUSE if the kernel is not available in this build or on this
+/// CPU. Not thread safe: call it before other threads use the library.
+/// @see B85_TUNE()
+b85_result_t
+B85_SET_COMPACT_KERNEL (b85_compact_kernel_t kernel);
+
+/// Gets the whitespace compaction kernel in use (never B85_COMPACT_AUTO).
+b85_compact_kernel_t
+B85_GET_COMPACT_KERNEL (void);
+
 /// Tranlates @a val to a debug error string (i.e., "B85_E_OK").
 const char *
 B85_DEBUG_ERROR_STRING (b85_result_t val);
@@ -89,6 +236,53 @@ struct base85_context_t
   /// Internal state (used for keeping track of the header/footer during
   /// decoding).
   uint8_t state;
+
+  /// Internal flags.
+  uint8_t flags;
+
+  /// Decoding hint, the expected number of characters per line (excluding the
+  /// line separator), or zero. @see B85_CONTEXT_SET_LINE_LENGTH()
+  size_t line_length;
+
+  /// CRC-32C of the binary data processed so far.
+  /// @see B85_CONTEXT_SET_CHECKSUM()
+  uint32_t checksum;
+
+  /// The alphabet of the encoded data. @see B85_CONTEXT_SET_ALPHABET()
+  const struct base85_alphabet_t *alphabet;
+};
+
+/// Random access index over an encoded stream. @see B85_INDEX_BUILD()
+struct base85_index_t
+{
+  /// Number of decoded bytes between checkpoints (a multiple of 4).
+  size_t interval;
+
+  /// Length of the encoded stream the index was built for.
+  size_t encoded_length;
+
+  /// Length of the decoded stream.
+  size_t decoded_length;
+
+  /// Nonzero if the checkpoints are inside a <~ ~> frame.
+  uint8_t framed;
+
+  /// Encoded offsets of the checkpoints. Checkpoint k is where the group that
+  /// decodes to offset (k + 1) * interval starts.
+  size_t *offsets;
+
+  /// Number of checkpoints.
+  size_t count;
+
+  /// Number of entries allocated for offsets.
+  size_t cap;
+};
+
+/// A range of decoded bytes. @see B85_ENCODE_PATCH()
+struct base85_range_t
+{
+  size_t offset;
+  size_t length;
 };
 
 /// Gets the output from @a ctx.
@@ -101,6 +295,12 @@ B85_GET_OUTPUT (struct base85_context_t *ctx, size_t *cb);
 size_t
 B85_GET_PROCESSED (struct base85_context_t *ctx);
 
+/// Gets the CRC-32C (Castagnoli) of the binary data processed by @a ctx, i.e.
+/// the input when encoding, and the output when decoding.
+/// @see B85_CONTEXT_SET_CHECKSUM()
+uint32_t
+B85_GET_CHECKSUM (struct base85_context_t *ctx);
+
 /// Clears the output buffer in @a ctx. i.e. the next call to
 /// B85_GET_OUTPUT() will return a byte count of zero.
 /// @pre @a ctx is valid.
@@ -112,11 +312,82 @@ B85_CLEAR_OUTPUT (struct base85_context_t *ctx);
 b85_result_t
 B85_CONTEXT_INIT (struct base85_context_t *ctx);
 
+/// Initializes a context object that writes its output to the @a out_cb bytes
+/// at @a out, which belong to the caller. The buffer is never reallocated; a
+/// call whose output does not fit fails with B85_E_BUFFER_TOO_SMALL (see
+/// B85_DECODED_LENGTH() for sizing it exactly). B85_CONTEXT_DESTROY() does
+/// not free @a out.
+b85_result_t
+B85_CONTEXT_INIT_FIXED (
+  struct base85_context_t *ctx, uint8_t *out, size_t out_cb
+);
+
+/// Makes sure that at least @a cb bytes can be appended to the output buffer
+/// of @a ctx without reallocating. Unlike the automatic growth performed by
+/// the encode/decode functions, the buffer is sized exactly.
+/// @see B85_DECODED_LENGTH()
+b85_result_t
+B85_CONTEXT_RESERVE (struct base85_context_t *ctx, size_t cb);
+
 /// Resets an existing context, but does not free its memory. This is useful
 /// for resetting the context before encoding/decoding a new data stream.
 void
 B85_CONTEXT_RESET (struct base85_context_t *ctx);
 
+/// Selects the alphabet that @a ctx encodes to and decodes from, instead of
+/// the default alphabet of this build. Must be called before any input is
+/// processed; @a alphabet must outlive the context. The alphabet survives
+/// B85_CONTEXT_RESET(). Functions that do not take a context (B85_VALIDATE(),
+/// the in place and index functions) use the default alphabet.
+b85_result_t
+B85_CONTEXT_SET_ALPHABET (
+  struct base85_context_t *ctx, const struct base85_alphabet_t *alphabet
+);
+
+/// Declares that the encoded input consists of lines of exactly
+/// @a line_length characters, each followed by LF or CRLF (the last line may
+/// be shorter). Line separators are then skipped at the predicted positions
+/// instead of testing every byte for whitespace. Input that does not match the
+/// prediction is still decoded correctly, just without the speedup. A
+/// @a line_length of zero removes the hint. The hint survives
+/// B85_CONTEXT_RESET().
+b85_result_t
+B85_CONTEXT_SET_LINE_LENGTH (struct base85_context_t *ctx, size_t line_length);
+
+/// Enables (@a enabled != 0) or disables the running checksum of the binary
+/// data, see B85_GET_CHECKSUM(). The checksum is computed inside the
+/// encode/decode calls, in slices that are still in cache, using the CRC32
+/// instructions of the host where available. It is cleared by
+/// B85_CONTEXT_RESET(), and is not maintained by B85_TRANSCODE().
+b85_result_t
+B85_CONTEXT_SET_CHECKSUM (struct base85_context_t *ctx, int enabled);
+
+/// Size of the context state written by B85_CONTEXT_SAVE().
+#define B85_CONTEXT_STATE_SIZE 34
+
+/// Serializes the stream state of @a ctx (hold, position, processed count,
+/// header/footer state, line length hint and checksum) to @a b, in a portable
+/// format. The output buffer is not included, so the output should be written
+/// out before saving. Together with B85_GET_PROCESSED(), which is the input
+/// offset to continue from, this allows an interrupted job to be resumed.
+b85_result_t
+B85_CONTEXT_SAVE (
+  const struct base85_context_t *ctx, uint8_t b[B85_CONTEXT_STATE_SIZE]
+);
+
+/// Restores the stream state saved by B85_CONTEXT_SAVE() into @a ctx, which
+/// must have been initialized with B85_CONTEXT_INIT(). The output of @a ctx is
+/// cleared. Encoding or decoding then continues with the input that follows
+/// the first B85_GET_PROCESSED() bytes. The state records whether it was
+/// saved by an encoder or a decoder; continuing in the other direction fails
+/// with B85_E_BAD_STATE.
+///
+/// @return 0 for success, B85_E_BAD_STATE if @a b is malformed.
+b85_result_t
+B85_CONTEXT_RESTORE (
+  struct base85_context_t *ctx, const uint8_t b[B85_CONTEXT_STATE_SIZE]
+);
+
 /// Context cleanup. Frees memory associated with the context.
 void
 B85_CONTEXT_DESTROY (struct base85_context_t *ctx);
@@ -130,6 +401,20 @@ B85_CONTEXT_DESTROY (struct base85_context_t *ctx);
 b85_result_t
 B85_ENCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx);
 
+/// Encodes the @a iovcnt buffers described by @a iov, in order, as if they were
+/// passed to B85_ENCODE() one after another. Groups that straddle fragment
+/// boundaries are handled internally, so the fragments do not have to be
+/// concatenated by the caller.
+/// @pre @a iov must contain at least @a iovcnt entries, and @a ctx must be a
+/// valid context.
+///
+/// Note: B85_ENCODE_LAST() must be called in order to finalize the encode
+/// operation.
+b85_result_t
+B85_ENCODEV (
+  const struct iovec *iov, int iovcnt, struct base85_context_t *ctx
+);
+
 /// Finalizes an encode operation that was initiated by calling base85_encode().
 /// @pre @a ctx must be valid.
 b85_result_t
@@ -148,6 +433,20 @@ B85_DECODE (
   const uint8_t *b, size_t cb_b, struct base85_context_t *ctx
 );
 
+/// Decodes the @a iovcnt buffers described by @a iov, in order, as if they were
+/// passed to B85_DECODE() one after another.
+/// @pre @a iov must contain at least @a iovcnt entries, and @a ctx must be a
+/// valid context.
+///
+/// Note: B85_DECODE_LAST() must be called in order to finalize the decode
+/// operation.
+///
+/// @return 0 for success.
+b85_result_t
+B85_DECODEV (
+  const struct iovec *iov, int iovcnt, struct base85_context_t *ctx
+);
+
 /// Finalizes a decode operation that was initiated by calling B85_DECODE().
 /// @pre @a ctx must be valid.
 ///
@@ -155,4 +454,158 @@ B85_DECODE (
 b85_result_t
 B85_DECODE_LAST (struct base85_context_t *ctx);
 
+/// Checks that the @a cb_b bytes in @a b form a complete, valid encoded
+/// stream, applying the same rules as B85_DECODE() followed by
+/// B85_DECODE_LAST() (alphabet, overflow, header/footer and 'z' placement).
+/// No output is produced and no memory is allocated.
+/// If @a processed is not NULL, it receives the number of input bytes
+/// processed, i.e. the error position on failure.
+///
+/// @return 0 for success.
+b85_result_t
+B85_VALIDATE (const uint8_t *b, size_t cb_b, size_t *processed);
+
+/// Computes the exact number of bytes that decoding the complete encoded
+/// stream in @a b would produce, accounting for whitespace, 'z' groups and
+/// the header/footer. The result is stored in @a length. Intended for sizing
+/// the output up front with B85_CONTEXT_RESERVE().
+///
+/// Note: Framing errors and invalid characters are reported, but overflow is
+/// only detected by the actual decode.
+///
+/// @return 0 for success.
+b85_result_t
+B85_DECODED_LENGTH (const uint8_t *b, size_t cb_b, size_t *length);
+
+/// Encodes the @a cb_b bytes at the start of @a b in place, working from the
+/// last group to the first. The buffer must have room for the encoded form
+/// without 'z' groups, i.e. @a cb_cap must be at least 5 * (cb_b / 4) bytes,
+/// plus cb_b % 4 + 1 for a final partial group (about 25% slack). The encoded
+/// length is stored in @a cb_out. The result is not NUL terminated.
+///
+/// @return 0 for success, B85_E_BUFFER_TOO_SMALL if @a cb_cap is too small.
+b85_result_t
+B85_ENCODE_INPLACE (uint8_t *b, size_t cb_b, size_t cb_cap, size_t *cb_out);
+
+/// Decodes the complete encoded stream in @a b in place, i.e. the decoded
+/// bytes overwrite the input from the start of @a b. The same rules as
+/// B85_DECODE() followed by B85_DECODE_LAST() apply. The decoded length is
+/// stored in @a cb_out.
+///
+/// Note: A 'z' group decodes to more bytes than it consumes. If a run of 'z'
+/// groups would overwrite input that has not been read yet, nothing is
+/// written and B85_E_BUFFER_TOO_SMALL is returned. On any other error, the
+/// contents of @a b are unspecified.
+///
+/// @return 0 for success.
+b85_result_t
+B85_DECODE_INPLACE (uint8_t *b, size_t cb_b, size_t *cb_out);
+
+/// Builds a random access index over the complete encoded stream in @a b, with
+/// a checkpoint every @a interval decoded bytes (a positive multiple of 4).
+/// Checkpoints are at group boundaries, so whitespace and 'z' groups are
+/// accounted for. The stream is validated like B85_DECODED_LENGTH(). On
+/// success, the index must be freed with B85_INDEX_DESTROY().
+///
+/// @return 0 for success.
+b85_result_t
+B85_INDEX_BUILD (
+  const uint8_t *b, size_t cb_b, size_t interval, struct base85_index_t *index
+);
+
+/// Serializes @a index to the compact form read by B85_INDEX_LOAD() (the
+/// checkpoints are stored as variable length deltas). The serialized length
+/// is stored in @a cb_out, even if @a cb is too small; @a b may be NULL in
+/// order to query the length.
+///
+/// @return 0 for success, B85_E_BUFFER_TOO_SMALL if @a cb is too small.
+b85_result_t
+B85_INDEX_SAVE (
+  const struct base85_index_t *index, uint8_t *b, size_t cb, size_t *cb_out
+);
+
+/// Reads an index that was serialized by B85_INDEX_SAVE(). On success, the
+/// index must be freed with B85_INDEX_DESTROY().
+///
+/// @return 0 for success, B85_E_BAD_INDEX if @a b is malformed.
+b85_result_t
+B85_INDEX_LOAD (const uint8_t *b, size_t cb, struct base85_index_t *index);
+
+/// Frees memory associated with @a index.
+void
+B85_INDEX_DESTROY (struct base85_index_t *index);
+
+/// Decodes the @a length bytes at decoded offset @a offset of the encoded
+/// stream in @a b, starting from the nearest checkpoint in @a index instead of
+/// the start of the stream. The range is clamped to the end of the decoded
+/// stream. The result is stored in @a ctx, which is reset first; on failure,
+/// B85_GET_PROCESSED() is the error position within @a b.
+///
+/// Note: Only the input between the checkpoint and the end of the range is
+/// validated.
+///
+/// @return 0 for success, B85_E_BAD_INDEX if @a index was built for a stream
+/// of a different length, B85_E_API_MISUSE if @a offset is past the end or
+/// @a ctx has an alphabet other than the default one (like the index).
+b85_result_t
+B85_DECODE_RANGE (
+  const uint8_t *b, size_t cb_b, const struct base85_index_t *index,
+  size_t offset, size_t length, struct base85_context_t *ctx
+);
+
+/// Updates the encoded stream in @a b after the bytes in the @a n @a ranges of
+/// the binary data have changed, without encoding the whole stream again.
+/// @a data holds all @a cb_data bytes of the new binary data, and @a index
+/// was built for @a b. Only the groups that overlap the ranges are encoded
+/// (with the default alphabet) and written over their old characters, so
+/// whitespace and framing are kept. The rest of the stream only moves if a
+/// group changes to or from a 'z' group; on success, @a index is updated to
+/// match, and the new encoded length is stored in @a cb_out.
+///
+/// Note: The groups outside the ranges are not validated. A group that
+/// changes width is written without the whitespace inside it, and lines are
+/// not wrapped again, so line lengths may vary afterwards.
+///
+/// @return 0 for success, B85_E_BUFFER_TOO_SMALL if the stream grows past
+/// @a cb_cap (@a cb_out is set, and nothing is modified), B85_E_BAD_INDEX if
+/// @a index was built for a stream of a different length.
+b85_result_t
+B85_ENCODE_PATCH (
+  uint8_t *b, size_t cb_b, size_t cb_cap, struct base85_index_t *index,
+  const uint8_t *data, size_t cb_data, const struct base85_range_t *ranges,
+  size_t n, size_t *cb_out
+);
+
+/// Converts @a cb_b bytes of encoded input from @a b, in the alphabet of
+/// @a ctx, directly to another alphabet: Z85 if the alphabet of @a ctx is
+/// Ascii85, and Ascii85 otherwise (Z85, RFC 1924 or a custom alphabet). This
+/// is done one group at a time without decoding to binary, so ascii85_to_z85
+/// and z85_to_ascii85 name the conversion of a context with the default
+/// alphabet only. The result is stored in @a ctx. The input is validated with the same rules as
+/// B85_DECODE(); whitespace and the header/footer are dropped. A 'z' group
+/// expands to "00000" in Z85, and an all-zero Z85 group is abbreviated to 'z'.
+/// A trailing partial group maps digit for digit, since both alphabets
+/// truncate the final group the same way.
+/// @pre @a b must contain at least @a cb_b bytes, and @a ctx must be a valid
+/// context that is not used for anything else until it is reset.
+///
+/// Note: B85_TRANSCODE_LAST() must be called in order to finalize the
+/// operation.
+///
+/// @return 0 for success.
+b85_result_t
+B85_TRANSCODE (const uint8_t *b, size_t cb_b, struct base85_context_t *ctx);
+
+/// Finalizes an operation that was initiated by calling B85_TRANSCODE().
+/// Like B85_ENCODE_LAST(), the output is NUL terminated.
+/// @pre @a ctx must be valid.
+///
+/// @return 0 for success.
+b85_result_t
+B85_TRANSCODE_LAST (struct base85_context_t *ctx);
+
+#if defined (__cplusplus)
+}
+#endif
+
 #endif // !defined (BASE85_H__INCLUDED__)
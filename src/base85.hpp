@@ -0,0 +1,452 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (BASE85_HPP__INCLUDED__)
+#define BASE85_HPP__INCLUDED__
+
+// C++20 range adaptors over the base85 codecs. The views produce their output
+// lazily, one group at a time, using the alphabet and decode tables of the C
+// library, so the output can be consumed (hashed, compared, written) without
+// ever being stored:
+//
+//   std::ranges::equal (token | base85::views::decode<>, expected);
+//
+// stops decoding at the first mismatch.
+
+#include "base85.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+const uint8_t *ascii85_get_alphabet (void);
+const uint8_t *ascii85_get_decode_table (void);
+const uint8_t *z85_get_alphabet (void);
+const uint8_t *z85_get_decode_table (void);
+}
+
+namespace base85
+{
+
+/// Ascii85 alphabet (link with the ascii85 library).
+struct ascii85
+{
+  /// An all-zero group is written as 'z'.
+  static constexpr bool zero_groups = true;
+
+  static const std::uint8_t *alphabet () { return ascii85_get_alphabet (); }
+  static const std::uint8_t *decode_table ()
+  {
+    return ascii85_get_decode_table ();
+  }
+};
+
+/// Z85 alphabet (link with the z85 library).
+struct z85
+{
+  static constexpr bool zero_groups = false;
+
+  static const std::uint8_t *alphabet () { return z85_get_alphabet (); }
+  static const std::uint8_t *decode_table () { return z85_get_decode_table (); }
+};
+
+namespace detail
+{
+
+template <class T>
+constexpr std::uint8_t
+to_byte (T v)
+{
+  if constexpr (std::is_enum_v<T>)
+    return static_cast<std::uint8_t> (static_cast<unsigned char> (v));
+  else
+    return static_cast<std::uint8_t> (v);
+}
+
+template <class R>
+concept byte_range = std::ranges::input_range<R>
+  && (std::is_integral_v<std::ranges::range_value_t<R>>
+    || std::is_same_v<std::ranges::range_value_t<R>, std::byte>)
+  && sizeof (std::ranges::range_value_t<R>) == 1;
+
+/// Iterator shared by the views below: all state lives in the view (these
+/// are single pass, input views), the iterator only refers to it.
+template <class View, class Value>
+class view_iterator
+{
+public:
+  using iterator_concept = std::input_iterator_tag;
+  using value_type = Value;
+  using difference_type = std::ptrdiff_t;
+
+  view_iterator () = default;
+  explicit view_iterator (View *parent) : parent_ (parent) {}
+
+  Value operator* () const { return parent_->current (); }
+
+  view_iterator &
+  operator++ ()
+  {
+    parent_->advance ();
+    return *this;
+  }
+
+  void operator++ (int) { ++*this; }
+
+  friend bool
+  operator== (const view_iterator &i, std::default_sentinel_t)
+  {
+    return i.at_end ();
+  }
+
+private:
+  bool at_end () const { return parent_->at_end (); }
+
+  View *parent_ = nullptr;
+};
+
+} // namespace detail
+
+/// Lazily encodes the bytes of @a V, like B85_ENCODE() followed by
+/// B85_ENCODE_LAST() (no header/footer, no line breaks).
+template <std::ranges::view V, class Alphabet = ascii85>
+  requires detail::byte_range<V>
+class encode_view
+  : public std::ranges::view_interface<encode_view<V, Alphabet>>
+{
+public:
+  using iterator = detail::view_iterator<encode_view, char>;
+
+  encode_view () = default;
+  explicit encode_view (V base) : base_ (std::move (base)) {}
+
+  iterator
+  begin ()
+  {
+    it_ = std::ranges::begin (base_);
+    fill ();
+    return iterator (this);
+  }
+
+  std::default_sentinel_t end () const { return {}; }
+
+  V base () const & { return base_; }
+
+private:
+  friend iterator;
+
+  char current () const { return static_cast<char> (group_[pos_]); }
+
+  void
+  advance ()
+  {
+    if (++pos_ == len_)
+      fill ();
+  }
+
+  bool at_end () const { return pos_ == len_; }
+
+  /// Encodes the next (possibly partial) group.
+  void
+  fill ()
+  {
+    pos_ = 0;
+    len_ = 0;
+
+    auto end = std::ranges::end (base_);
+    std::uint32_t v = 0;
+    std::size_t n = 0;
+    for (; n < 4 && *it_ != end; ++n, ++*it_)
+      v |= std::uint32_t { detail::to_byte (**it_) } << (24 - 8 * n);
+
+    if (!n)
+      return;
+
+    if (Alphabet::zero_groups && 4 == n && !v)
+    {
+      group_[0] = 'z';
+      len_ = 1;
+      return;
+    }
+
+    const std::uint8_t *alphabet = Alphabet::alphabet ();
+    for (int c = 4; c >= 0; --c)
+    {
+      group_[c] = alphabet[v % 85];
+      v /= 85;
+    }
+    len_ = n + 1;
+  }
+
+  V base_ = V ();
+  std::optional<std::ranges::iterator_t<V>> it_;
+  std::uint8_t group_[5] = {};
+  std::size_t pos_ = 0;
+  std::size_t len_ = 0;
+};
+
+/// Lazily decodes the characters of @a V, with the same rules as B85_DECODE()
+/// followed by B85_DECODE_LAST() (whitespace, 'z' groups, header/footer).
+/// Decoding stops at the first error, which is then available from error().
+template <std::ranges::view V, class Alphabet = ascii85>
+  requires detail::byte_range<V>
+class decode_view
+  : public std::ranges::view_interface<decode_view<V, Alphabet>>
+{
+public:
+  using iterator = detail::view_iterator<decode_view, std::uint8_t>;
+
+  decode_view () = default;
+  explicit decode_view (V base) : base_ (std::move (base)) {}
+
+  iterator
+  begin ()
+  {
+    it_ = std::ranges::begin (base_);
+    table_ = Alphabet::decode_table ();
+    fill ();
+    return iterator (this);
+  }
+
+  std::default_sentinel_t end () const { return {}; }
+
+  V base () const & { return base_; }
+
+  /// The error that ended the output early, or B85_E_OK.
+  b85_result_t error () const { return error_; }
+
+  /// The number of input characters consumed so far (the error position).
+  std::size_t processed () const { return processed_; }
+
+private:
+  friend iterator;
+
+  /// Mirrors b85_state_t.
+  enum state_t : std::uint8_t
+  {
+    START, NO_HEADER, HEADER0, HEADER, FOOTER0, FOOTER, INVALID,
+  };
+
+  std::uint8_t current () const { return out_[pos_]; }
+
+  void
+  advance ()
+  {
+    if (++pos_ == len_)
+      fill ();
+  }
+
+  bool at_end () const { return pos_ == len_; }
+
+  static bool
+  whitespace (std::uint8_t c)
+  {
+    return ' ' == c || '\n' == c || '\r' == c || '\t' == c;
+  }
+
+  /// Header/footer transitions, see base85_handle_state(). Returns true if
+  /// @a c has been consumed.
+  bool
+  handle_state (std::uint8_t c)
+  {
+    switch (state_)
+    {
+    case START:
+      if ('<' == c)
+      {
+        state_ = HEADER0;
+        return true;
+      }
+      state_ = NO_HEADER;
+      return false;
+
+    case NO_HEADER:
+      return false;
+
+    case HEADER0:
+      if ('~' == c)
+      {
+        state_ = HEADER;
+        return true;
+      }
+      hold_[hold_pos_++] = table_['<'] - 1;
+      state_ = NO_HEADER;
+      return false;
+
+    case HEADER:
+      if ('~' == c)
+      {
+        state_ = FOOTER0;
+        return true;
+      }
+      return false;
+
+    case FOOTER0:
+      state_ = '>' == c ? FOOTER : INVALID;
+      return true;
+
+    case FOOTER:
+    case INVALID:
+      break;
+    }
+    return true;
+  }
+
+  /// Decodes the hold to @a n bytes, see base85_decode_strict().
+  bool
+  decode_hold (std::size_t n)
+  {
+    std::uint32_t v = 0;
+    for (int c = 0; c < 4; ++c)
+      v = v * 85 + hold_[c];
+    if (0xffffffff / 85 < v || 0xffffffff - hold_[4] < (v *= 85))
+    {
+      error_ = B85_E_OVERFLOW;
+      return false;
+    }
+    v += hold_[4];
+
+    for (std::size_t i = 0; i < 4; ++i)
+      out_[i] = static_cast<std::uint8_t> (v >> (24 - 8 * i));
+    hold_pos_ = 0;
+    len_ = n;
+    return true;
+  }
+
+  /// Decodes the next group.
+  void
+  fill ()
+  {
+    pos_ = 0;
+    len_ = 0;
+    if (finished_)
+      return;
+
+    auto end = std::ranges::end (base_);
+    while (*it_ != end && FOOTER != state_)
+    {
+      if (INVALID == state_)
+      {
+        error_ = B85_E_BAD_FOOTER;
+        finished_ = true;
+        return;
+      }
+
+      std::uint8_t c = detail::to_byte (**it_);
+      ++*it_;
+      ++processed_;
+
+      if (HEADER0 != state_ && FOOTER0 != state_ && whitespace (c))
+        continue;
+
+      if (handle_state (c))
+        continue;
+
+      if (Alphabet::zero_groups && 'z' == c && !hold_pos_)
+      {
+        out_[0] = out_[1] = out_[2] = out_[3] = 0;
+        len_ = 4;
+        return;
+      }
+
+      std::uint8_t x = table_[c];
+      if (!x--)
+      {
+        error_ = B85_E_INVALID_CHAR;
+        finished_ = true;
+        return;
+      }
+
+      hold_[hold_pos_++] = x;
+      if (5 == hold_pos_)
+      {
+        if (!decode_hold (4))
+          finished_ = true;
+        return;
+      }
+    }
+
+    // End of input (or of the frame), see B85_DECODE_LAST().
+    finished_ = true;
+    if (START == state_)
+      return;
+
+    if (FOOTER != state_ && NO_HEADER != state_)
+    {
+      error_ = B85_E_BAD_FOOTER;
+      return;
+    }
+
+    if (hold_pos_)
+    {
+      std::size_t n = hold_pos_ - 1;
+      for (std::size_t i = hold_pos_; i < 5; ++i)
+        hold_[i] = 84;
+      decode_hold (n);
+    }
+  }
+
+  V base_ = V ();
+  std::optional<std::ranges::iterator_t<V>> it_;
+  const std::uint8_t *table_ = nullptr;
+  state_t state_ = START;
+  std::uint8_t hold_[5] = {};
+  std::size_t hold_pos_ = 0;
+  std::uint8_t out_[4] = {};
+  std::size_t pos_ = 0;
+  std::size_t len_ = 0;
+  std::size_t processed_ = 0;
+  bool finished_ = false;
+  b85_result_t error_ = B85_E_OK;
+};
+
+template <class R, class Alphabet = ascii85>
+encode_view (R &&) -> encode_view<std::views::all_t<R>, Alphabet>;
+
+template <class R, class Alphabet = ascii85>
+decode_view (R &&) -> decode_view<std::views::all_t<R>, Alphabet>;
+
+namespace detail
+{
+
+/// Range adaptor object, usable as views::encode<> (r) or r | views::encode<>.
+template <template <class, class> class View, class Alphabet>
+struct adaptor
+{
+  template <std::ranges::viewable_range R>
+  auto
+  operator() (R &&r) const
+  {
+    return View<std::views::all_t<R>, Alphabet> (
+      std::views::all (std::forward<R> (r))
+    );
+  }
+
+  template <std::ranges::viewable_range R>
+  friend auto
+  operator| (R &&r, const adaptor &a)
+  {
+    return a (std::forward<R> (r));
+  }
+};
+
+} // namespace detail
+
+namespace views
+{
+
+template <class Alphabet = ascii85>
+inline constexpr detail::adaptor<encode_view, Alphabet> encode {};
+
+template <class Alphabet = ascii85>
+inline constexpr detail::adaptor<decode_view, Alphabet> decode {};
+
+} // namespace views
+
+} // namespace base85
+
+#endif // !defined (BASE85_HPP__INCLUDED__)
@@ -0,0 +1,477 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Default number of shards, see B85_CACHE_CREATE().
+#define B85_CACHE_SHARDS 16
+
+/// Initial number of hash buckets of a shard.
+#define B85_CACHE_BUCKETS 64
+
+/// Conversions, part of the key of an entry.
+typedef enum
+{
+  B85_CACHE_OP_ENCODE = 1,
+  B85_CACHE_OP_DECODE,
+} b85_cache_op_t;
+
+/// A cached conversion: the input (key) followed by the output (value).
+struct base85_cache_entry_t
+{
+  /// Next entry of the same hash bucket.
+  struct base85_cache_entry_t *chain;
+
+  /// LRU list, from the most to the least recently used entry.
+  struct base85_cache_entry_t *prev;
+  struct base85_cache_entry_t *next;
+
+  uint64_t hash;
+  size_t key_cb;
+  size_t value_cb;
+  uint8_t op;
+  uint8_t data[];
+};
+
+/// A lock stripe of the cache, padded to its own cache lines so that the
+/// shards do not share lines between cores.
+struct base85_cache_shard_t
+{
+  pthread_mutex_t lock;
+
+  /// Hash table (a power of two number of chained buckets).
+  struct base85_cache_entry_t **buckets;
+  size_t bucket_count;
+
+  /// LRU list.
+  struct base85_cache_entry_t *head;
+  struct base85_cache_entry_t *tail;
+
+  /// Memory cap of the shard, and what the entries take.
+  size_t cap;
+  size_t bytes;
+  size_t entries;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+} __attribute__ ((aligned (64)));
+
+struct b85_cache_t
+{
+  struct base85_cache_shard_t *shards;
+
+  /// Number of shards (a power of two).
+  size_t shard_count;
+};
+
+/// Hashes the @a cb_b bytes at @a b, 8 bytes per step.
+static uint64_t
+base85_cache_hash (const uint8_t *b, size_t cb_b, uint8_t op)
+{
+  uint64_t h = (cb_b + op) * 0x9e3779b97f4a7c15ull;
+  size_t i = 0;
+  for (; i + 8 <= cb_b; i += 8)
+  {
+    uint64_t w;
+    memcpy (&w, b + i, 8);
+    h = (h ^ w) * 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 31;
+  }
+
+  uint64_t w = 0;
+  if (cb_b > i)
+    memcpy (&w, b + i, cb_b - i);
+  h = (h ^ w) * 0x94d049bb133111ebull;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  return h ^ (h >> 32);
+}
+
+/// Memory taken by an entry.
+static size_t
+base85_cache_entry_size (size_t key_cb, size_t value_cb)
+{
+  return sizeof (struct base85_cache_entry_t) + key_cb + value_cb;
+}
+
+static void
+base85_cache_unlink (
+  struct base85_cache_shard_t *shard, struct base85_cache_entry_t *e
+)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    shard->head = e->next;
+
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    shard->tail = e->prev;
+}
+
+static void
+base85_cache_push_front (
+  struct base85_cache_shard_t *shard, struct base85_cache_entry_t *e
+)
+{
+  e->prev = NULL;
+  e->next = shard->head;
+  if (shard->head)
+    shard->head->prev = e;
+  else
+    shard->tail = e;
+  shard->head = e;
+}
+
+/// Finds the entry for @a op on the @a cb_b bytes at @a b, and makes it the
+/// most recently used one.
+/// @pre The shard is locked.
+static struct base85_cache_entry_t *
+base85_cache_find (
+  struct base85_cache_shard_t *shard, uint64_t hash, uint8_t op,
+  const uint8_t *b, size_t cb_b
+)
+{
+  if (!shard->buckets)
+    return NULL;
+
+  struct base85_cache_entry_t *e
+    = shard->buckets[hash & (shard->bucket_count - 1)];
+  for (; e; e = e->chain)
+  {
+    if (e->hash == hash && e->op == op && e->key_cb == cb_b
+      && (!cb_b || !memcmp (e->data, b, cb_b)))
+    {
+      break;
+    }
+  }
+
+  if (e && e != shard->head)
+  {
+    base85_cache_unlink (shard, e);
+    base85_cache_push_front (shard, e);
+  }
+  return e;
+}
+
+/// Removes @a e from the hash table of @a shard.
+static void
+base85_cache_unchain (
+  struct base85_cache_shard_t *shard, struct base85_cache_entry_t *e
+)
+{
+  struct base85_cache_entry_t **p
+    = &shard->buckets[e->hash & (shard->bucket_count - 1)];
+  while (*p != e)
+    p = &(*p)->chain;
+  *p = e->chain;
+}
+
+/// Doubles the hash table of @a shard once it holds more entries than
+/// buckets. Without memory, the chains just get longer.
+static void
+base85_cache_grow (struct base85_cache_shard_t *shard)
+{
+  if (shard->buckets && shard->entries < shard->bucket_count)
+    return;
+
+  size_t count = shard->buckets ? shard->bucket_count * 2 : B85_CACHE_BUCKETS;
+  struct base85_cache_entry_t **buckets = calloc (count, sizeof (*buckets));
+  if (!buckets)
+    return;
+
+  for (size_t i = 0; shard->buckets && i < shard->bucket_count; ++i)
+  {
+    struct base85_cache_entry_t *e = shard->buckets[i];
+    while (e)
+    {
+      struct base85_cache_entry_t *chain = e->chain;
+      e->chain = buckets[e->hash & (count - 1)];
+      buckets[e->hash & (count - 1)] = e;
+      e = chain;
+    }
+  }
+
+  free (shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_count = count;
+}
+
+/// Caches @a value as the result of @a op on @a key, evicting the least
+/// recently used entries as needed. Results that do not fit into the shard at
+/// all are not cached.
+/// @pre The shard is locked, and has no entry for the key.
+static void
+base85_cache_insert (
+  struct base85_cache_shard_t *shard, uint64_t hash, uint8_t op,
+  const uint8_t *key, size_t key_cb, const uint8_t *value, size_t value_cb
+)
+{
+  size_t size = base85_cache_entry_size (key_cb, value_cb);
+  if (size > shard->cap)
+    return;
+
+  base85_cache_grow (shard);
+  if (!shard->buckets)
+    return;
+
+  while (shard->bytes + size > shard->cap)
+  {
+    struct base85_cache_entry_t *victim = shard->tail;
+    base85_cache_unlink (shard, victim);
+    base85_cache_unchain (shard, victim);
+    shard->bytes -= base85_cache_entry_size (victim->key_cb, victim->value_cb);
+    --shard->entries;
+    ++shard->evictions;
+    free (victim);
+  }
+
+  struct base85_cache_entry_t *e = malloc (size);
+  if (!e)
+    return;
+
+  e->hash = hash;
+  e->op = op;
+  e->key_cb = key_cb;
+  e->value_cb = value_cb;
+  if (key_cb)
+    memcpy (e->data, key, key_cb);
+  memcpy (e->data + key_cb, value, value_cb);
+
+  struct base85_cache_entry_t **bucket
+    = &shard->buckets[hash & (shard->bucket_count - 1)];
+  e->chain = *bucket;
+  *bucket = e;
+  base85_cache_push_front (shard, e);
+  shard->bytes += size;
+  ++shard->entries;
+}
+
+b85_result_t
+B85_CACHE_CREATE (
+  size_t max_bytes, size_t shards, struct b85_cache_t **cache
+)
+{
+  if (!cache || !max_bytes)
+    return B85_E_API_MISUSE;
+
+  size_t count = 1;
+  while (count < (shards ? shards : B85_CACHE_SHARDS))
+    count *= 2;
+
+  struct b85_cache_t *c = malloc (sizeof (*c));
+  void *p = NULL;
+  if (!c || posix_memalign (&p, 64, count * sizeof (*c->shards)))
+  {
+    free (c);
+    return B85_E_BAD_ALLOC;
+  }
+
+  c->shards = p;
+  c->shard_count = count;
+  for (size_t i = 0; i < count; ++i)
+  {
+    struct base85_cache_shard_t *shard = &c->shards[i];
+    memset (shard, 0, sizeof (*shard));
+    pthread_mutex_init (&shard->lock, NULL);
+    shard->cap = max_bytes / count;
+  }
+
+  *cache = c;
+  return B85_E_OK;
+}
+
+void
+B85_CACHE_DESTROY (struct b85_cache_t *cache)
+{
+  if (!cache)
+    return;
+
+  for (size_t i = 0; i < cache->shard_count; ++i)
+  {
+    struct base85_cache_shard_t *shard = &cache->shards[i];
+    while (shard->head)
+    {
+      struct base85_cache_entry_t *e = shard->head;
+      shard->head = e->next;
+      free (e);
+    }
+    free (shard->buckets);
+    pthread_mutex_destroy (&shard->lock);
+  }
+
+  free (cache->shards);
+  free (cache);
+}
+
+/// Copies the @a value_cb bytes of @a value to @a out, see B85_CACHE_ENCODE().
+static b85_result_t
+base85_cache_copy (
+  const uint8_t *value, size_t value_cb, uint8_t *out, size_t cb,
+  size_t *cb_out
+)
+{
+  *cb_out = value_cb;
+  if (cb < value_cb)
+    return B85_E_BUFFER_TOO_SMALL;
+
+  if (value_cb)
+    memcpy (out, value, value_cb);
+  return B85_E_OK;
+}
+
+/// Runs @a op on the @a cb_b bytes at @a b into a new buffer, stored in
+/// @a value (freed by the caller) with its length in @a value_cb.
+static b85_result_t
+base85_cache_convert (
+  uint8_t op, const uint8_t *b, size_t cb_b, uint8_t **value,
+  size_t *value_cb
+)
+{
+  // Encoding grows the input by at most 25%, and decoding in place only
+  // shrinks it, except for runs of 'z' groups.
+  size_t cb = B85_CACHE_OP_ENCODE == op ? cb_b / 4 * 5 + 5 : cb_b;
+  uint8_t *buf = malloc (cb ? cb : 1);
+  if (!buf)
+    return B85_E_BAD_ALLOC;
+  if (cb_b)
+    memcpy (buf, b, cb_b);
+
+  b85_result_t rv = B85_CACHE_OP_ENCODE == op
+    ? B85_ENCODE_INPLACE (buf, cb_b, cb, value_cb)
+    : B85_DECODE_INPLACE (buf, cb_b, value_cb);
+  if (B85_E_BUFFER_TOO_SMALL == rv && B85_CACHE_OP_DECODE == op)
+  {
+    size_t length;
+    uint8_t *p = NULL;
+    rv = B85_DECODED_LENGTH (b, cb_b, &length);
+    if (B85_E_OK == rv)
+      p = realloc (buf, length ? length : 1);
+    if (p)
+    {
+      // Decode from the original input, with the output sized exactly.
+      struct base85_context_t ctx;
+      buf = p;
+      rv = B85_CONTEXT_INIT (&ctx);
+      if (B85_E_OK == rv)
+      {
+        rv = B85_DECODE (b, cb_b, &ctx);
+        if (B85_E_OK == rv)
+          rv = B85_DECODE_LAST (&ctx);
+        const uint8_t *out = B85_GET_OUTPUT (&ctx, value_cb);
+        if (B85_E_OK == rv)
+          memcpy (buf, out, *value_cb);
+        B85_CONTEXT_DESTROY (&ctx);
+      }
+    }
+    else if (B85_E_OK == rv)
+    {
+      rv = B85_E_BAD_ALLOC;
+    }
+  }
+
+  if (rv)
+  {
+    free (buf);
+    return rv;
+  }
+
+  *value = buf;
+  return B85_E_OK;
+}
+
+/// Looks up @a op on the @a cb_b bytes at @a b, and runs it on a miss.
+static b85_result_t
+base85_cache_run (
+  struct b85_cache_t *cache, uint8_t op, const uint8_t *b, size_t cb_b,
+  uint8_t *out, size_t cb, size_t *cb_out
+)
+{
+  if (!cache || !cb_out || (cb_b && !b) || (cb && !out))
+    return B85_E_API_MISUSE;
+
+  uint64_t hash = base85_cache_hash (b, cb_b, op);
+  struct base85_cache_shard_t *shard
+    = &cache->shards[(hash >> 40) & (cache->shard_count - 1)];
+
+  pthread_mutex_lock (&shard->lock);
+  struct base85_cache_entry_t *e = base85_cache_find (shard, hash, op, b, cb_b);
+  b85_result_t rv = B85_E_OK;
+  if (e)
+  {
+    ++shard->hits;
+    rv = base85_cache_copy (e->data + cb_b, e->value_cb, out, cb, cb_out);
+  }
+  else
+  {
+    ++shard->misses;
+  }
+  pthread_mutex_unlock (&shard->lock);
+  if (e)
+    return rv;
+
+  // The conversion runs unlocked, so another thread may have cached the same
+  // result in the meantime.
+  uint8_t *value;
+  size_t value_cb;
+  rv = base85_cache_convert (op, b, cb_b, &value, &value_cb);
+  if (rv)
+    return rv;
+
+  pthread_mutex_lock (&shard->lock);
+  if (!base85_cache_find (shard, hash, op, b, cb_b))
+    base85_cache_insert (shard, hash, op, b, cb_b, value, value_cb);
+  pthread_mutex_unlock (&shard->lock);
+
+  rv = base85_cache_copy (value, value_cb, out, cb, cb_out);
+  free (value);
+  return rv;
+}
+
+b85_result_t
+B85_CACHE_ENCODE (
+  struct b85_cache_t *cache, const uint8_t *b, size_t cb_b, uint8_t *out,
+  size_t cb, size_t *cb_out
+)
+{
+  return base85_cache_run (
+    cache, B85_CACHE_OP_ENCODE, b, cb_b, out, cb, cb_out
+  );
+}
+
+b85_result_t
+B85_CACHE_DECODE (
+  struct b85_cache_t *cache, const uint8_t *b, size_t cb_b, uint8_t *out,
+  size_t cb, size_t *cb_out
+)
+{
+  return base85_cache_run (
+    cache, B85_CACHE_OP_DECODE, b, cb_b, out, cb, cb_out
+  );
+}
+
+void
+B85_CACHE_STATS (struct b85_cache_t *cache, struct b85_cache_stats_t *stats)
+{
+  if (!stats)
+    return;
+
+  memset (stats, 0, sizeof (*stats));
+  for (size_t i = 0; cache && i < cache->shard_count; ++i)
+  {
+    struct base85_cache_shard_t *shard = &cache->shards[i];
+    pthread_mutex_lock (&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->entries += shard->entries;
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock (&shard->lock);
+  }
+}
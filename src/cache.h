@@ -0,0 +1,92 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (CACHE_H__INCLUDED__)
+#define CACHE_H__INCLUDED__
+
+#include "base85.h"
+
+#define B85_CACHE_CREATE B85_NAME (cache_create)
+#define B85_CACHE_DESTROY B85_NAME (cache_destroy)
+#define B85_CACHE_ENCODE B85_NAME (cache_encode)
+#define B85_CACHE_DECODE B85_NAME (cache_decode)
+#define B85_CACHE_STATS B85_NAME (cache_stats)
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/// Bounded memo cache of conversions, for workloads that convert the same
+/// small values (keys, session IDs, fixed headers) over and over. Entries are
+/// keyed by a 64-bit hash of the input and compared in full, so a hash
+/// collision never returns a wrong result.
+///
+/// The cache is split into shards, each with its own lock, hash table and
+/// LRU list; a conversion only locks the shard its hash falls into. Each shard
+/// holds at most its share of the memory cap (entries, keys and values
+/// included), evicting the least recently used entries to make room.
+struct b85_cache_t;
+
+/// Counters of a cache, summed over its shards. @see B85_CACHE_STATS()
+struct b85_cache_stats_t
+{
+  /// Conversions answered from the cache.
+  uint64_t hits;
+
+  /// Conversions that ran the codec (including failed ones).
+  uint64_t misses;
+
+  /// Entries evicted to stay within the memory cap.
+  uint64_t evictions;
+
+  /// Current number of entries, and the memory they take.
+  size_t entries;
+  size_t bytes;
+};
+
+/// Creates a cache that uses at most @a max_bytes of memory for its entries,
+/// spread over @a shards shards (rounded up to a power of two; 0 for the
+/// default of 16). Free it with B85_CACHE_DESTROY().
+///
+/// @return 0 for success, B85_E_API_MISUSE if @a max_bytes is zero.
+b85_result_t
+B85_CACHE_CREATE (
+  size_t max_bytes, size_t shards, struct b85_cache_t **cache
+);
+
+/// Frees @a cache and all of its entries.
+void
+B85_CACHE_DESTROY (struct b85_cache_t *cache);
+
+/// Encodes the @a cb_b bytes at @a b like B85_ENCODE() followed by
+/// B85_ENCODE_LAST(), through @a cache, and copies the result (not NUL
+/// terminated) to @a out. The encoded length is stored in @a cb_out, even if
+/// @a cb is too small; the result is cached either way, so that the call can
+/// be repeated with a larger buffer. Thread safe.
+///
+/// @return 0 for success, B85_E_BUFFER_TOO_SMALL if @a cb is too small.
+b85_result_t
+B85_CACHE_ENCODE (
+  struct b85_cache_t *cache, const uint8_t *b, size_t cb_b, uint8_t *out,
+  size_t cb, size_t *cb_out
+);
+
+/// Decodes the complete encoded stream in @a b like B85_DECODE() followed by
+/// B85_DECODE_LAST(), through @a cache, see B85_CACHE_ENCODE(). Failed
+/// conversions are not cached. Thread safe.
+///
+/// @return 0 for success, B85_E_BUFFER_TOO_SMALL if @a cb is too small.
+b85_result_t
+B85_CACHE_DECODE (
+  struct b85_cache_t *cache, const uint8_t *b, size_t cb_b, uint8_t *out,
+  size_t cb, size_t *cb_out
+);
+
+/// Gets the counters of @a cache.
+void
+B85_CACHE_STATS (struct b85_cache_t *cache, struct b85_cache_stats_t *stats);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // !defined (CACHE_H__INCLUDED__)
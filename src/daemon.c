@@ -0,0 +1,675 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+// Encode/decode daemon: serves requests (see daemon.h) over a Unix domain
+// socket. A single thread runs an epoll loop over all connections; complete
+// requests are queued to worker threads, which take them in batches and each
+// reuse one context for all of their requests.
+
+#define _GNU_SOURCE
+
+#include "base85.h"
+#include "cache.h"
+#include "daemon.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define dimof(x) (sizeof(x) / sizeof(*x))
+
+/// Maximum number of requests a worker takes from the queue at once.
+static const size_t WORKER_BATCH = 16;
+
+static const size_t READ_CHUNK = 64 * 1024;
+
+/// Encode and decode requests up to this size go through the cache (-c).
+static const size_t CACHE_PAYLOAD_MAX = 4096;
+
+/// Connection states.
+typedef enum
+{
+  /// Waiting for a complete request.
+  CONN_READING,
+
+  /// A request is being processed by a worker.
+  CONN_PROCESSING,
+
+  /// The response is being sent.
+  CONN_WRITING,
+} conn_state_t;
+
+struct conn_t;
+
+/// A request, owned by its connection.
+struct job_t
+{
+  struct conn_t *conn;
+  uint8_t op;
+
+  /// Payload, borrowed from the input buffer of the connection (which is not
+  /// touched while the request is processed).
+  const uint8_t *payload;
+  size_t payload_cb;
+
+  /// Complete response (header and payload), built by the worker.
+  uint8_t *response;
+  size_t response_cb;
+
+  struct job_t *next;
+};
+
+struct conn_t
+{
+  int fd;
+  conn_state_t state;
+
+  /// The peer has closed its end.
+  bool eof;
+
+  /// The connection is registered with epoll.
+  bool watched;
+
+  uint8_t *in;
+  size_t in_cb;
+  size_t in_cap;
+
+  /// Bytes of the response that have been sent.
+  size_t sent;
+
+  struct job_t job;
+};
+
+/// Queue of pending requests, and list of finished ones.
+struct queue_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct job_t *head;
+  struct job_t **tail;
+  bool stop;
+
+  pthread_mutex_t done_lock;
+  struct job_t *done;
+
+  /// Signals the event loop that there are finished requests.
+  int event_fd;
+};
+
+static volatile sig_atomic_t g_stop;
+
+/// Memo cache of small conversions, or NULL.
+static struct b85_cache_t *g_cache;
+
+static void
+on_signal (int sig)
+{
+  (void) sig;
+  g_stop = 1;
+}
+
+static int
+usage (const char *name)
+{
+  fprintf (
+    stderr, "Usage: %s [-j threads] [-c cache_bytes] socket_path\n", name
+  );
+  return 2;
+}
+
+/// Runs a small encode or decode request through the cache, and builds the
+/// response. Returns false if the request has to run on a context instead,
+/// e.g. for the error position of a failed request.
+static bool
+run_cached (struct job_t *job)
+{
+  bool encode = B85_OP_ENCODE == job->op;
+  if (!g_cache || job->payload_cb > CACHE_PAYLOAD_MAX
+    || (!encode && B85_OP_DECODE != job->op))
+  {
+    return false;
+  }
+
+  // Bounds: 5 characters per 4 bytes, 4 bytes per 'z' group.
+  size_t cap = encode ? job->payload_cb / 4 * 5 + 5 : job->payload_cb * 4;
+  uint8_t *response = malloc (B85_RESPONSE_HEADER + cap);
+  if (!response)
+    return false;
+
+  size_t out_cb;
+  b85_result_t rv = (encode ? B85_CACHE_ENCODE : B85_CACHE_DECODE) (
+    g_cache, job->payload, job->payload_cb, response + B85_RESPONSE_HEADER,
+    cap, &out_cb
+  );
+  if (rv)
+  {
+    free (response);
+    return false;
+  }
+
+  b85_put_u32 (B85_E_OK, response);
+  b85_put_u32 (0, response + 4);
+  b85_put_u32 ((uint32_t) out_cb, response + 8);
+  job->response = response;
+  job->response_cb = B85_RESPONSE_HEADER + out_cb;
+  return true;
+}
+
+/// Runs a single request on @a ctx, and builds the response.
+static void
+run_job (struct base85_context_t *ctx, struct job_t *job)
+{
+  if (run_cached (job))
+    return;
+
+  b85_result_t rv = B85_E_API_MISUSE;
+  B85_CONTEXT_RESET (ctx);
+  switch (job->op)
+  {
+  case B85_OP_ENCODE:
+    rv = B85_ENCODE (job->payload, job->payload_cb, ctx);
+    if (B85_E_OK == rv)
+      rv = B85_ENCODE_LAST (ctx);
+    break;
+
+  case B85_OP_DECODE:
+    rv = B85_DECODE (job->payload, job->payload_cb, ctx);
+    if (B85_E_OK == rv)
+      rv = B85_DECODE_LAST (ctx);
+    break;
+
+  case B85_OP_TRANSCODE:
+    rv = B85_TRANSCODE (job->payload, job->payload_cb, ctx);
+    if (B85_E_OK == rv)
+      rv = B85_TRANSCODE_LAST (ctx);
+    break;
+  }
+
+  size_t out_cb = 0;
+  uint8_t *out = B85_GET_OUTPUT (ctx, &out_cb);
+  if (rv)
+    out_cb = 0;
+
+  // Without a response, the connection is closed.
+  job->response = malloc (B85_RESPONSE_HEADER + out_cb);
+  if (!job->response)
+    return;
+
+  b85_put_u32 ((uint32_t) rv, job->response);
+  b85_put_u32 (
+    (uint32_t) (rv ? B85_GET_PROCESSED (ctx) : 0), job->response + 4
+  );
+  b85_put_u32 ((uint32_t) out_cb, job->response + 8);
+  memcpy (job->response + B85_RESPONSE_HEADER, out, out_cb);
+  job->response_cb = B85_RESPONSE_HEADER + out_cb;
+}
+
+/// A worker thread, and its context (initialized before the thread starts).
+struct worker_t
+{
+  struct queue_t *q;
+  struct base85_context_t ctx;
+  pthread_t thread;
+};
+
+static void *
+worker_main (void *arg)
+{
+  struct worker_t *w = arg;
+  struct queue_t *q = w->q;
+
+  for (;;)
+  {
+    // Take up to WORKER_BATCH requests, from any connections.
+    pthread_mutex_lock (&q->lock);
+    while (!q->head && !q->stop)
+      pthread_cond_wait (&q->ready, &q->lock);
+    if (q->stop)
+    {
+      pthread_mutex_unlock (&q->lock);
+      break;
+    }
+
+    struct job_t *batch = q->head;
+    struct job_t *last = batch;
+    for (size_t n = 1; n < WORKER_BATCH && last->next; ++n)
+      last = last->next;
+    q->head = last->next;
+    if (!q->head)
+      q->tail = &q->head;
+    last->next = NULL;
+    pthread_mutex_unlock (&q->lock);
+
+    for (struct job_t *job = batch; job; job = job->next)
+      run_job (&w->ctx, job);
+
+    pthread_mutex_lock (&q->done_lock);
+    last->next = q->done;
+    q->done = batch;
+    pthread_mutex_unlock (&q->done_lock);
+
+    uint64_t one = 1;
+    (void) !write (q->event_fd, &one, sizeof (one));
+  }
+
+  return NULL;
+}
+
+/// Watches @a c for @a events. With no events, @a c is removed from epoll
+/// altogether, since hangups would otherwise still be reported.
+static void
+conn_watch (int epoll_fd, struct conn_t *c, uint32_t events)
+{
+  struct epoll_event ev = { .events = events, .data.ptr = c };
+  if (!events)
+  {
+    if (c->watched)
+      (void) epoll_ctl (epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->watched = false;
+    return;
+  }
+
+  int op = c->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  c->watched = !epoll_ctl (epoll_fd, op, c->fd, &ev);
+}
+
+static void
+conn_close (int epoll_fd, struct conn_t *c)
+{
+  conn_watch (epoll_fd, c, 0);
+  (void) close (c->fd);
+  free (c->in);
+  free (c->job.response);
+  free (c);
+}
+
+/// Queues the request at the start of the input buffer of @a c, if it is
+/// complete. Returns false if the request is malformed.
+static bool
+conn_dispatch (int epoll_fd, struct conn_t *c, struct queue_t *q)
+{
+  if (c->in_cb < B85_REQUEST_HEADER)
+  {
+    conn_watch (epoll_fd, c, EPOLLIN);
+    return true;
+  }
+
+  size_t cb = b85_get_u32 (c->in + 4);
+  if (cb > B85_MAX_PAYLOAD)
+    return false;
+
+  if (c->in_cb < B85_REQUEST_HEADER + cb)
+  {
+    conn_watch (epoll_fd, c, EPOLLIN);
+    return true;
+  }
+
+  c->state = CONN_PROCESSING;
+  c->job = (struct job_t) {
+    .conn = c,
+    .op = c->in[0],
+    .payload = c->in + B85_REQUEST_HEADER,
+    .payload_cb = cb,
+  };
+  conn_watch (epoll_fd, c, 0);
+
+  pthread_mutex_lock (&q->lock);
+  *q->tail = &c->job;
+  q->tail = &c->job.next;
+  pthread_cond_signal (&q->ready);
+  pthread_mutex_unlock (&q->lock);
+  return true;
+}
+
+/// Sends as much of the response of @a c as possible. When it is complete,
+/// the request is dropped from the input buffer and the next one (if any) is
+/// dispatched. Returns false if the connection should be closed.
+static bool
+conn_send (int epoll_fd, struct conn_t *c, struct queue_t *q)
+{
+  while (c->sent < c->job.response_cb)
+  {
+    ssize_t n = send (
+      c->fd, c->job.response + c->sent, c->job.response_cb - c->sent,
+      MSG_NOSIGNAL
+    );
+    if (n < 0)
+    {
+      if (EAGAIN == errno || EWOULDBLOCK == errno)
+      {
+        c->state = CONN_WRITING;
+        conn_watch (epoll_fd, c, EPOLLOUT);
+        return true;
+      }
+      if (EINTR == errno)
+        continue;
+      return false;
+    }
+    c->sent += n;
+  }
+
+  if (!c->job.response_cb)
+    return false;
+
+  size_t used = B85_REQUEST_HEADER + c->job.payload_cb;
+  memmove (c->in, c->in + used, c->in_cb - used);
+  c->in_cb -= used;
+  free (c->job.response);
+  c->job.response = NULL;
+  c->job.response_cb = 0;
+  c->sent = 0;
+  c->state = CONN_READING;
+
+  if (c->eof && c->in_cb < B85_REQUEST_HEADER)
+    return false;
+  return conn_dispatch (epoll_fd, c, q);
+}
+
+/// Reads from @a c. Returns false if the connection should be closed.
+static bool
+conn_read (int epoll_fd, struct conn_t *c, struct queue_t *q)
+{
+  for (;;)
+  {
+    if (c->in_cap - c->in_cb < READ_CHUNK)
+    {
+      size_t cap = c->in_cap ? c->in_cap * 2 : READ_CHUNK;
+      if (cap > B85_REQUEST_HEADER + B85_MAX_PAYLOAD + READ_CHUNK)
+        cap = B85_REQUEST_HEADER + B85_MAX_PAYLOAD + READ_CHUNK;
+
+      uint8_t *in = realloc (c->in, cap);
+      if (!in)
+        return false;
+      c->in = in;
+      c->in_cap = cap;
+    }
+
+    ssize_t n = read (c->fd, c->in + c->in_cb, c->in_cap - c->in_cb);
+    if (n < 0)
+    {
+      if (EAGAIN == errno || EWOULDBLOCK == errno)
+        break;
+      if (EINTR == errno)
+        continue;
+      return false;
+    }
+    if (!n)
+    {
+      c->eof = true;
+      break;
+    }
+
+    c->in_cb += n;
+
+    // Do not buffer more than the pending request.
+    if (c->in_cb >= B85_REQUEST_HEADER)
+    {
+      size_t cb = b85_get_u32 (c->in + 4);
+      if (cb > B85_MAX_PAYLOAD)
+        return false;
+      if (c->in_cb >= B85_REQUEST_HEADER + cb)
+        break;
+    }
+  }
+
+  if (!conn_dispatch (epoll_fd, c, q))
+    return false;
+
+  // A request that can no longer be completed.
+  return !(c->eof && CONN_READING == c->state);
+}
+
+/// Sends the responses of all finished requests.
+static void
+collect_done (int epoll_fd, struct queue_t *q)
+{
+  uint64_t count;
+  (void) !read (q->event_fd, &count, sizeof (count));
+
+  pthread_mutex_lock (&q->done_lock);
+  struct job_t *done = q->done;
+  q->done = NULL;
+  pthread_mutex_unlock (&q->done_lock);
+
+  while (done)
+  {
+    struct job_t *job = done;
+    done = done->next;
+    job->next = NULL;
+    if (!conn_send (epoll_fd, job->conn, q))
+      conn_close (epoll_fd, job->conn);
+  }
+}
+
+static int
+listen_unix (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    fprintf (stderr, "* Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy (addr.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (-1 == fd)
+  {
+    perror ("* socket() error");
+    return -1;
+  }
+
+  (void) unlink (path);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr))
+    || listen (fd, SOMAXCONN))
+  {
+    perror ("* bind()/listen() error");
+    (void) close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void
+accept_all (int epoll_fd, int listen_fd)
+{
+  for (;;)
+  {
+    int fd = accept4 (listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (-1 == fd)
+      return;
+
+    struct conn_t *c = calloc (1, sizeof (*c));
+    if (c)
+    {
+      c->fd = fd;
+      conn_watch (epoll_fd, c, EPOLLIN);
+    }
+    if (!c || !c->watched)
+    {
+      free (c);
+      (void) close (fd);
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  long threads = sysconf (_SC_NPROCESSORS_ONLN);
+  unsigned long long cache_bytes = 0;
+  int i = 1;
+  for (; i + 1 < argc && '-' == argv[i][0]; i += 2)
+  {
+    char *end;
+    if (!strcmp (argv[i], "-j"))
+    {
+      threads = strtol (argv[i + 1], &end, 10);
+      if (*end || threads < 1)
+        return usage (argv[0]);
+    }
+    else if (!strcmp (argv[i], "-c"))
+    {
+      cache_bytes = strtoull (argv[i + 1], &end, 10);
+      if (*end || !cache_bytes || cache_bytes > SIZE_MAX)
+        return usage (argv[0]);
+    }
+    else
+    {
+      return usage (argv[0]);
+    }
+  }
+  if (argc != i + 1)
+    return usage (argv[0]);
+  if (threads < 1)
+    threads = 1;
+
+  if (cache_bytes && B85_CACHE_CREATE ((size_t) cache_bytes, 0, &g_cache))
+  {
+    fprintf (stderr, "* Cache setup error\n");
+    return 1;
+  }
+
+  const char *path = argv[i];
+  int listen_fd = listen_unix (path);
+  if (-1 == listen_fd)
+  {
+    B85_CACHE_DESTROY (g_cache);
+    return 1;
+  }
+
+  struct sigaction sa = { .sa_handler = on_signal };
+  sigemptyset (&sa.sa_mask);
+  (void) sigaction (SIGINT, &sa, NULL);
+  (void) sigaction (SIGTERM, &sa, NULL);
+
+  struct queue_t q = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .done_lock = PTHREAD_MUTEX_INITIALIZER,
+  };
+  q.tail = &q.head;
+  q.event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  int status = 1;
+  int epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  struct epoll_event ev_done = { .events = EPOLLIN, .data.ptr = &q };
+  struct worker_t *workers = calloc (threads, sizeof (*workers));
+  long initialized = 0;
+  long started = 0;
+  if (-1 == q.event_fd || -1 == epoll_fd || !workers
+    || epoll_ctl (epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev)
+    || epoll_ctl (epoll_fd, EPOLL_CTL_ADD, q.event_fd, &ev_done))
+  {
+    perror ("* Setup error");
+    goto exit;
+  }
+
+  // The contexts are set up here, before any thread starts, so that failures
+  // are reported.
+  for (; initialized < threads; ++initialized)
+  {
+    workers[initialized].q = &q;
+    b85_result_t rv = B85_CONTEXT_INIT (&workers[initialized].ctx);
+    if (rv)
+    {
+      fprintf (stderr, "* Error[%d]: %s.\n", rv, B85_ERROR_STRING (rv));
+      goto exit;
+    }
+  }
+
+  for (; started < threads; ++started)
+  {
+    struct worker_t *w = &workers[started];
+    if (pthread_create (&w->thread, NULL, worker_main, w))
+      break;
+  }
+  if (!started)
+  {
+    perror ("* pthread_create() error");
+    goto exit;
+  }
+
+  struct epoll_event events[64];
+  while (!g_stop)
+  {
+    int n = epoll_wait (epoll_fd, events, dimof (events), -1);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      perror ("* epoll_wait() error");
+      goto exit;
+    }
+
+    for (int k = 0; k < n; ++k)
+    {
+      void *ptr = events[k].data.ptr;
+      if (!ptr)
+      {
+        accept_all (epoll_fd, listen_fd);
+        continue;
+      }
+
+      if (&q == ptr)
+      {
+        collect_done (epoll_fd, &q);
+        continue;
+      }
+
+      // Connections that are being processed are not watched, errors are
+      // picked up once the response is sent.
+      struct conn_t *c = ptr;
+      bool ok = true;
+      if (CONN_READING == c->state)
+        ok = conn_read (epoll_fd, c, &q);
+      else if (CONN_WRITING == c->state)
+        ok = conn_send (epoll_fd, c, &q);
+      if (!ok)
+        conn_close (epoll_fd, c);
+    }
+  }
+  status = 0;
+
+exit:
+  pthread_mutex_lock (&q.lock);
+  q.stop = true;
+  pthread_cond_broadcast (&q.ready);
+  pthread_mutex_unlock (&q.lock);
+  for (long k = 0; k < started; ++k)
+    pthread_join (workers[k].thread, NULL);
+  for (long k = 0; k < initialized; ++k)
+    B85_CONTEXT_DESTROY (&workers[k].ctx);
+  free (workers);
+
+  if (-1 != epoll_fd)
+    (void) close (epoll_fd);
+  if (-1 != q.event_fd)
+    (void) close (q.event_fd);
+  (void) close (listen_fd);
+  (void) unlink (path);
+
+  if (g_cache)
+  {
+    struct b85_cache_stats_t stats;
+    B85_CACHE_STATS (g_cache, &stats);
+    fprintf (
+      stderr, "* Cache: %llu hits, %llu misses, %llu evictions, %zu entries"
+      " (%zu bytes)\n", (unsigned long long) stats.hits,
+      (unsigned long long) stats.misses, (unsigned long long) stats.evictions,
+      stats.entries, stats.bytes
+    );
+    B85_CACHE_DESTROY (g_cache);
+  }
+  return status;
+}
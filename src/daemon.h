@@ -0,0 +1,55 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (DAEMON_H__INCLUDED__)
+#define DAEMON_H__INCLUDED__
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/// Wire format of the encode/decode daemon. All integers are in network byte
+/// order. A connection carries any number of requests; responses are sent in
+/// request order.
+///
+/// Request:  op (1 byte), 3 zero bytes, uint32 payload length, payload.
+/// Response: int32 result (b85_result_t), uint32 error position (the input
+///           position on failure), uint32 payload length, payload.
+
+/// Size of the request header.
+#define B85_REQUEST_HEADER 8
+
+/// Size of the response header.
+#define B85_RESPONSE_HEADER 12
+
+/// Largest payload accepted by the daemon.
+#define B85_MAX_PAYLOAD (64u * 1024 * 1024)
+
+/// Request operations.
+typedef enum
+{
+  /// Encode binary data.
+  B85_OP_ENCODE = 'e',
+
+  /// Decode encoded data.
+  B85_OP_DECODE = 'd',
+
+  /// Transcode to the other alphabet, see B85_TRANSCODE().
+  B85_OP_TRANSCODE = 't',
+} b85_op_t;
+
+static inline void
+b85_put_u32 (uint32_t v, uint8_t *b)
+{
+  v = htonl (v);
+  memcpy (b, &v, 4);
+}
+
+static inline uint32_t
+b85_get_u32 (const uint8_t *b)
+{
+  uint32_t v;
+  memcpy (&v, b, 4);
+  return ntohl (v);
+}
+
+#endif // !defined (DAEMON_H__INCLUDED__)
@@ -0,0 +1,428 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "filter.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined (B85_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+/// Maximum number of input bytes handed to a codec per call. This bounds the
+/// size of the working buffer of a stage, no matter how much input is pushed
+/// at once.
+static const size_t B85_FILTER_CHUNK = 64 * 1024;
+
+/// Passes @a cb bytes from @a b to the stage after @a f.
+static b85_result_t
+base85_filter_forward (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  if (!cb)
+    return B85_E_OK;
+  return f->next->ops->push (f->next, b, cb);
+}
+
+/// Finishes the stage after @a f, if any.
+static b85_result_t
+base85_filter_finish_next (struct b85_filter_t *f)
+{
+  if (!f->next)
+    return B85_E_OK;
+  return f->next->ops->finish (f->next);
+}
+
+/// Encoder/decoder stage.
+struct base85_codec_filter_t
+{
+  struct b85_filter_t base;
+  struct base85_context_t ctx;
+};
+
+/// Hands the output of the codec downstream, then recycles the buffer.
+static b85_result_t
+base85_codec_flush (struct base85_codec_filter_t *s)
+{
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&s->ctx, &cb);
+  b85_result_t rv = base85_filter_forward (&s->base, out, cb);
+  B85_CLEAR_OUTPUT (&s->ctx);
+  return rv;
+}
+
+static b85_result_t
+base85_decoder_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  struct base85_codec_filter_t *s = (struct base85_codec_filter_t *) f;
+  while (cb)
+  {
+    size_t n = cb < B85_FILTER_CHUNK ? cb : B85_FILTER_CHUNK;
+    b85_result_t rv = B85_DECODE (b, n, &s->ctx);
+    if (rv)
+      return rv;
+
+    rv = base85_codec_flush (s);
+    if (rv)
+      return rv;
+
+    b += n;
+    cb -= n;
+  }
+
+  return B85_E_OK;
+}
+
+static b85_result_t
+base85_decoder_finish (struct b85_filter_t *f)
+{
+  struct base85_codec_filter_t *s = (struct base85_codec_filter_t *) f;
+  b85_result_t rv = B85_DECODE_LAST (&s->ctx);
+  if (rv)
+    return rv;
+
+  rv = base85_codec_flush (s);
+  if (rv)
+    return rv;
+
+  return base85_filter_finish_next (f);
+}
+
+static b85_result_t
+base85_encoder_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  struct base85_codec_filter_t *s = (struct base85_codec_filter_t *) f;
+  while (cb)
+  {
+    size_t n = cb < B85_FILTER_CHUNK ? cb : B85_FILTER_CHUNK;
+    b85_result_t rv = B85_ENCODE (b, n, &s->ctx);
+    if (rv)
+      return rv;
+
+    rv = base85_codec_flush (s);
+    if (rv)
+      return rv;
+
+    b += n;
+    cb -= n;
+  }
+
+  return B85_E_OK;
+}
+
+static b85_result_t
+base85_encoder_finish (struct b85_filter_t *f)
+{
+  struct base85_codec_filter_t *s = (struct base85_codec_filter_t *) f;
+
+  // The NUL terminator written by B85_ENCODE_LAST() is not part of the
+  // output, so it is not passed on.
+  b85_result_t rv = B85_ENCODE_LAST (&s->ctx);
+  if (rv)
+    return rv;
+
+  rv = base85_codec_flush (s);
+  if (rv)
+    return rv;
+
+  return base85_filter_finish_next (f);
+}
+
+static void
+base85_codec_destroy (struct b85_filter_t *f)
+{
+  struct base85_codec_filter_t *s = (struct base85_codec_filter_t *) f;
+  B85_CONTEXT_DESTROY (&s->ctx);
+  free (s);
+}
+
+static const struct b85_filter_ops_t g_decoder_ops = {
+  base85_decoder_push, base85_decoder_finish, base85_codec_destroy
+};
+
+static const struct b85_filter_ops_t g_encoder_ops = {
+  base85_encoder_push, base85_encoder_finish, base85_codec_destroy
+};
+
+static b85_result_t
+base85_codec_create (
+  const struct b85_filter_ops_t *ops, struct b85_filter_t *next,
+  struct b85_filter_t **filter
+)
+{
+  if (!next || !filter)
+    return B85_E_API_MISUSE;
+
+  struct base85_codec_filter_t *s = malloc (sizeof (*s));
+  if (!s)
+    return B85_E_BAD_ALLOC;
+
+  b85_result_t rv = B85_CONTEXT_INIT (&s->ctx);
+  if (rv)
+  {
+    free (s);
+    return rv;
+  }
+
+  s->base.ops = ops;
+  s->base.next = next;
+  *filter = &s->base;
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_FILTER_DECODER (struct b85_filter_t *next, struct b85_filter_t **filter)
+{
+  return base85_codec_create (&g_decoder_ops, next, filter);
+}
+
+b85_result_t
+B85_FILTER_ENCODER (struct b85_filter_t *next, struct b85_filter_t **filter)
+{
+  return base85_codec_create (&g_encoder_ops, next, filter);
+}
+
+/// Terminal stage.
+struct base85_sink_filter_t
+{
+  struct b85_filter_t base;
+  b85_filter_sink_fn fn;
+  void *user;
+};
+
+static b85_result_t
+base85_sink_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  struct base85_sink_filter_t *s = (struct base85_sink_filter_t *) f;
+  return s->fn (s->user, b, cb);
+}
+
+static b85_result_t
+base85_sink_finish (struct b85_filter_t *f)
+{
+  return base85_filter_finish_next (f);
+}
+
+static void
+base85_sink_destroy (struct b85_filter_t *f)
+{
+  free (f);
+}
+
+static const struct b85_filter_ops_t g_sink_ops = {
+  base85_sink_push, base85_sink_finish, base85_sink_destroy
+};
+
+b85_result_t
+B85_FILTER_SINK (
+  b85_filter_sink_fn fn, void *user, struct b85_filter_t **filter
+)
+{
+  if (!fn || !filter)
+    return B85_E_API_MISUSE;
+
+  struct base85_sink_filter_t *s = malloc (sizeof (*s));
+  if (!s)
+    return B85_E_BAD_ALLOC;
+
+  s->base.ops = &g_sink_ops;
+  s->base.next = NULL;
+  s->fn = fn;
+  s->user = user;
+  *filter = &s->base;
+  return B85_E_OK;
+}
+
+#if defined (B85_HAVE_ZLIB)
+/// Size of the output window of the zlib stages. Output is passed downstream
+/// one window at a time.
+#define B85_ZLIB_WINDOW (16 * 1024)
+
+/// Inflate/deflate stage.
+struct base85_zlib_filter_t
+{
+  struct b85_filter_t base;
+  z_stream zs;
+
+  /// Set once the end of the zlib stream has been reached.
+  bool done;
+
+  uint8_t window[B85_ZLIB_WINDOW];
+};
+
+static b85_result_t
+base85_zlib_result (int z)
+{
+  return Z_MEM_ERROR == z ? B85_E_BAD_ALLOC : B85_E_FILTER;
+}
+
+/// Runs inflate() or deflate() (@a deflating) with @a flush over the pending
+/// input, passing each filled window downstream.
+static b85_result_t
+base85_zlib_run (struct base85_zlib_filter_t *s, bool deflating, int flush)
+{
+  z_stream *zs = &s->zs;
+  do
+  {
+    zs->next_out = s->window;
+    zs->avail_out = sizeof (s->window);
+
+    int z = deflating ? deflate (zs, flush) : inflate (zs, flush);
+    if (Z_STREAM_END == z)
+      s->done = true;
+    else if (Z_BUF_ERROR == z)
+      break; // No progress possible, more input is needed.
+    else if (Z_OK != z)
+      return base85_zlib_result (z);
+
+    size_t n = sizeof (s->window) - zs->avail_out;
+    b85_result_t rv = base85_filter_forward (&s->base, s->window, n);
+    if (rv)
+      return rv;
+  } while (!s->done && (zs->avail_in || !zs->avail_out || Z_FINISH == flush));
+
+  return B85_E_OK;
+}
+
+static b85_result_t
+base85_zlib_push (
+  struct base85_zlib_filter_t *s, bool deflating,
+  const uint8_t *b, size_t cb
+)
+{
+  while (cb && !s->done)
+  {
+    size_t n = cb < B85_FILTER_CHUNK ? cb : B85_FILTER_CHUNK;
+    s->zs.next_in = (Bytef *) b;
+    s->zs.avail_in = (uInt) n;
+
+    b85_result_t rv = base85_zlib_run (s, deflating, Z_NO_FLUSH);
+    if (rv)
+      return rv;
+
+    b += n;
+    cb -= n;
+  }
+
+  return B85_E_OK;
+}
+
+static b85_result_t
+base85_inflate_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  return base85_zlib_push ((struct base85_zlib_filter_t *) f, false, b, cb);
+}
+
+static b85_result_t
+base85_inflate_finish (struct b85_filter_t *f)
+{
+  struct base85_zlib_filter_t *s = (struct base85_zlib_filter_t *) f;
+
+  // The input ended before the zlib stream did.
+  if (!s->done)
+    return B85_E_FILTER;
+
+  return base85_filter_finish_next (f);
+}
+
+static void
+base85_inflate_destroy (struct b85_filter_t *f)
+{
+  struct base85_zlib_filter_t *s = (struct base85_zlib_filter_t *) f;
+  inflateEnd (&s->zs);
+  free (s);
+}
+
+static b85_result_t
+base85_deflate_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  return base85_zlib_push ((struct base85_zlib_filter_t *) f, true, b, cb);
+}
+
+static b85_result_t
+base85_deflate_finish (struct b85_filter_t *f)
+{
+  struct base85_zlib_filter_t *s = (struct base85_zlib_filter_t *) f;
+  if (!s->done)
+  {
+    s->zs.next_in = NULL;
+    s->zs.avail_in = 0;
+
+    b85_result_t rv = base85_zlib_run (s, true, Z_FINISH);
+    if (rv)
+      return rv;
+
+    if (!s->done)
+      return B85_E_LOGIC_ERROR;
+  }
+
+  return base85_filter_finish_next (f);
+}
+
+static void
+base85_deflate_destroy (struct b85_filter_t *f)
+{
+  struct base85_zlib_filter_t *s = (struct base85_zlib_filter_t *) f;
+  deflateEnd (&s->zs);
+  free (s);
+}
+
+static const struct b85_filter_ops_t g_inflate_ops = {
+  base85_inflate_push, base85_inflate_finish, base85_inflate_destroy
+};
+
+static const struct b85_filter_ops_t g_deflate_ops = {
+  base85_deflate_push, base85_deflate_finish, base85_deflate_destroy
+};
+
+/// Allocates a zlib stage, initialized for inflate or, if @a level is not
+/// NULL, for deflate with compression level *@a level.
+static b85_result_t
+base85_zlib_create (
+  const int *level, struct b85_filter_t *next, struct b85_filter_t **filter
+)
+{
+  if (!next || !filter)
+    return B85_E_API_MISUSE;
+
+  struct base85_zlib_filter_t *s = calloc (1, sizeof (*s));
+  if (!s)
+    return B85_E_BAD_ALLOC;
+
+  int z = level ? deflateInit (&s->zs, *level) : inflateInit (&s->zs);
+  if (Z_OK != z)
+  {
+    free (s);
+    return Z_STREAM_ERROR == z ? B85_E_API_MISUSE : base85_zlib_result (z);
+  }
+
+  s->base.ops = level ? &g_deflate_ops : &g_inflate_ops;
+  s->base.next = next;
+  *filter = &s->base;
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_FILTER_INFLATE (struct b85_filter_t *next, struct b85_filter_t **filter)
+{
+  return base85_zlib_create (NULL, next, filter);
+}
+
+b85_result_t
+B85_FILTER_DEFLATE (
+  int level, struct b85_filter_t *next, struct b85_filter_t **filter
+)
+{
+  return base85_zlib_create (&level, next, filter);
+}
+#endif
+
+void
+B85_FILTER_DESTROY (struct b85_filter_t *f)
+{
+  while (f)
+  {
+    struct b85_filter_t *next = f->next;
+    f->ops->destroy (f);
+    f = next;
+  }
+}
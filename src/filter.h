@@ -0,0 +1,122 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (FILTER_H__INCLUDED__)
+#define FILTER_H__INCLUDED__
+
+#include "base85.h"
+
+#define B85_FILTER_DECODER B85_NAME (filter_decoder)
+#define B85_FILTER_ENCODER B85_NAME (filter_encoder)
+#define B85_FILTER_SINK B85_NAME (filter_sink)
+#define B85_FILTER_INFLATE B85_NAME (filter_inflate)
+#define B85_FILTER_DEFLATE B85_NAME (filter_deflate)
+#define B85_FILTER_DESTROY B85_NAME (filter_destroy)
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct b85_filter_t;
+
+/// Operations implemented by a filter stage.
+struct b85_filter_ops_t
+{
+  /// Consumes @a cb bytes from @a b. The bytes are borrowed, i.e. they are
+  /// only valid for the duration of the call. A stage passes its output to
+  /// the next stage in the same way, so no stage keeps more than its own
+  /// working buffer.
+  b85_result_t (*push) (struct b85_filter_t *f, const uint8_t *b, size_t cb);
+
+  /// Flushes any buffered output to the next stage, then finishes the next
+  /// stage.
+  b85_result_t (*finish) (struct b85_filter_t *f);
+
+  /// Frees the resources of this stage only.
+  void (*destroy) (struct b85_filter_t *f);
+};
+
+/// A stage of a filter chain. Stages are created with the next (downstream)
+/// stage already known, so a chain is built from the sink upwards, e.g.
+/// ASCII85Decode -> FlateDecode -> sink:
+///
+///   B85_FILTER_SINK (parse, parser, &sink);
+///   B85_FILTER_INFLATE (sink, &inflate);
+///   B85_FILTER_DECODER (inflate, &chain);
+///
+/// On success, a new stage takes ownership of the next stage. Input is then
+/// pushed into the first stage with b85_filter_push(), and the chain is
+/// finalized with b85_filter_finish().
+struct b85_filter_t
+{
+  const struct b85_filter_ops_t *ops;
+
+  /// Downstream stage, or NULL.
+  struct b85_filter_t *next;
+};
+
+/// Callback for B85_FILTER_SINK(). @a b is borrowed, see
+/// b85_filter_ops_t::push.
+typedef b85_result_t (*b85_filter_sink_fn) (
+  void *user, const uint8_t *b, size_t cb
+);
+
+/// Pushes @a cb bytes from @a b into the filter chain starting at @a f.
+static inline b85_result_t
+b85_filter_push (struct b85_filter_t *f, const uint8_t *b, size_t cb)
+{
+  if (!f || (cb && !b))
+    return B85_E_API_MISUSE;
+  return cb ? f->ops->push (f, b, cb) : B85_E_OK;
+}
+
+/// Finalizes the filter chain starting at @a f.
+static inline b85_result_t
+b85_filter_finish (struct b85_filter_t *f)
+{
+  if (!f)
+    return B85_E_API_MISUSE;
+  return f->ops->finish (f);
+}
+
+/// Creates a stage that decodes its input and passes the decoded bytes to
+/// @a next. The decode buffer is handed downstream and then cleared on every
+/// push, so it only ever holds the output of a single push.
+b85_result_t
+B85_FILTER_DECODER (struct b85_filter_t *next, struct b85_filter_t **filter);
+
+/// Creates a stage that encodes its input and passes the encoded characters
+/// to @a next.
+b85_result_t
+B85_FILTER_ENCODER (struct b85_filter_t *next, struct b85_filter_t **filter);
+
+/// Creates a terminal stage that passes its input to @a fn.
+b85_result_t
+B85_FILTER_SINK (
+  b85_filter_sink_fn fn, void *user, struct b85_filter_t **filter
+);
+
+#if defined (B85_HAVE_ZLIB)
+/// Creates a stage that inflates zlib (RFC 1950) data, i.e. the PDF
+/// FlateDecode filter. Input after the end of the zlib stream is ignored.
+/// Corrupt or truncated data is reported as B85_E_FILTER.
+b85_result_t
+B85_FILTER_INFLATE (struct b85_filter_t *next, struct b85_filter_t **filter);
+
+/// Creates a stage that deflates its input to zlib (RFC 1950) data, using
+/// compression level @a level (0-9, or -1 for the zlib default).
+b85_result_t
+B85_FILTER_DEFLATE (
+  int level, struct b85_filter_t *next, struct b85_filter_t **filter
+);
+#endif
+
+/// Destroys the filter chain starting at @a f, including all downstream
+/// stages.
+void
+B85_FILTER_DESTROY (struct b85_filter_t *f);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // !defined (FILTER_H__INCLUDED__)
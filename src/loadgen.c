@@ -0,0 +1,243 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+// Load generator for the encode/decode daemon. Every connection runs in its
+// own thread and sends encode requests, each followed by a decode request for
+// the result, and verifies that the round trip returns the original data.
+
+#include "daemon.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct client_t
+{
+  const char *path;
+  size_t requests;
+  size_t size;
+  unsigned seed;
+
+  /// Results.
+  size_t done;
+  size_t failed;
+  pthread_t thread;
+};
+
+static int
+usage (const char *name)
+{
+  fprintf (
+    stderr,
+    "Usage: %s [-c connections] [-n round_trips] [-s size] socket_path\n",
+    name
+  );
+  return 2;
+}
+
+static bool
+send_all (int fd, const uint8_t *b, size_t cb)
+{
+  while (cb)
+  {
+    ssize_t n = send (fd, b, cb, MSG_NOSIGNAL);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return false;
+    b += n;
+    cb -= n;
+  }
+  return true;
+}
+
+static bool
+recv_all (int fd, uint8_t *b, size_t cb)
+{
+  while (cb)
+  {
+    ssize_t n = recv (fd, b, cb, 0);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return false;
+    b += n;
+    cb -= n;
+  }
+  return true;
+}
+
+/// Sends a request, and receives the response payload into @a out (which is
+/// grown as needed). Returns the result of the request, or -1 on I/O errors.
+static int
+request (
+  int fd, uint8_t op, const uint8_t *b, size_t cb, uint8_t **out,
+  size_t *out_cb
+)
+{
+  uint8_t header[B85_RESPONSE_HEADER] = { op };
+  b85_put_u32 ((uint32_t) cb, header + 4);
+  if (!send_all (fd, header, B85_REQUEST_HEADER) || !send_all (fd, b, cb))
+    return -1;
+
+  if (!recv_all (fd, header, B85_RESPONSE_HEADER))
+    return -1;
+
+  int rv = (int32_t) b85_get_u32 (header);
+  size_t n = b85_get_u32 (header + 8);
+  uint8_t *p = realloc (*out, n ? n : 1);
+  if (!p)
+    return -1;
+  *out = p;
+  *out_cb = n;
+  return recv_all (fd, *out, n) ? rv : -1;
+}
+
+static int
+connect_unix (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return -1;
+  strcpy (addr.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (-1 != fd && connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+  {
+    (void) close (fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static void *
+client_main (void *arg)
+{
+  struct client_t *c = arg;
+  uint8_t *input = malloc (c->size ? c->size : 1);
+  uint8_t *encoded = NULL;
+  uint8_t *decoded = NULL;
+  size_t encoded_cb = 0;
+  size_t decoded_cb = 0;
+
+  int fd = connect_unix (c->path);
+  if (-1 == fd || !input)
+  {
+    perror ("* connect() error");
+    c->failed = c->requests;
+    goto exit;
+  }
+
+  for (size_t i = 0; i < c->requests; ++i)
+  {
+    // Vary the data (including runs of zeros) from request to request.
+    for (size_t k = 0; k < c->size; ++k)
+      input[k] = (k / 64) % 4 ? (uint8_t) rand_r (&c->seed) : 0;
+
+    int rv = request (
+      fd, B85_OP_ENCODE, input, c->size, &encoded, &encoded_cb
+    );
+    if (!rv)
+    {
+      rv = request (
+        fd, B85_OP_DECODE, encoded, encoded_cb, &decoded, &decoded_cb
+      );
+    }
+
+    if (rv < 0)
+    {
+      fprintf (stderr, "* Connection error\n");
+      c->failed += c->requests - i;
+      break;
+    }
+
+    if (rv || decoded_cb != c->size || memcmp (decoded, input, c->size))
+      c->failed++;
+    c->done++;
+  }
+
+exit:
+  if (-1 != fd)
+    (void) close (fd);
+  free (input);
+  free (encoded);
+  free (decoded);
+  return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t connections = 4;
+  size_t requests = 1000;
+  size_t size = 4096;
+
+  int i = 1;
+  for (; i + 1 < argc && '-' == argv[i][0]; i += 2)
+  {
+    char *end;
+    unsigned long v = strtoul (argv[i + 1], &end, 10);
+    if (*end)
+      return usage (argv[0]);
+
+    if (!strcmp (argv[i], "-c"))
+      connections = v;
+    else if (!strcmp (argv[i], "-n"))
+      requests = v;
+    else if (!strcmp (argv[i], "-s"))
+      size = v;
+    else
+      return usage (argv[0]);
+  }
+  if (argc != i + 1 || !connections || size > B85_MAX_PAYLOAD / 5 * 4)
+    return usage (argv[0]);
+
+  struct client_t *clients = calloc (connections, sizeof (*clients));
+  if (!clients)
+    return 1;
+
+  struct timespec start;
+  struct timespec end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  size_t started = 0;
+  for (; started < connections; ++started)
+  {
+    struct client_t *c = &clients[started];
+    c->path = argv[i];
+    c->requests = requests;
+    c->size = size;
+    c->seed = (unsigned) started + 1;
+    if (pthread_create (&c->thread, NULL, client_main, c))
+      break;
+  }
+
+  size_t done = 0;
+  size_t failed = 0;
+  for (size_t k = 0; k < started; ++k)
+  {
+    pthread_join (clients[k].thread, NULL);
+    done += clients[k].done;
+    failed += clients[k].failed;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec)
+    + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf (
+    "%zu connections, %zu round trips of %zu bytes, %zu failed\n"
+    "%.3fs, %.0f round trips/s, %.1f MB/s\n",
+    started, done, size, failed, elapsed, done / elapsed,
+    done * (double) size / elapsed / 1e6
+  );
+
+  free (clients);
+  return failed || started < connections;
+}
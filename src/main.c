@@ -1,14 +1,111 @@
 /* Copyright 2015 Judson Weissert; See LICENSE file. */
 
 #include "base85.h"
+#include "pool.h"
+#include "tune.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 static const size_t ENCODED_LINE_LENGTH = 80;
-static const size_t INPUT_BUFFER_MAX = 1024;
+
+/// Bytes read per B85_ENCODE()/B85_DECODE() call, unless tuned (see --tune).
+static const size_t INPUT_BUFFER_DEFAULT = 1024;
+
+/// Number of input bytes read at once, and the default number of --batch
+/// threads (0 for one per CPU), from the tuning cache.
+static size_t g_input_cb = INPUT_BUFFER_DEFAULT;
+static size_t g_threads;
+
+/// Tuned input sizes above this are ignored.
+static const size_t INPUT_BUFFER_TUNED_MAX = 16 * 1024 * 1024;
+
+/// Tuned thread counts above this are ignored.
+static const size_t THREADS_TUNED_MAX = 256;
+
+/// Decoded bytes between the checkpoints of an index written by -i.
+static const size_t INDEX_INTERVAL = 64 * 1024;
+
+/// Input bytes between the checkpoints written by --resume.
+static const size_t CHECKPOINT_INTERVAL = 64 * 1024 * 1024;
+
+/// State of a job started with --resume.
+struct resume_t
+{
+  /// Checkpoint file, or NULL if --resume is not used.
+  const char *path;
+
+  /// Operation of the job ('e', 'd' or 't').
+  char mode;
+
+  /// Input position of the next checkpoint.
+  size_t next;
+
+  /// Line position of the encoded output, see print_max_width().
+  size_t print_offset;
+
+  /// True if the job continues from a checkpoint with the context state below.
+  bool restored;
+  uint8_t state[B85_CONTEXT_STATE_SIZE];
+};
+
+static struct resume_t g_resume;
+
+/// Phases timed by --stats.
+typedef enum
+{
+  STATS_INIT,
+  STATS_READ,
+  STATS_CODEC,
+  STATS_WRITE,
+  STATS_END,
+} stats_phase_t;
+
+static const char *const STATS_PHASE_NAMES[STATS_END] = {
+  "init", "read", "codec", "write",
+};
+
+/// Counters of a job started with --stats. Only updated when enabled, as the
+/// --batch workers share the handlers below.
+struct stats_t
+{
+  /// 0 if --stats is not used, 1 for text output, 2 for JSON.
+  int format;
+
+  /// Bytes read and written.
+  size_t input_cb;
+  size_t output_cb;
+
+  /// Seconds spent in each phase.
+  double seconds[STATS_END];
+};
+
+static struct stats_t g_stats;
+
+static double
+stats_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Evaluates @a expr, adding the time it takes to @a phase if --stats is used.
+#define STATS_TIME(phase, expr) do { \
+  double t0_ = g_stats.format ? stats_now () : 0; \
+  expr; \
+  if (g_stats.format) \
+    g_stats.seconds[phase] += stats_now () - t0_; \
+} while (0)
 
 /// Wrapper for performing a write operation and returning 1 on error.
 #define TRY_WRITE(buf, cb, fh, error_val) do { \
@@ -17,12 +114,23 @@ static const size_t INPUT_BUFFER_MAX = 1024;
     perror ("* Write error"); \
     return error_val; \
   } \
+  g_stats.output_cb += g_stats.format ? cb : 0; \
 } while (0);
 
 static int
 usage (const char *name)
 {
-  fprintf (stderr, "Usage: %s -e | -d [input_file [output_file]]\n", name);
+  fprintf (
+    stderr,
+    "Usage: %s -e | -d | -t [--stats[=json]] [input_file [output_file]]\n"
+    "       %s -e | -d | -t --batch [-j threads] -o output_dir [files...]\n"
+    "       %s -e | -d | -t [--stats[=json]] --resume checkpoint_file"
+    " input_file output_file\n"
+    "       %s -i input_file index_file\n"
+    "       %s -r offset length input_file index_file [output_file]\n"
+    "       %s --tune [cache_file]\n",
+    name, name, name, name, name, name
+  );
   return 2;
 }
 
@@ -51,33 +159,133 @@ print_max_width (
   return 0;
 }
 
+/// Reads the next chunk of input.
+static size_t
+read_input (uint8_t *b, FILE *fh)
+{
+  size_t cb;
+  STATS_TIME (STATS_READ, cb = fread (b, 1, g_input_cb, fh));
+  g_stats.input_cb += g_stats.format ? cb : 0;
+  return cb;
+}
+
+/// Writes encoded output, see print_max_width().
+static int
+write_encoded (FILE *fh, const uint8_t *b, size_t cb, size_t *offset)
+{
+  int rv;
+  STATS_TIME (
+    STATS_WRITE,
+    rv = print_max_width (fh, b, cb, ENCODED_LINE_LENGTH, offset)
+  );
+  return rv;
+}
+
+/// Writes decoded output.
+static int
+write_decoded (FILE *fh, const uint8_t *b, size_t cb)
+{
+  size_t written;
+  STATS_TIME (STATS_WRITE, written = fwrite (b, 1, cb, fh));
+  if (cb != written)
+  {
+    perror ("* Write error");
+    return 1;
+  }
+  g_stats.output_cb += g_stats.format ? cb : 0;
+  return 0;
+}
+
+/// Writes the checkpoint of a --resume job: the output is flushed to disk
+/// first, then the checkpoint file is replaced atomically.
 static b85_result_t
-b85_encode (struct base85_context_t *ctx, FILE *fh_in, FILE *fh_out)
+resume_save (struct base85_context_t *ctx, FILE *fh_out, size_t print_offset)
+{
+  b85_result_t rv = B85_CONTEXT_SAVE (ctx, g_resume.state);
+  if (rv)
+    return rv;
+
+  if (fflush (fh_out) || fsync (fileno (fh_out)))
+  {
+    perror ("* Write error");
+    return B85_E_UNSPECIFIED;
+  }
+
+  size_t cb = strlen (g_resume.path) + 5;
+  char *tmp = malloc (cb);
+  if (!tmp)
+    return B85_E_BAD_ALLOC;
+  snprintf (tmp, cb, "%s.tmp", g_resume.path);
+
+  FILE *fh = fopen (tmp, "w");
+  bool failed = !fh;
+  if (fh)
+  {
+    fprintf (
+      fh, "%c %lld %zu\n", g_resume.mode, (long long) ftello (fh_out),
+      print_offset
+    );
+    for (size_t i = 0; i < B85_CONTEXT_STATE_SIZE; ++i)
+      fprintf (fh, "%02x", g_resume.state[i]);
+    fprintf (fh, "\n");
+
+    failed = fflush (fh) || fsync (fileno (fh));
+    failed |= 0 != fclose (fh);
+  }
+
+  if (failed || rename (tmp, g_resume.path))
+  {
+    perror ("* Checkpoint write error");
+    rv = B85_E_UNSPECIFIED;
+  }
+  free (tmp);
+  return rv;
+}
+
+/// Called after each chunk of output has been written. Writes a checkpoint
+/// every CHECKPOINT_INTERVAL bytes of input if --resume is used.
+static b85_result_t
+resume_tick (struct base85_context_t *ctx, FILE *fh_out, size_t print_offset)
+{
+  if (!g_resume.path || B85_GET_PROCESSED (ctx) < g_resume.next)
+    return B85_E_OK;
+
+  g_resume.next = B85_GET_PROCESSED (ctx) + CHECKPOINT_INTERVAL;
+  return resume_save (ctx, fh_out, print_offset);
+}
+
+static b85_result_t
+b85_encode (
+  struct base85_context_t *ctx, uint8_t *input, FILE *fh_in, FILE *fh_out
+)
 {
-  uint8_t input[INPUT_BUFFER_MAX];
   b85_result_t rv = B85_E_UNSPECIFIED;
 
-  size_t print_offset = 0;
+  size_t print_offset = g_resume.print_offset;
   size_t cb = 0;
   size_t input_cb;
   uint8_t *out = NULL;
-  while ((input_cb = fread (input, 1, INPUT_BUFFER_MAX, fh_in)))
+  while ((input_cb = read_input (input, fh_in)))
   {
-    rv = B85_ENCODE (input, input_cb, ctx);
+    STATS_TIME (STATS_CODEC, rv = B85_ENCODE (input, input_cb, ctx));
     if (rv)
       return rv;
 
     out = B85_GET_OUTPUT (ctx, &cb);
-    if (print_max_width (fh_out, out, cb, ENCODED_LINE_LENGTH, &print_offset))
+    if (write_encoded (fh_out, out, cb, &print_offset))
       return B85_E_UNSPECIFIED;
     B85_CLEAR_OUTPUT (ctx);
+
+    rv = resume_tick (ctx, fh_out, print_offset);
+    if (rv)
+      return rv;
   }
-  rv = B85_ENCODE_LAST (ctx);
+  STATS_TIME (STATS_CODEC, rv = B85_ENCODE_LAST (ctx));
   if (rv)
     return rv;
 
   out = B85_GET_OUTPUT (ctx, &cb);
-  if (print_max_width (fh_out, out, cb, ENCODED_LINE_LENGTH, &print_offset))
+  if (write_encoded (fh_out, out, cb, &print_offset))
     return B85_E_UNSPECIFIED;
   if (print_offset)
     TRY_WRITE ("\n", 1, fh_out, B85_E_UNSPECIFIED)
@@ -86,58 +294,831 @@ b85_encode (struct base85_context_t *ctx, FILE *fh_in, FILE *fh_out)
 }
 
 static b85_result_t
-b85_decode (struct base85_context_t *ctx, FILE *fh_in, FILE *fh_out)
+b85_decode (
+  struct base85_context_t *ctx, uint8_t *input, FILE *fh_in, FILE *fh_out
+)
 {
-  uint8_t input[INPUT_BUFFER_MAX];
   b85_result_t rv = B85_E_UNSPECIFIED;
 
+  // Input produced by the encoder below has a fixed line length, anything else
+  // is still decoded correctly.
+  rv = B85_CONTEXT_SET_LINE_LENGTH (ctx, ENCODED_LINE_LENGTH);
+  if (rv)
+    return rv;
+
   size_t input_cb;
   uint8_t *out = NULL;
-  while ((input_cb = fread (input, 1, INPUT_BUFFER_MAX, fh_in)))
+  while ((input_cb = read_input (input, fh_in)))
   {
-    rv = B85_DECODE (input, input_cb, ctx);
+    STATS_TIME (STATS_CODEC, rv = B85_DECODE (input, input_cb, ctx));
     if (rv)
       return rv;
 
     size_t out_cb;
     out = B85_GET_OUTPUT (ctx, &out_cb);
-    TRY_WRITE (out, out_cb, fh_out, B85_E_UNSPECIFIED)
+    if (write_decoded (fh_out, out, out_cb))
+      return B85_E_UNSPECIFIED;
     B85_CLEAR_OUTPUT (ctx);
+
+    rv = resume_tick (ctx, fh_out, 0);
+    if (rv)
+      return rv;
   }
-  rv = B85_DECODE_LAST (ctx);
+  STATS_TIME (STATS_CODEC, rv = B85_DECODE_LAST (ctx));
   if (rv)
     return rv;
 
   size_t out_cb;
   out = B85_GET_OUTPUT (ctx, &out_cb);
-  TRY_WRITE (out, out_cb, fh_out, B85_E_UNSPECIFIED)
+  if (write_decoded (fh_out, out, out_cb))
+    return B85_E_UNSPECIFIED;
 
   return B85_E_OK;
 }
 
-typedef b85_result_t (*handler_t) (struct base85_context_t *, FILE *, FILE *);
+static b85_result_t
+b85_transcode (
+  struct base85_context_t *ctx, uint8_t *input, FILE *fh_in, FILE *fh_out
+)
+{
+  b85_result_t rv = B85_CONTEXT_SET_LINE_LENGTH (ctx, ENCODED_LINE_LENGTH);
+  if (rv)
+    return rv;
 
+  size_t print_offset = g_resume.print_offset;
+  size_t cb = 0;
+  size_t input_cb;
+  uint8_t *out = NULL;
+  while ((input_cb = read_input (input, fh_in)))
+  {
+    STATS_TIME (STATS_CODEC, rv = B85_TRANSCODE (input, input_cb, ctx));
+    if (rv)
+      return rv;
+
+    out = B85_GET_OUTPUT (ctx, &cb);
+    if (write_encoded (fh_out, out, cb, &print_offset))
+      return B85_E_UNSPECIFIED;
+    B85_CLEAR_OUTPUT (ctx);
+
+    rv = resume_tick (ctx, fh_out, print_offset);
+    if (rv)
+      return rv;
+  }
+  STATS_TIME (STATS_CODEC, rv = B85_TRANSCODE_LAST (ctx));
+  if (rv)
+    return rv;
+
+  out = B85_GET_OUTPUT (ctx, &cb);
+  if (write_encoded (fh_out, out, cb, &print_offset))
+    return B85_E_UNSPECIFIED;
+  if (print_offset)
+    TRY_WRITE ("\n", 1, fh_out, B85_E_UNSPECIFIED)
+
+  return B85_E_OK;
+}
+
+/// Maps the file @a path into memory. An empty file is represented by NULL.
+static int
+map_file (const char *path, const uint8_t **b, size_t *cb)
+{
+  int fd = open (path, O_RDONLY);
+  if (-1 == fd)
+  {
+    perror ("* Input open() error");
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st))
+  {
+    perror ("* Input fstat() error");
+    (void) close (fd);
+    return 1;
+  }
+
+  *b = NULL;
+  *cb = st.st_size;
+  if (*cb)
+  {
+    void *p = mmap (NULL, *cb, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == p)
+    {
+      perror ("* Input mmap() error");
+      (void) close (fd);
+      return 1;
+    }
+    *b = p;
+  }
+
+  (void) close (fd);
+  return 0;
+}
+
+static void
+unmap_file (const uint8_t *b, size_t cb)
+{
+  if (b)
+    (void) munmap ((void *) b, cb);
+}
+
+static void
+print_error (b85_result_t rv, size_t position)
+{
+  fprintf (
+    stderr, "* Error[%d]: %s. [position: %zu]\n", rv,
+    B85_ERROR_STRING (rv), position
+  );
+}
+
+/// Builds an index over @a input_path, and saves it to @a index_path.
 static b85_result_t
-b85_wrapper (handler_t handler, FILE *fh_in, FILE *fh_out)
+b85_index (const char *input_path, const char *index_path)
+{
+  const uint8_t *b;
+  size_t cb;
+  if (map_file (input_path, &b, &cb))
+    return B85_E_UNSPECIFIED;
+
+  struct base85_index_t index;
+  uint8_t *sidecar = NULL;
+  b85_result_t rv = B85_INDEX_BUILD (b, cb, INDEX_INTERVAL, &index);
+  unmap_file (b, cb);
+  if (rv)
+  {
+    print_error (rv, 0);
+    return rv;
+  }
+
+  size_t sidecar_cb;
+  (void) B85_INDEX_SAVE (&index, NULL, 0, &sidecar_cb);
+  sidecar = malloc (sidecar_cb);
+  if (!sidecar)
+    rv = B85_E_BAD_ALLOC;
+  else
+    rv = B85_INDEX_SAVE (&index, sidecar, sidecar_cb, &sidecar_cb);
+  B85_INDEX_DESTROY (&index);
+  if (rv)
+  {
+    print_error (rv, 0);
+    free (sidecar);
+    return rv;
+  }
+
+  FILE *fh = fopen (index_path, "wb");
+  if (!fh)
+  {
+    perror ("* Output fopen() error");
+    free (sidecar);
+    return B85_E_UNSPECIFIED;
+  }
+
+  if (sidecar_cb != fwrite (sidecar, 1, sidecar_cb, fh))
+  {
+    perror ("* Write error");
+    rv = B85_E_UNSPECIFIED;
+  }
+  if (fclose (fh) && !rv)
+  {
+    perror ("* Write error");
+    rv = B85_E_UNSPECIFIED;
+  }
+  free (sidecar);
+  return rv;
+}
+
+/// Parses a decimal size argument.
+static int
+parse_size (const char *s, size_t *v)
+{
+  char *end;
+  errno = 0;
+  unsigned long long x = strtoull (s, &end, 10);
+  if (errno || end == s || *end || '-' == *s || x > SIZE_MAX)
+  {
+    fprintf (stderr, "* Invalid number: %s\n", s);
+    return 1;
+  }
+  *v = (size_t) x;
+  return 0;
+}
+
+/// Decodes @a length bytes at decoded offset @a offset of @a input_path,
+/// using the index in @a index_path.
+static b85_result_t
+b85_range (
+  size_t offset, size_t length, const char *input_path,
+  const char *index_path, FILE *fh_out
+)
 {
+  const uint8_t *sidecar;
+  size_t sidecar_cb;
+  if (map_file (index_path, &sidecar, &sidecar_cb))
+    return B85_E_UNSPECIFIED;
+
+  struct base85_index_t index;
+  b85_result_t rv = B85_INDEX_LOAD (sidecar, sidecar_cb, &index);
+  unmap_file (sidecar, sidecar_cb);
+  if (rv)
+  {
+    print_error (rv, 0);
+    return rv;
+  }
+
+  const uint8_t *b;
+  size_t cb;
+  if (map_file (input_path, &b, &cb))
+  {
+    B85_INDEX_DESTROY (&index);
+    return B85_E_UNSPECIFIED;
+  }
+
   struct base85_context_t ctx;
-  b85_result_t rv = B85_CONTEXT_INIT (&ctx);
+  rv = B85_CONTEXT_INIT (&ctx);
   if (B85_E_OK == rv)
-    rv = handler (&ctx, fh_in, fh_out);
-  if (B85_E_OK == rv && ferror (fh_in))
-    rv = B85_E_UNSPECIFIED;
+    rv = B85_DECODE_RANGE (b, cb, &index, offset, length, &ctx);
   if (rv)
+  {
+    print_error (rv, B85_GET_PROCESSED (&ctx));
+  }
+  else
+  {
+    size_t out_cb;
+    uint8_t *out = B85_GET_OUTPUT (&ctx, &out_cb);
+    if (out_cb != fwrite (out, 1, out_cb, fh_out))
+    {
+      perror ("* Write error");
+      rv = B85_E_UNSPECIFIED;
+    }
+  }
+
+  B85_CONTEXT_DESTROY (&ctx);
+  unmap_file (b, cb);
+  B85_INDEX_DESTROY (&index);
+  return rv;
+}
+
+/// Converts @a fh_in to @a fh_out, reading g_input_cb bytes at a time into
+/// @a input.
+typedef b85_result_t (*handler_t) (
+  struct base85_context_t *ctx, uint8_t *input, FILE *fh_in, FILE *fh_out
+);
+
+/// Prints the --stats report of a job that took @a elapsed seconds.
+static void
+stats_print (const struct base85_context_t *ctx, double elapsed)
+{
+  struct rusage usage;
+  long peak_rss = getrusage (RUSAGE_SELF, &usage) ? -1 : usage.ru_maxrss;
+  double mb_per_s = elapsed > 0 ? g_stats.input_cb / elapsed / 1e6 : 0;
+
+  if (2 == g_stats.format)
+  {
+    fprintf (
+      stderr, "{\"input_bytes\":%zu,\"output_bytes\":%zu,\"seconds\":{",
+      g_stats.input_cb, g_stats.output_cb
+    );
+    for (int i = 0; i < STATS_END; ++i)
+    {
+      fprintf (
+        stderr, "\"%s\":%.6f,", STATS_PHASE_NAMES[i], g_stats.seconds[i]
+      );
+    }
+    fprintf (
+      stderr,
+      "\"total\":%.6f},\"mb_per_s\":%.1f,\"peak_rss_kib\":%ld,"
+      "\"buffer_capacity\":%zu}\n",
+      elapsed, mb_per_s, peak_rss, ctx->out_cb
+    );
+    return;
+  }
+
+  fprintf (
+    stderr, "* Input: %zu bytes, output: %zu bytes\n", g_stats.input_cb,
+    g_stats.output_cb
+  );
+  for (int i = 0; i < STATS_END; ++i)
   {
     fprintf (
-      stderr, "* Error[%d]: %s. [position: %zu]\n", rv,
-      B85_ERROR_STRING (rv),
-      B85_GET_PROCESSED (&ctx)
+      stderr, "* %-6s %10.6fs\n", STATS_PHASE_NAMES[i], g_stats.seconds[i]
     );
   }
+  fprintf (
+    stderr,
+    "* total  %10.6fs, %.1f MB/s\n"
+    "* Peak RSS: %ld KiB, output buffer: %zu bytes\n",
+    elapsed, mb_per_s, peak_rss, ctx->out_cb
+  );
+}
+
+static b85_result_t
+b85_wrapper (handler_t handler, FILE *fh_in, FILE *fh_out)
+{
+  struct base85_context_t ctx;
+  double start = g_stats.format ? stats_now () : 0;
+  b85_result_t rv;
+  STATS_TIME (STATS_INIT, rv = B85_CONTEXT_INIT (&ctx));
+  if (B85_E_OK == rv && g_resume.restored)
+  {
+    // Continue with the input that follows the checkpoint.
+    rv = B85_CONTEXT_RESTORE (&ctx, g_resume.state);
+    if (B85_E_OK == rv
+      && fseeko (fh_in, (off_t) B85_GET_PROCESSED (&ctx), SEEK_SET))
+    {
+      perror ("* Input fseeko() error");
+      rv = B85_E_UNSPECIFIED;
+    }
+  }
+  uint8_t *input = NULL;
+  if (B85_E_OK == rv && !(input = malloc (g_input_cb)))
+    rv = B85_E_BAD_ALLOC;
+  if (B85_E_OK == rv)
+    rv = handler (&ctx, input, fh_in, fh_out);
+  if (B85_E_OK == rv && ferror (fh_in))
+    rv = B85_E_UNSPECIFIED;
+  if (rv)
+    print_error (rv, B85_GET_PROCESSED (&ctx));
+  if (g_stats.format)
+    stats_print (&ctx, stats_now () - start);
+  free (input);
   B85_CONTEXT_DESTROY (&ctx);
   return rv;
 }
 
+/// Reads the checkpoint of a --resume job, if there is one. Returns 1 if a
+/// checkpoint was loaded (with the output length in @a out_offset), 0 if there
+/// is none, and -1 if it is malformed or belongs to another operation.
+static int
+resume_load (off_t *out_offset)
+{
+  FILE *fh = fopen (g_resume.path, "r");
+  if (!fh)
+    return ENOENT == errno ? 0 : -1;
+
+  char mode;
+  long long offset;
+  int ok = 3 == fscanf (
+    fh, "%c %lld %zu", &mode, &offset, &g_resume.print_offset
+  );
+  for (size_t i = 0; ok && i < B85_CONTEXT_STATE_SIZE; ++i)
+    ok = 1 == fscanf (fh, "%2hhx", &g_resume.state[i]);
+  (void) fclose (fh);
+
+  if (!ok || mode != g_resume.mode || offset < 0
+    || g_resume.print_offset >= ENCODED_LINE_LENGTH)
+  {
+    return -1;
+  }
+
+  *out_offset = offset;
+  g_resume.restored = true;
+  return 1;
+}
+
+/// Runs @a handler on files, so that it can be continued after an
+/// interruption: "--resume checkpoint_file input_file output_file". While the
+/// job runs, a checkpoint is written every CHECKPOINT_INTERVAL input bytes.
+/// If the checkpoint file exists, the job continues from it, after truncating
+/// the output to the length it had at the checkpoint. The checkpoint file is
+/// removed once the job has completed.
+static int
+b85_resume (
+  handler_t handler, char mode, const char *path, const char *input_path,
+  const char *output_path
+)
+{
+  g_resume.path = path;
+  g_resume.mode = mode;
+  g_resume.next = CHECKPOINT_INTERVAL;
+
+  off_t out_offset = 0;
+  int loaded = resume_load (&out_offset);
+  if (loaded < 0)
+  {
+    fprintf (stderr, "* Invalid checkpoint file: %s\n", path);
+    return 1;
+  }
+
+  FILE *fh_in = fopen (input_path, "rb");
+  if (!fh_in)
+  {
+    perror ("* Input fopen() error");
+    return 1;
+  }
+
+  FILE *fh_out = fopen (output_path, loaded ? "r+b" : "wb");
+  if (!fh_out
+    || (loaded && (ftruncate (fileno (fh_out), out_offset)
+      || fseeko (fh_out, out_offset, SEEK_SET))))
+  {
+    perror ("* Output error");
+    (void) fclose (fh_in);
+    if (fh_out)
+      (void) fclose (fh_out);
+    return 1;
+  }
+
+  b85_result_t rv = b85_wrapper (handler, fh_in, fh_out);
+  (void) fclose (fh_in);
+  if (fclose (fh_out) && !rv)
+  {
+    perror ("* Write error");
+    rv = B85_E_UNSPECIFIED;
+  }
+
+  if (!rv)
+    (void) remove (path);
+  return B85_E_OK != rv;
+}
+
+/// A file converted by b85_batch().
+struct batch_file_t
+{
+  const char *path;
+  char *out_path;
+  off_t size;
+
+  /// Result, and the error position or errno of a failed fopen().
+  b85_result_t rv;
+  size_t position;
+  int error;
+};
+
+struct batch_t
+{
+  handler_t handler;
+
+  /// One context and input buffer per worker, reused for all files of the
+  /// worker.
+  struct base85_context_t *contexts;
+  uint8_t *inputs;
+};
+
+static void
+batch_run_file (void *user, size_t worker, void *task)
+{
+  struct batch_t *batch = user;
+  struct batch_file_t *f = task;
+  struct base85_context_t *ctx = &batch->contexts[worker];
+
+  FILE *fh_in = fopen (f->path, "rb");
+  FILE *fh_out = fh_in ? fopen (f->out_path, "wb") : NULL;
+  if (!fh_out)
+  {
+    f->error = errno;
+    if (fh_in)
+      (void) fclose (fh_in);
+    return;
+  }
+
+  B85_CONTEXT_RESET (ctx);
+  f->rv = batch->handler (
+    ctx, batch->inputs + worker * g_input_cb, fh_in, fh_out
+  );
+  if (B85_E_OK == f->rv && ferror (fh_in))
+    f->rv = B85_E_UNSPECIFIED;
+  f->position = B85_GET_PROCESSED (ctx);
+
+  (void) fclose (fh_in);
+  if (fclose (fh_out) && B85_E_OK == f->rv)
+    f->error = errno;
+}
+
+/// Orders files from the largest to the smallest.
+static int
+batch_compare (const void *a, const void *b)
+{
+  const struct batch_file_t *fa = *(struct batch_file_t * const *) a;
+  const struct batch_file_t *fb = *(struct batch_file_t * const *) b;
+  return (fa->size < fb->size) - (fa->size > fb->size);
+}
+
+/// Orders files by output path.
+static int
+batch_compare_output (const void *a, const void *b)
+{
+  const struct batch_file_t *fa = *(struct batch_file_t * const *) a;
+  const struct batch_file_t *fb = *(struct batch_file_t * const *) b;
+  return strcmp (fa->out_path, fb->out_path);
+}
+
+/// Reads file names from stdin, one per line.
+static char **
+batch_read_list (size_t *n)
+{
+  char **list = NULL;
+  size_t cap = 0;
+  char *line = NULL;
+  size_t line_cb = 0;
+  ssize_t len;
+
+  *n = 0;
+  while (-1 != (len = getline (&line, &line_cb, stdin)))
+  {
+    while (len && ('\n' == line[len - 1] || '\r' == line[len - 1]))
+      line[--len] = 0;
+    if (!len)
+      continue;
+
+    if (*n == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      char **p = realloc (list, cap * sizeof (*list));
+      if (!p)
+        break;
+      list = p;
+    }
+
+    list[(*n)++] = line;
+    line = NULL;
+    line_cb = 0;
+  }
+
+  free (line);
+  return list;
+}
+
+/// Converts many files with a single process: "--batch [-j threads]
+/// -o output_dir [files...]", reading the file names from stdin if none are
+/// given. Each output file has the name of its input file.
+static int
+b85_batch (handler_t handler, int argc, char *argv[], const char *name)
+{
+  long threads = g_threads ? (long) g_threads
+    : sysconf (_SC_NPROCESSORS_ONLN);
+  const char *out_dir = NULL;
+  int i = 0;
+  for (; i < argc && '-' == argv[i][0]; ++i)
+  {
+    if (!strcmp (argv[i], "-j") && i + 1 < argc)
+    {
+      char *end;
+      threads = strtol (argv[++i], &end, 10);
+      if (*end || threads < 1)
+        return usage (name);
+    }
+    else if (!strcmp (argv[i], "-o") && i + 1 < argc)
+    {
+      out_dir = argv[++i];
+    }
+    else
+    {
+      return usage (name);
+    }
+  }
+
+  if (!out_dir)
+    return usage (name);
+  if (threads < 1)
+    threads = 1;
+
+  char **list = NULL;
+  size_t n = argc - i;
+  if (!n)
+    list = batch_read_list (&n);
+
+  // No more threads than files (like b85_pool_run()), before anything is
+  // allocated per thread.
+  if ((size_t) threads > (n ? n : 1))
+    threads = n ? n : 1;
+
+  int status = 1;
+  struct batch_file_t *files = calloc (n ? n : 1, sizeof (*files));
+  struct batch_file_t **tasks = calloc (n ? n : 1, sizeof (*tasks));
+  struct batch_t batch = {
+    .handler = handler,
+    .contexts = calloc (threads, sizeof (*batch.contexts)),
+    .inputs = malloc (threads * g_input_cb),
+  };
+  long initialized = 0;
+  if (!files || !tasks || !batch.contexts || !batch.inputs)
+  {
+    perror ("* Batch setup error");
+    goto exit;
+  }
+
+  for (; initialized < threads; ++initialized)
+  {
+    b85_result_t rv = B85_CONTEXT_INIT (&batch.contexts[initialized]);
+    if (rv)
+    {
+      fprintf (stderr, "* Error[%d]: %s.\n", rv, B85_ERROR_STRING (rv));
+      goto exit;
+    }
+  }
+
+  for (size_t k = 0; k < n; ++k)
+  {
+    struct batch_file_t *f = &files[k];
+    f->path = list ? list[k] : argv[i + k];
+
+    const char *base = strrchr (f->path, '/');
+    base = base ? base + 1 : f->path;
+    f->out_path = malloc (strlen (out_dir) + strlen (base) + 2);
+    if (!f->out_path)
+    {
+      perror ("* Batch setup error");
+      goto exit;
+    }
+    sprintf (f->out_path, "%s/%s", out_dir, base);
+
+    // Files that cannot be stat()ed are reported when they are opened. An
+    // output that is its own input would be truncated before it is read.
+    struct stat st;
+    struct stat st_out;
+    f->size = 0;
+    if (!stat (f->path, &st))
+    {
+      f->size = st.st_size;
+      if (!stat (f->out_path, &st_out) && st.st_dev == st_out.st_dev
+        && st.st_ino == st_out.st_ino)
+      {
+        fprintf (stderr, "* %s: The output is the input file.\n", f->path);
+        goto exit;
+      }
+    }
+    tasks[k] = f;
+  }
+
+  // Files with the same name would race on one output file.
+  qsort (tasks, n, sizeof (*tasks), batch_compare_output);
+  for (size_t k = 1; k < n; ++k)
+  {
+    if (!strcmp (tasks[k - 1]->out_path, tasks[k]->out_path))
+    {
+      fprintf (
+        stderr, "* %s: Same output file as %s.\n", tasks[k]->path,
+        tasks[k - 1]->path
+      );
+      goto exit;
+    }
+  }
+
+  qsort (tasks, n, sizeof (*tasks), batch_compare);
+  if (b85_pool_run (threads, (void **) tasks, n, batch_run_file, &batch))
+  {
+    perror ("* Batch setup error");
+    goto exit;
+  }
+
+  // Report in input order.
+  status = 0;
+  for (size_t k = 0; k < n; ++k)
+  {
+    struct batch_file_t *f = &files[k];
+    if (f->error)
+    {
+      fprintf (stderr, "* %s: %s\n", f->path, strerror (f->error));
+      status = 1;
+    }
+    else if (f->rv)
+    {
+      fprintf (
+        stderr, "* %s: Error[%d]: %s. [position: %zu]\n", f->path, f->rv,
+        B85_ERROR_STRING (f->rv), f->position
+      );
+      status = 1;
+    }
+  }
+
+exit:
+  for (long k = 0; k < initialized; ++k)
+    B85_CONTEXT_DESTROY (&batch.contexts[k]);
+  for (size_t k = 0; files && k < n; ++k)
+    free (files[k].out_path);
+  for (size_t k = 0; list && k < n; ++k)
+    free (list[k]);
+  free (list);
+  free (files);
+  free (tasks);
+  free (batch.contexts);
+  free (batch.inputs);
+  return status;
+}
+
+/// Parameters of the thread count benchmark of --tune.
+#define TUNE_BLOCK_CB ((size_t) 256 * 1024)
+#define TUNE_BLOCKS 64
+#define TUNE_ROUNDS 3
+
+/// More threads must be faster than the winner so far by this factor.
+#define TUNE_MARGIN 0.97
+
+/// Encodes one block of the thread count benchmark.
+static void
+tune_run_block (void *user, size_t worker, void *task)
+{
+  struct base85_context_t *contexts = user;
+  struct base85_context_t *ctx = &contexts[worker];
+
+  B85_CONTEXT_RESET (ctx);
+  (void) B85_ENCODE (task, TUNE_BLOCK_CB, ctx);
+  (void) B85_ENCODE_LAST (ctx);
+}
+
+/// Times --batch style parallel encoding with 1 .. CPU count threads, and
+/// returns the fastest thread count.
+static size_t
+tune_threads (void)
+{
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t max_threads = cpus < 1 ? 1 : cpus > TUNE_BLOCKS ? TUNE_BLOCKS : cpus;
+
+  uint8_t *data = malloc (TUNE_BLOCK_CB * TUNE_BLOCKS);
+  struct base85_context_t *contexts = calloc (max_threads, sizeof (*contexts));
+  size_t initialized = 0;
+  size_t best = 0;
+  double best_time = 0;
+  if (!data || !contexts)
+    goto exit;
+
+  for (size_t i = 0; i < TUNE_BLOCK_CB * TUNE_BLOCKS; ++i)
+    data[i] = (uint8_t) (i * 2654435761u >> 13);
+  for (; initialized < max_threads; ++initialized)
+  {
+    if (B85_CONTEXT_INIT (&contexts[initialized]))
+      goto exit;
+  }
+
+  void *tasks[TUNE_BLOCKS];
+  for (size_t i = 0; i < TUNE_BLOCKS; ++i)
+    tasks[i] = data + i * TUNE_BLOCK_CB;
+
+  for (size_t threads = 1; threads <= max_threads; ++threads)
+  {
+    double t = 0;
+    for (int round = 0; round < TUNE_ROUNDS; ++round)
+    {
+      double start = stats_now ();
+      if (b85_pool_run (threads, tasks, TUNE_BLOCKS, tune_run_block, contexts))
+        goto exit;
+      double r = stats_now () - start;
+      t = !t || r < t ? r : t;
+    }
+
+    if (!best_time || t < best_time * TUNE_MARGIN)
+    {
+      best_time = t;
+      best = threads;
+    }
+  }
+
+exit:
+  for (size_t k = 0; k < initialized; ++k)
+    B85_CONTEXT_DESTROY (&contexts[k]);
+  free (contexts);
+  free (data);
+  return best;
+}
+
+/// Benchmarks this machine and stores the results in the tuning cache:
+/// "--tune [cache_file]", see B85_TUNE().
+static int
+b85_tune (const char *path)
+{
+  struct b85_tuning_t tuning = { .compact = B85_COMPACT_AUTO };
+  b85_result_t rv = B85_TUNE (&tuning);
+  if (rv)
+  {
+    fprintf (stderr, "* Error[%d]: %s.\n", rv, B85_ERROR_STRING (rv));
+    return 1;
+  }
+  tuning.threads = tune_threads ();
+
+  fprintf (
+    stderr,
+    "* CPU: %s\n"
+    "* Compaction kernel: %s\n"
+    "* Chunk size: ascii85 %zu, z85 %zu bytes\n"
+    "* Threads: %zu\n",
+    B85_TUNING_CPU (), B85_TUNING_KERNEL_NAME (tuning.compact),
+    tuning.chunk[B85_TUNE_ASCII85], tuning.chunk[B85_TUNE_Z85],
+    tuning.threads
+  );
+
+  rv = B85_TUNING_SAVE (path, &tuning);
+  if (rv)
+  {
+    perror ("* Tuning cache write error");
+    return 1;
+  }
+  return 0;
+}
+
+/// Uses the cached tuning of this CPU model, if there is one.
+static void
+load_tuning (void)
+{
+  struct b85_tuning_t tuning;
+  if (B85_TUNING_LOAD (NULL, &tuning))
+    return;
+
+  size_t cb = tuning.chunk[B85_TUNE_DEFAULT];
+  if (cb && cb <= INPUT_BUFFER_TUNED_MAX)
+    g_input_cb = cb;
+  if (tuning.threads <= THREADS_TUNED_MAX)
+    g_threads = tuning.threads;
+}
+
 static int
 open_file_handles (int argc, char *argv[], FILE **fh_in, FILE **fh_out)
 {
@@ -188,30 +1169,99 @@ close_file_handles (int argc, FILE **fh_in, FILE **fh_out)
 int
 main (int argc, char *argv[])
 {
-  if (argc < 2 || argc > 4)
-    return usage (argv[0]);
+  if (argc >= 2 && !strcmp (argv[1], "-i"))
+  {
+    if (4 != argc)
+      return usage (argv[0]);
+    return B85_E_OK != b85_index (argv[2], argv[3]);
+  }
 
-  FILE *fh_in = stdin;
-  FILE *fh_out = stdout;
+  if (argc >= 2 && !strcmp (argv[1], "-r"))
+  {
+    size_t offset;
+    size_t length;
+    if (argc < 6 || argc > 7)
+      return usage (argv[0]);
+    if (parse_size (argv[2], &offset) || parse_size (argv[3], &length))
+      return 2;
 
-  b85_result_t rv = B85_E_UNSPECIFIED;
-  if (!strcmp (argv[1], "-e"))
+    FILE *fh_out = stdout;
+    if (7 == argc)
+    {
+      fh_out = fopen (argv[6], "wb");
+      if (!fh_out)
+      {
+        perror ("* Output fopen() error");
+        return 1;
+      }
+    }
+
+    b85_result_t rv = b85_range (offset, length, argv[4], argv[5], fh_out);
+    if (fclose (fh_out) && !rv)
+    {
+      perror ("* Write error");
+      rv = B85_E_UNSPECIFIED;
+    }
+    return B85_E_OK != rv;
+  }
+
+  if (argc >= 2 && !strcmp (argv[1], "--tune"))
   {
-    if (open_file_handles (argc, argv, &fh_in, &fh_out))
-      return 1;
-    rv = b85_wrapper (b85_encode, fh_in, fh_out);
+    if (argc > 3)
+      return usage (argv[0]);
+    return b85_tune (3 == argc ? argv[2] : NULL);
   }
+
+  if (argc < 2)
+    return usage (argv[0]);
+
+  handler_t handler = NULL;
+  if (!strcmp (argv[1], "-e"))
+    handler = b85_encode;
   else if (!strcmp (argv[1], "-d"))
+    handler = b85_decode;
+  else if (!strcmp (argv[1], "-t"))
+    handler = b85_transcode;
+  else
+    return usage (argv[0]);
+
+  load_tuning ();
+
+  if (argc >= 3 && !strncmp (argv[2], "--stats", 7))
   {
-    if (open_file_handles (argc, argv, &fh_in, &fh_out))
-      return 1;
-    rv = b85_wrapper (b85_decode, fh_in, fh_out);
+    if (!strcmp (argv[2] + 7, ""))
+      g_stats.format = 1;
+    else if (!strcmp (argv[2] + 7, "=json"))
+      g_stats.format = 2;
+    else
+      return usage (argv[0]);
+
+    // Drop the option, the remaining arguments are parsed as usual.
+    memmove (argv + 2, argv + 3, (argc - 2) * sizeof (*argv));
+    --argc;
+    if (argc >= 3 && !strcmp (argv[2], "--batch"))
+      return usage (argv[0]);
   }
-  else
+
+  if (argc >= 3 && !strcmp (argv[2], "--batch"))
+    return b85_batch (handler, argc - 3, argv + 3, argv[0]);
+
+  if (argc >= 3 && !strcmp (argv[2], "--resume"))
   {
-    return usage (argv[0]);
+    if (6 != argc)
+      return usage (argv[0]);
+    return b85_resume (handler, argv[1][1], argv[3], argv[4], argv[5]);
   }
 
+  if (argc > 4)
+    return usage (argv[0]);
+
+  FILE *fh_in = stdin;
+  FILE *fh_out = stdout;
+  if (open_file_handles (argc, argv, &fh_in, &fh_out))
+    return 1;
+
+  b85_result_t rv = b85_wrapper (handler, fh_in, fh_out);
   close_file_handles (argc, &fh_in, &fh_out);
   return B85_E_OK != rv;
 }
@@ -0,0 +1,136 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/// Task queue of a single worker. Tasks are never added while the pool runs,
+/// so a queue is a fixed range [head, tail) of its task array.
+struct b85_queue_t
+{
+  pthread_mutex_t lock;
+  void **tasks;
+  size_t head;
+  size_t tail;
+};
+
+struct b85_pool_t
+{
+  struct b85_queue_t *queues;
+  size_t threads;
+  b85_pool_fn fn;
+  void *user;
+};
+
+struct b85_worker_t
+{
+  struct b85_pool_t *pool;
+  size_t index;
+  pthread_t thread;
+};
+
+/// Takes a task from the front (@a own) or the back of @a q.
+static void *
+b85_queue_take (struct b85_queue_t *q, bool own)
+{
+  void *task = NULL;
+  pthread_mutex_lock (&q->lock);
+  if (q->head < q->tail)
+    task = own ? q->tasks[q->head++] : q->tasks[--q->tail];
+  pthread_mutex_unlock (&q->lock);
+  return task;
+}
+
+/// Returns the next task for worker @a index, or NULL once all queues are
+/// empty.
+static void *
+b85_pool_next (struct b85_pool_t *pool, size_t index)
+{
+  void *task = b85_queue_take (&pool->queues[index], true);
+  for (size_t i = 1; !task && i < pool->threads; ++i)
+    task = b85_queue_take (&pool->queues[(index + i) % pool->threads], false);
+  return task;
+}
+
+static void *
+b85_worker_main (void *arg)
+{
+  struct b85_worker_t *w = arg;
+  struct b85_pool_t *pool = w->pool;
+
+  void *task;
+  while ((task = b85_pool_next (pool, w->index)))
+    pool->fn (pool->user, w->index, task);
+  return NULL;
+}
+
+int
+b85_pool_run (
+  size_t threads, void **tasks, size_t n, b85_pool_fn fn, void *user
+)
+{
+  if (!threads || !fn || (n && !tasks))
+    return 1;
+
+  if (threads > n)
+    threads = n ? n : 1;
+
+  struct b85_pool_t pool = {
+    .threads = threads,
+    .fn = fn,
+    .user = user,
+  };
+
+  // Queue i holds tasks i, i + threads, i + 2 * threads, ...
+  size_t per = (n + threads - 1) / threads;
+  void **dealt = malloc ((per ? per : 1) * threads * sizeof (*dealt));
+  pool.queues = calloc (threads, sizeof (*pool.queues));
+  struct b85_worker_t *workers = calloc (threads, sizeof (*workers));
+  if (!dealt || !pool.queues || !workers)
+  {
+    free (dealt);
+    free (pool.queues);
+    free (workers);
+    return 1;
+  }
+
+  for (size_t i = 0; i < threads; ++i)
+  {
+    struct b85_queue_t *q = &pool.queues[i];
+    pthread_mutex_init (&q->lock, NULL);
+    q->tasks = dealt + i * per;
+    for (size_t k = i; k < n; k += threads)
+      q->tasks[q->tail++] = tasks[k];
+  }
+
+  // The calling thread acts as worker 0.
+  size_t started = 1;
+  for (; started < threads; ++started)
+  {
+    workers[started].pool = &pool;
+    workers[started].index = started;
+    if (pthread_create (
+      &workers[started].thread, NULL, b85_worker_main, &workers[started]
+    ))
+    {
+      break;
+    }
+  }
+
+  // Tasks of workers that could not be started are stolen by the others.
+  workers[0].pool = &pool;
+  workers[0].index = 0;
+  (void) b85_worker_main (&workers[0]);
+
+  for (size_t i = 1; i < started; ++i)
+    pthread_join (workers[i].thread, NULL);
+
+  for (size_t i = 0; i < threads; ++i)
+    pthread_mutex_destroy (&pool.queues[i].lock);
+  free (dealt);
+  free (pool.queues);
+  free (workers);
+  return 0;
+}
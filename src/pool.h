@@ -0,0 +1,29 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (POOL_H__INCLUDED__)
+#define POOL_H__INCLUDED__
+
+#include <stddef.h>
+
+/// Task callback for b85_pool_run(). @a worker is the index of the calling
+/// worker thread (0 .. threads - 1), so that per-worker state such as a
+/// reusable context can be indexed by it.
+typedef void (*b85_pool_fn) (void *user, size_t worker, void *task);
+
+/// Runs @a fn on each of the @a n tasks in @a tasks, using @a threads worker
+/// threads, and returns once all tasks are done.
+///
+/// The tasks are dealt round-robin to per-worker queues in the given order.
+/// Every worker takes tasks from the front of its own queue, and when that is
+/// empty, steals from the back of the other queues. Ordering the tasks from
+/// the most to the least expensive therefore starts the expensive tasks first
+/// and leaves the cheap ones for balancing at the end.
+///
+/// @return 0 for success, nonzero if the pool could not be set up (in which
+/// case no task has been run).
+int
+b85_pool_run (
+  size_t threads, void **tasks, size_t n, b85_pool_fn fn, void *user
+);
+
+#endif // !defined (POOL_H__INCLUDED__)
@@ -0,0 +1,255 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "segments.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// Returns the position of the first "<~" in the @a cb_b bytes at @a b, or
+/// @a cb_b if there is none.
+static size_t
+base85_find_header (const uint8_t *b, size_t cb_b)
+{
+  size_t i = 0;
+
+#if defined (__SSE2__)
+  // Compares each byte and its successor at once, 16 positions per step.
+  const __m128i lt = _mm_set1_epi8 ('<');
+  const __m128i tilde = _mm_set1_epi8 ('~');
+  for (; i + 17 <= cb_b; i += 16)
+  {
+    __m128i x0 = _mm_loadu_si128 ((const __m128i *) (b + i));
+    __m128i x1 = _mm_loadu_si128 ((const __m128i *) (b + i + 1));
+    unsigned mask = _mm_movemask_epi8 (_mm_and_si128 (
+      _mm_cmpeq_epi8 (x0, lt), _mm_cmpeq_epi8 (x1, tilde)
+    ));
+    if (mask)
+      return i + __builtin_ctz (mask);
+  }
+#endif
+
+  for (; i + 1 < cb_b; ++i)
+  {
+    const uint8_t *p = memchr (b + i, '<', cb_b - 1 - i);
+    if (!p)
+      break;
+    i = p - b;
+    if ('~' == p[1])
+      return i;
+  }
+  return cb_b;
+}
+
+b85_result_t
+B85_SEGMENTS_SCAN (
+  const uint8_t *b, size_t cb_b, struct base85_segments_t *segments
+)
+{
+  if (!segments || (cb_b && !b))
+    return B85_E_API_MISUSE;
+
+  memset (segments, 0, sizeof (*segments));
+  size_t i = 0;
+  while (i < cb_b)
+  {
+    size_t start = i + base85_find_header (b + i, cb_b - i);
+    if (start == cb_b)
+      break;
+
+    // The segment ends at the first '~' after the header, and includes the
+    // character after it, so that the decoder reports a malformed footer.
+    size_t end = cb_b;
+    const uint8_t *footer = memchr (b + start + 2, '~', cb_b - start - 2);
+    if (footer)
+    {
+      end = footer - b + 2;
+      if (end > cb_b)
+        end = cb_b;
+    }
+
+    if (segments->count == segments->cap)
+    {
+      size_t cap = segments->cap ? segments->cap * 2 : 64;
+      struct base85_segment_t *p = realloc (
+        segments->segments, cap * sizeof (*p)
+      );
+      if (!p)
+      {
+        B85_SEGMENTS_DESTROY (segments);
+        return B85_E_BAD_ALLOC;
+      }
+      segments->segments = p;
+      segments->cap = cap;
+    }
+
+    segments->segments[segments->count++] = (struct base85_segment_t) {
+      .offset = start,
+      .cb = end - start,
+    };
+    i = end;
+  }
+
+  return B85_E_OK;
+}
+
+/// State shared by the workers of B85_SEGMENTS_DECODE().
+struct base85_segments_job_t
+{
+  const uint8_t *b;
+  struct base85_segments_t *segments;
+
+  /// One context per worker, reused for the segments of the worker that fail
+  /// to measure.
+  struct base85_context_t *contexts;
+};
+
+/// First pass: computes the decoded length of a segment, so that the arena
+/// can be laid out before anything is decoded.
+static void
+base85_segment_measure (void *user, size_t worker, void *task)
+{
+  struct base85_segments_job_t *job = user;
+  struct base85_segment_t *s = task;
+  (void) worker;
+
+  s->rv = B85_DECODED_LENGTH (job->b + s->offset, s->cb, &s->out_cb);
+  if (s->rv)
+    s->out_cb = 0;
+}
+
+/// Second pass: decodes a segment straight into its place in the arena.
+static void
+base85_segment_decode (void *user, size_t worker, void *task)
+{
+  struct base85_segments_job_t *job = user;
+  struct base85_segment_t *s = task;
+
+  // A segment that failed to measure has no place in the arena; it is decoded
+  // into the context of the worker instead, for the error position.
+  struct base85_context_t slot;
+  struct base85_context_t *ctx = &slot;
+  if (B85_E_OK == s->rv)
+  {
+    B85_CONTEXT_INIT_FIXED (
+      ctx, job->segments->arena + s->out_offset, s->out_cb
+    );
+  }
+  else
+  {
+    ctx = &job->contexts[worker];
+    B85_CONTEXT_RESET (ctx);
+  }
+
+  b85_result_t rv = B85_DECODE (job->b + s->offset, s->cb, ctx);
+  if (B85_E_OK == rv)
+    rv = B85_DECODE_LAST (ctx);
+  s->processed = B85_GET_PROCESSED (ctx);
+
+  // The slot is sized exactly, so running out of it means that the two passes
+  // disagree.
+  size_t cb;
+  B85_GET_OUTPUT (ctx, &cb);
+  if (B85_E_BUFFER_TOO_SMALL == rv && ctx == &slot)
+    s->rv = B85_E_LOGIC_ERROR;
+  else if (rv)
+    s->rv = rv;
+  else if (B85_E_OK == s->rv && cb != s->out_cb)
+    s->rv = B85_E_LOGIC_ERROR;
+
+  if (s->rv)
+    s->out_cb = 0;
+}
+
+/// Orders segments from the largest to the smallest.
+static int
+base85_segment_compare (const void *a, const void *b)
+{
+  const struct base85_segment_t *sa = *(struct base85_segment_t * const *) a;
+  const struct base85_segment_t *sb = *(struct base85_segment_t * const *) b;
+  return (sa->cb < sb->cb) - (sa->cb > sb->cb);
+}
+
+b85_result_t
+B85_SEGMENTS_DECODE (
+  const uint8_t *b, struct base85_segments_t *segments, size_t threads
+)
+{
+  if (!segments || !threads || (segments->count && !b))
+    return B85_E_API_MISUSE;
+
+  size_t n = segments->count;
+  if (threads > n)
+    threads = n ? n : 1;
+
+  free (segments->arena);
+  segments->arena = NULL;
+  segments->arena_cb = 0;
+
+  struct base85_segments_job_t job = {
+    .b = b,
+    .segments = segments,
+    .contexts = calloc (threads, sizeof (*job.contexts)),
+  };
+  void **tasks = malloc ((n ? n : 1) * sizeof (*tasks));
+  size_t initialized = 0;
+  b85_result_t rv = job.contexts && tasks ? B85_E_OK : B85_E_BAD_ALLOC;
+  for (; B85_E_OK == rv && initialized < threads; ++initialized)
+  {
+    rv = B85_CONTEXT_INIT (&job.contexts[initialized]);
+    if (rv)
+      break;
+  }
+  if (rv)
+    goto exit;
+
+  // The largest segments go first, see b85_pool_run().
+  for (size_t k = 0; k < n; ++k)
+    tasks[k] = &segments->segments[k];
+  qsort (tasks, n, sizeof (*tasks), base85_segment_compare);
+
+  if (b85_pool_run (threads, tasks, n, base85_segment_measure, &job))
+  {
+    rv = B85_E_BAD_ALLOC;
+    goto exit;
+  }
+
+  size_t arena_cb = 0;
+  for (size_t k = 0; k < n; ++k)
+  {
+    segments->segments[k].out_offset = arena_cb;
+    arena_cb += segments->segments[k].out_cb;
+  }
+  segments->arena = malloc (arena_cb ? arena_cb : 1);
+  if (!segments->arena)
+  {
+    rv = B85_E_BAD_ALLOC;
+    goto exit;
+  }
+  segments->arena_cb = arena_cb;
+
+  if (b85_pool_run (threads, tasks, n, base85_segment_decode, &job))
+    rv = B85_E_BAD_ALLOC;
+
+exit:
+  for (size_t k = 0; k < initialized; ++k)
+    B85_CONTEXT_DESTROY (&job.contexts[k]);
+  free (job.contexts);
+  free (tasks);
+  return rv;
+}
+
+void
+B85_SEGMENTS_DESTROY (struct base85_segments_t *segments)
+{
+  if (!segments)
+    return;
+
+  free (segments->segments);
+  free (segments->arena);
+  memset (segments, 0, sizeof (*segments));
+}
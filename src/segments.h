@@ -0,0 +1,93 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (SEGMENTS_H__INCLUDED__)
+#define SEGMENTS_H__INCLUDED__
+
+#include "base85.h"
+
+#define B85_SEGMENTS_SCAN B85_NAME (segments_scan)
+#define B85_SEGMENTS_DECODE B85_NAME (segments_decode)
+#define B85_SEGMENTS_DESTROY B85_NAME (segments_destroy)
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/// A <~ ~> segment of a larger buffer. @see B85_SEGMENTS_SCAN()
+struct base85_segment_t
+{
+  /// Position and length of the segment in the scanned buffer, from the '<' of
+  /// the header up to and including the footer. The segment ends early at the
+  /// first '~' that is not followed by '>', and runs to the end of the buffer
+  /// if there is no footer.
+  size_t offset;
+  size_t cb;
+
+  /// Position and length of the decoded bytes in the arena, set by
+  /// B85_SEGMENTS_DECODE(). @a out_cb is zero for a segment that failed.
+  size_t out_offset;
+  size_t out_cb;
+
+  /// Result of decoding the segment, and the number of its bytes that were
+  /// processed (the error position, relative to @a offset).
+  b85_result_t rv;
+  size_t processed;
+};
+
+/// Segments found in a buffer, and their decoded bytes.
+struct base85_segments_t
+{
+  /// Segments, in the order they appear in the buffer.
+  struct base85_segment_t *segments;
+
+  /// Number of segments.
+  size_t count;
+
+  /// Number of entries allocated for segments.
+  size_t cap;
+
+  /// Decoded bytes of all segments, back to back in segment order (a segment
+  /// that fails to decode may leave a gap).
+  uint8_t *arena;
+
+  /// Number of bytes in the arena.
+  size_t arena_cb;
+};
+
+/// Finds all <~ ~> segments in the @a cb_b bytes at @a b, e.g. the Ascii85
+/// streams embedded in a document. Everything outside the segments is
+/// skipped. On success, @a segments must be freed with B85_SEGMENTS_DESTROY().
+///
+/// The headers are searched 16 bytes at a time where SSE2 is available. Since
+/// '~' is not part of the alphabets, the first '~' after a header ends the
+/// segment.
+///
+/// @return 0 for success.
+b85_result_t
+B85_SEGMENTS_SCAN (
+  const uint8_t *b, size_t cb_b, struct base85_segments_t *segments
+);
+
+/// Decodes all segments found by B85_SEGMENTS_SCAN() in @a b (the same
+/// buffer) with the default alphabet, using up to @a threads threads (the
+/// calling thread included). The decoded bytes are stored in the arena of
+/// @a segments, and the result of each segment in its entry.
+///
+/// A segment that fails to decode does not stop the others.
+///
+/// @return 0 if the segments were decoded, regardless of their individual
+/// results, or B85_E_BAD_ALLOC.
+b85_result_t
+B85_SEGMENTS_DECODE (
+  const uint8_t *b, struct base85_segments_t *segments, size_t threads
+);
+
+/// Frees memory associated with @a segments.
+void
+B85_SEGMENTS_DESTROY (struct base85_segments_t *segments);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // !defined (SEGMENTS_H__INCLUDED__)
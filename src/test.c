@@ -1,12 +1,19 @@
 /* Copyright 2015 Judson Weissert; See LICENSE file. */
 
 #include "base85.h"
+#include "cache.h"
+#include "filter.h"
+#include "pool.h"
+#include "segments.h"
+#include "tune.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 struct bytes_t
 {
@@ -21,150 +28,1916 @@ struct b85_test_t
 };
 
 static const char zeros[32];
+static const char helloworld[] = "hello world!";
 static const char binary1[] = { 0xff, 0xd8, 0xff, 0xe0 };
 static const char binary2[] = { 0xff, 0xff, 0xff, 0xff };
 
-#define B85_TRY(func) do { rv = func; if (rv) goto error_exit; } while (0);
+#define dimof(x) (sizeof(x) / sizeof(*x))
+
+#define B85_TRY(func) do { rv = func; if (rv) goto error_exit; } while (0);
+
+static b85_result_t
+check_cb (size_t cb0, size_t cb1)
+{
+  return cb0 == cb1 ? B85_E_OK : B85_E_UNSPECIFIED;
+}
+
+static b85_result_t
+check_bytes (const void *b0, const void *b1, size_t cb)
+{
+  if (memcmp (b0, b1, cb))
+    return B85_E_UNSPECIFIED;
+  return B85_E_OK;
+}
+
+/// Fills the @a cb bytes at @a b with test data: runs of @a run mixed bytes,
+/// and every third run zeros (which encode to 'z' groups where aligned).
+static void
+fill_input (uint8_t *b, size_t cb, size_t run)
+{
+  for (size_t i = 0; i < cb; ++i)
+    b[i] = (i / run) % 3 ? (uint8_t) (i * 13 + i / 11) : 0;
+}
+
+/// Writes the @a cb bytes of @a b to @a out, followed by @a sep every @a width
+/// bytes and at the end (unchanged if @a width is zero). Returns the number of
+/// bytes written, at most wrapped_size().
+static size_t
+wrap_lines_to (
+  uint8_t *out, const uint8_t *b, size_t cb, size_t width, const char *sep
+)
+{
+  if (!width)
+  {
+    memcpy (out, b, cb);
+    return cb;
+  }
+
+  size_t sep_cb = strlen (sep);
+  size_t n = 0;
+  for (size_t i = 0; i < cb; i += width)
+  {
+    size_t line = cb - i < width ? cb - i : width;
+    memcpy (out + n, b + i, line);
+    n += line;
+    memcpy (out + n, sep, sep_cb);
+    n += sep_cb;
+  }
+  return n;
+}
+
+/// Upper bound of the output of wrap_lines_to().
+static size_t
+wrapped_size (size_t cb, size_t width, const char *sep)
+{
+  return width ? cb + (cb / width + 1) * strlen (sep) : cb;
+}
+
+/// Wraps the @a cb bytes of @a b at @a width, separating lines with @a sep.
+/// The result must be freed by the caller.
+static uint8_t *
+wrap_lines (
+  const uint8_t *b, size_t cb, size_t width, const char *sep, size_t *cb_out
+)
+{
+  uint8_t *out = malloc (wrapped_size (cb, width, sep));
+  if (!out)
+    return NULL;
+
+  *cb_out = wrap_lines_to (out, b, cb, width, sep);
+  return out;
+}
+
+/// Like wrap_lines(), with a "<~" header and a "~>" footer around the lines.
+/// The result has room for @a slack more bytes.
+static uint8_t *
+frame_wrapped (
+  const uint8_t *b, size_t cb, size_t width, const char *sep, size_t slack,
+  size_t *cb_out
+)
+{
+  uint8_t *out = malloc (wrapped_size (cb, width, sep) + 4 + slack);
+  if (!out)
+    return NULL;
+
+  memcpy (out, "<~", 2);
+  size_t n = 2 + wrap_lines_to (out + 2, b, cb, width, sep);
+  memcpy (out + n, "~>", 2);
+  *cb_out = n + 2;
+  return out;
+}
+
+static b85_result_t
+run_decode_test (const struct b85_test_t *entry)
+{
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_DECODE ((void *) entry->input_.b_, entry->input_.cb_b_, &ctx))
+  B85_TRY (B85_DECODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, entry->expected_.cb_b_))
+  B85_TRY (check_bytes (out, entry->expected_.b_, cb))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+run_encode_test (const struct b85_test_t *entry)
+{
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  uint8_t *out = NULL;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_ENCODE ((void *) entry->input_.b_, entry->input_.cb_b_, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb;
+  out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, entry->expected_.cb_b_))
+  size_t result_len = strlen ((char *) out);
+  B85_TRY (check_cb (result_len, entry->expected_.cb_b_))
+  B85_TRY (check_bytes (out, entry->expected_.b_, result_len))
+  B85_TRY (B85_DECODE (out, result_len, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  size_t cb2;
+  out = B85_GET_OUTPUT (&ctx2, &cb2);
+  B85_TRY (check_cb (cb2, entry->input_.cb_b_))
+  B85_TRY (check_bytes (entry->input_.b_, out, cb2))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+b85_test_allbytes ()
+{
+  uint8_t input[256];
+  for (size_t i = 0; i < 256; ++i)
+    input[i] = (uint8_t) i;
+
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  uint8_t *out = NULL;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_ENCODE (input, 256, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+  size_t cb;
+  out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (B85_DECODE (out, cb, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  size_t cb2;
+  out = B85_GET_OUTPUT (&ctx2, &cb2);
+
+  B85_TRY (check_cb (256, cb2))
+  B85_TRY (check_bytes (input, out, cb2))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+b85_test_more_data ()
+{
+  static const size_t INPUT_CHUNK_SIZE = 2048;
+  static const size_t N_ITERATIONS = 2000;
+
+  uint8_t input[INPUT_CHUNK_SIZE];
+  for (size_t i = 0; i < INPUT_CHUNK_SIZE; ++i)
+    input[i] = (uint8_t) i;
+
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  uint8_t *out = NULL;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+
+  size_t cb;
+  for (size_t i = 0; i < N_ITERATIONS; ++i)
+  {
+    B85_TRY (B85_ENCODE (input, INPUT_CHUNK_SIZE, &ctx))
+    out = B85_GET_OUTPUT (&ctx, &cb);
+
+    B85_TRY (B85_DECODE (out, cb, &ctx2))
+    out = B85_GET_OUTPUT (&ctx2, &cb);
+    B85_TRY (check_cb (cb, INPUT_CHUNK_SIZE))
+    B85_TRY (check_bytes (out, input, cb))
+    B85_CLEAR_OUTPUT (&ctx);
+    B85_CLEAR_OUTPUT (&ctx2);
+  }
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  // Sanity check on buffer size.
+  if (ctx.out_cb > INPUT_CHUNK_SIZE * 2 || ctx2.out_cb > INPUT_CHUNK_SIZE * 2)
+    rv = B85_E_UNSPECIFIED;
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+b85_test_iovec ()
+{
+  static const char text[] = "The quick brown fox jumps over the lazy dog";
+  static const size_t splits[] = { 0, 1, 3, 4, 9, 10, 22, 37, 43 };
+
+  // Fragments deliberately straddle the 4 byte (encode) and 5 character
+  // (decode) group boundaries.
+  struct iovec iov[dimof (splits) - 1];
+  for (size_t i = 0; i + 1 < dimof (splits); ++i)
+  {
+    iov[i].iov_base = (void *) (text + splits[i]);
+    iov[i].iov_len = splits[i + 1] - splits[i];
+  }
+
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  struct base85_context_t ctx3 = { .out = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_CONTEXT_INIT (&ctx3))
+  B85_TRY (B85_ENCODEV (iov, dimof (iov), &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+  B85_TRY (B85_ENCODE ((void *) text, sizeof (text) - 1, &ctx2))
+  B85_TRY (B85_ENCODE_LAST (&ctx2))
+
+  size_t cb, cb2;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  uint8_t *out2 = B85_GET_OUTPUT (&ctx2, &cb2);
+  B85_TRY (check_cb (cb, cb2))
+  B85_TRY (check_bytes (out, out2, cb))
+
+  // Decode the encoded form using the same split points, the last fragment
+  // takes the remainder.
+  for (size_t i = 0; i + 1 < dimof (splits); ++i)
+  {
+    iov[i].iov_base = out + splits[i];
+    iov[i].iov_len = splits[i + 1] - splits[i];
+  }
+  iov[dimof (iov) - 1].iov_len = cb - splits[dimof (splits) - 2];
+  B85_TRY (B85_DECODEV (iov, dimof (iov), &ctx3))
+  B85_TRY (B85_DECODE_LAST (&ctx3))
+
+  out = B85_GET_OUTPUT (&ctx3, &cb);
+  B85_TRY (check_cb (cb, sizeof (text) - 1))
+  B85_TRY (check_bytes (out, text, cb))
+
+  // Lengths that add up past SIZE_MAX.
+  struct iovec huge[] = {
+    { (void *) text, SIZE_MAX / 2 + 1 }, { (void *) text, SIZE_MAX / 2 + 1 },
+  };
+  B85_TRY (check_cb (
+    B85_ENCODEV (huge, dimof (huge), &ctx), B85_E_API_MISUSE
+  ))
+  B85_TRY (check_cb (
+    B85_DECODEV (huge, dimof (huge), &ctx3), B85_E_API_MISUSE
+  ))
+
+  if (B85_E_API_MISUSE != B85_ENCODEV (NULL, 1, &ctx))
+    rv = B85_E_UNSPECIFIED;
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  B85_CONTEXT_DESTROY (&ctx3);
+  return rv;
+}
+
+static b85_result_t
+check_validate (const char *b, b85_result_t expected, size_t expected_pos)
+{
+  size_t pos = 0;
+  b85_result_t rv = B85_VALIDATE ((const uint8_t *) b, strlen (b), &pos);
+  if (rv != expected || pos != expected_pos)
+    return B85_E_UNSPECIFIED;
+  return B85_E_OK;
+}
+
+static b85_result_t
+b85_test_validate ()
+{
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_validate ("", B85_E_OK, 0))
+  B85_TRY (check_validate ("BOu!rD]j7BEbo80", B85_E_OK, 15))
+  B85_TRY (check_validate (" <~BOu!r\nDZ~> xyz", B85_E_OK, 13))
+  B85_TRY (check_validate ("zz!!", B85_E_OK, 4))
+  B85_TRY (check_validate ("BOu!rD]j7BEbo80x", B85_E_INVALID_CHAR, 16))
+  B85_TRY (check_validate ("BOu!rs8W-\"", B85_E_OVERFLOW, 10))
+  B85_TRY (check_validate ("BOzu!r", B85_E_INVALID_CHAR, 3))
+  B85_TRY (check_validate ("<~BOu!r", B85_E_BAD_FOOTER, 7))
+  B85_TRY (check_validate ("<~BOu!r~ >", B85_E_BAD_FOOTER, 9))
+
+  // A run of 'z' groups that decodes to more than the internal scratch
+  // buffer holds.
+  char zeros[5001];
+  memset (zeros, 'z', 5000);
+  zeros[5000] = '\0';
+  B85_TRY (check_validate (zeros, B85_E_OK, 5000))
+
+  // Larger than the internal scratch buffer.
+  uint8_t input[8192];
+  for (size_t i = 0; i < sizeof (input); ++i)
+    input[i] = (uint8_t) (i * 7);
+
+  struct base85_context_t ctx;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_ENCODE (input, sizeof (input), &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+  size_t cb;
+  char *out = (char *) B85_GET_OUTPUT (&ctx, &cb);
+  rv = check_validate (out, B85_E_OK, cb);
+  B85_CONTEXT_DESTROY (&ctx);
+
+error_exit:
+  return rv;
+}
+
+static b85_result_t
+check_decoded_length (const char *b, size_t expected)
+{
+  size_t length = 0;
+  b85_result_t rv = B85_DECODED_LENGTH (
+    (const uint8_t *) b, strlen (b), &length
+  );
+  if (rv)
+    return rv;
+  return check_cb (length, expected);
+}
+
+static b85_result_t
+b85_test_decoded_length ()
+{
+  static const size_t INPUT_SIZE = 8192;
+  uint8_t input[INPUT_SIZE];
+  uint8_t fixed[INPUT_SIZE];
+  struct base85_context_t ctx = { .out = NULL };
+  struct base85_context_t ctx2 = { .out = NULL };
+  uint8_t *wrapped = NULL;
+
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_decoded_length ("", 0))
+  B85_TRY (check_decoded_length ("<~~>", 0))
+  B85_TRY (check_decoded_length ("BOu!rD]j7BEbo80", 12))
+  B85_TRY (check_decoded_length (" <~BOu!r\nDZ~> xyz", 5))
+  B85_TRY (check_decoded_length ("<dSb1", 4))
+  B85_TRY (check_decoded_length ("zz!!", 9))
+  B85_TRY (check_decoded_length ("z B\r\nE", 5))
+
+  if (B85_E_BAD_FOOTER != check_decoded_length ("<~BE", 1))
+    return B85_E_UNSPECIFIED;
+  if (B85_E_INVALID_CHAR != check_decoded_length ("BzE", 1))
+    return B85_E_UNSPECIFIED;
+
+  // Line wrapped input with 'z' groups, decoded into an exactly sized buffer.
+  fill_input (input, INPUT_SIZE, 64);
+
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_ENCODE (input, INPUT_SIZE, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  size_t wrapped_cb;
+  wrapped = frame_wrapped (out, cb, 76, "\r\n", 0, &wrapped_cb);
+  if (!wrapped)
+    B85_TRY (B85_E_BAD_ALLOC)
+
+  size_t length = 0;
+  B85_TRY (B85_DECODED_LENGTH (wrapped, wrapped_cb, &length))
+  B85_TRY (check_cb (length, INPUT_SIZE))
+  B85_TRY (B85_CONTEXT_RESERVE (&ctx2, length))
+
+  uint8_t *reserved = ctx2.out;
+  size_t reserved_cb = ctx2.out_cb;
+  B85_TRY (B85_DECODE (wrapped, wrapped_cb, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  // The output buffer must not have been reallocated.
+  if (reserved != ctx2.out || reserved_cb != ctx2.out_cb)
+    B85_TRY (B85_E_UNSPECIFIED)
+
+  out = B85_GET_OUTPUT (&ctx2, &cb);
+  B85_TRY (check_cb (cb, INPUT_SIZE))
+  B85_TRY (check_bytes (out, input, cb))
+
+  // The same into a buffer of the caller, which is not freed on destroy.
+  B85_CONTEXT_DESTROY (&ctx2);
+  B85_TRY (B85_CONTEXT_INIT_FIXED (&ctx2, fixed, length))
+  B85_TRY (B85_DECODE (wrapped, wrapped_cb, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+  out = B85_GET_OUTPUT (&ctx2, &cb);
+  B85_TRY (check_cb (out == fixed, 1))
+  B85_TRY (check_cb (cb, INPUT_SIZE))
+  B85_TRY (check_bytes (out, input, cb))
+  B85_TRY (check_cb (B85_CONTEXT_RESERVE (&ctx2, 1), B85_E_BUFFER_TOO_SMALL))
+
+  // One byte short.
+  B85_CONTEXT_DESTROY (&ctx2);
+  B85_TRY (B85_CONTEXT_INIT_FIXED (&ctx2, fixed, length - 1))
+  rv = B85_DECODE (wrapped, wrapped_cb, &ctx2);
+  if (B85_E_OK == rv)
+    rv = B85_DECODE_LAST (&ctx2);
+  B85_TRY (check_cb (rv, B85_E_BUFFER_TOO_SMALL))
+  rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_cb (
+    B85_CONTEXT_INIT_FIXED (&ctx2, NULL, 1), B85_E_API_MISUSE
+  ))
+
+error_exit:
+  free (wrapped);
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+check_decode_inplace (
+  const char *b, b85_result_t expected, const char *decoded, size_t decoded_cb
+)
+{
+  char buffer[64];
+  size_t cb = strlen (b);
+  memcpy (buffer, b, cb);
+
+  size_t cb_out = 0;
+  b85_result_t rv = B85_DECODE_INPLACE ((uint8_t *) buffer, cb, &cb_out);
+  if (rv != expected)
+    return B85_E_UNSPECIFIED;
+  if (rv)
+    return B85_E_OK;
+  if (check_cb (cb_out, decoded_cb))
+    return B85_E_UNSPECIFIED;
+  return check_bytes (buffer, decoded, cb_out);
+}
+
+/// Uses the library the way a process that has not initialized it yet does,
+/// see run_tests(): a cache miss and hit, then an in place conversion.
+static b85_result_t
+b85_test_first_use ()
+{
+  static const char encoded[] = "BOu!rD]j7BEbo80";
+  struct b85_cache_t *cache = NULL;
+  uint8_t b[32];
+  size_t cb;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CACHE_CREATE (4096, 1, &cache))
+  for (int round = 0; round < 2; ++round)
+  {
+    memset (b, 0xff, sizeof (b));
+    B85_TRY (B85_CACHE_ENCODE (
+      cache, (const uint8_t *) helloworld, 12, b, sizeof (b), &cb
+    ))
+    B85_TRY (check_cb (cb, 15))
+    B85_TRY (check_bytes (b, encoded, cb))
+  }
+
+  memcpy (b, helloworld, 12);
+  B85_TRY (B85_ENCODE_INPLACE (b, 12, sizeof (b), &cb))
+  B85_TRY (check_cb (cb, 15))
+  B85_TRY (check_bytes (b, encoded, cb))
+
+error_exit:
+  B85_CACHE_DESTROY (cache);
+  return rv;
+}
+
+static b85_result_t
+b85_test_inplace ()
+{
+  static const char hello_z[] = "hello world!\0\0\0";
+  static const size_t INPUT_SIZE = 4099;
+  uint8_t input[INPUT_SIZE];
+  uint8_t buffer[INPUT_SIZE + INPUT_SIZE / 4 + 1];
+  struct base85_context_t ctx = { .out = NULL };
+
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_decode_inplace ("BOu!rD]j7BEbo80", B85_E_OK, helloworld, 12))
+  B85_TRY (check_decode_inplace (" <~BOu!r\nDZ~> xyz", B85_E_OK, "hello", 5))
+  B85_TRY (check_decode_inplace ("BOu!rD]j7BEbo80z", B85_E_OK, hello_z, 16))
+  B85_TRY (check_decode_inplace ("<~BOu!rD]j", B85_E_BAD_FOOTER, "", 0))
+
+  // A leading 'z' would overwrite the input before it is read.
+  static const char zz[] = "zz!!";
+  char z_buffer[sizeof (zz)];
+  memcpy (z_buffer, zz, sizeof (zz));
+  size_t cb_out = 0;
+  if (B85_E_BUFFER_TOO_SMALL
+    != B85_DECODE_INPLACE ((uint8_t *) z_buffer, 4, &cb_out))
+  {
+    return B85_E_UNSPECIFIED;
+  }
+  B85_TRY (check_bytes (z_buffer, zz, sizeof (zz)))
+
+  // Round trip, compared against the regular encoder.
+  fill_input (input, INPUT_SIZE, 16);
+
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  for (size_t cb = 0; cb <= INPUT_SIZE; cb += 1 + cb / 2)
+  {
+    B85_CONTEXT_RESET (&ctx);
+    B85_TRY (B85_ENCODE (input, cb, &ctx))
+    B85_TRY (B85_ENCODE_LAST (&ctx))
+    size_t expected_cb;
+    uint8_t *expected = B85_GET_OUTPUT (&ctx, &expected_cb);
+
+    size_t cap = cb / 4 * 5 + (cb % 4 ? cb % 4 + 1 : 0);
+    if (cap && B85_E_BUFFER_TOO_SMALL
+      != B85_ENCODE_INPLACE (buffer, cb, cap - 1, &cb_out))
+    {
+      rv = B85_E_UNSPECIFIED;
+      goto error_exit;
+    }
+
+    memcpy (buffer, input, cb);
+    B85_TRY (B85_ENCODE_INPLACE (buffer, cb, cap, &cb_out))
+    B85_TRY (check_cb (cb_out, expected_cb))
+    B85_TRY (check_bytes (buffer, expected, cb_out))
+  }
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+b85_test_zero_runs ()
+{
+  static const size_t LEADING = 4096;
+  static const size_t TRAILING = 100;
+
+  uint8_t input[LEADING + 4 + TRAILING];
+  char expected[LEADING / 4 + 5 + TRAILING / 4];
+  memset (input, 0, sizeof (input));
+  memcpy (input + LEADING, binary2, 4);
+  memset (expected, 'z', sizeof (expected));
+  memcpy (expected + LEADING / 4, "s8W-!", 5);
+
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_ENCODE (input, sizeof (input), &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, sizeof (expected)))
+  B85_TRY (check_bytes (out, expected, cb))
+
+  // Split the runs of 'z' across calls.
+  B85_TRY (B85_DECODE (out, 7, &ctx2))
+  B85_TRY (B85_DECODE (out + 7, cb - 7, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  out = B85_GET_OUTPUT (&ctx2, &cb);
+  B85_TRY (check_cb (cb, sizeof (input)))
+  B85_TRY (check_bytes (out, input, cb))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+b85_test_ws_error ()
+{
+  // Line wrapped input, long enough to span several compaction blocks, with
+  // an invalid character deep inside.
+  static const size_t ENCODED_SIZE = 4000;
+  static const size_t BAD_OFFSET = 3001;
+  uint8_t encoded[ENCODED_SIZE];
+  for (size_t i = 0; i < ENCODED_SIZE; ++i)
+    encoded[i] = 72 == i % 74 ? '\r' : 73 == i % 74 ? '\n' : '0' + i % 40;
+  encoded[BAD_OFFSET] = 'x';
+
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_CONTEXT_INIT (&ctx);
+  if (rv)
+    return rv;
+
+  rv = B85_DECODE (encoded, ENCODED_SIZE, &ctx);
+  if (B85_E_INVALID_CHAR == rv)
+    rv = check_cb (B85_GET_PROCESSED (&ctx), BAD_OFFSET + 1);
+  else
+    rv = B85_E_UNSPECIFIED;
+
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+/// Decodes @a cb bytes from @a b, and checks the error, the error position and
+/// the length of the output decoded before the error.
+static b85_result_t
+check_decode_error (
+  const uint8_t *b, size_t cb, b85_result_t expected, size_t processed,
+  size_t out_cb
+)
+{
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_CONTEXT_INIT (&ctx);
+  if (rv)
+    return rv;
+
+  size_t cb_out;
+  rv = B85_DECODE (b, cb, &ctx);
+  B85_GET_OUTPUT (&ctx, &cb_out);
+  if (expected != rv || B85_GET_PROCESSED (&ctx) != processed
+    || cb_out != out_cb)
+  {
+    rv = B85_E_UNSPECIFIED;
+  }
+  else
+  {
+    rv = B85_E_OK;
+  }
+
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+b85_test_bulk_errors ()
+{
+  // Errors anywhere within (and at the edges of) the batches of the bulk
+  // kernel are located exactly.
+  static const size_t ENCODED_SIZE = 5000;
+  static const size_t offsets[] = { 0, 1, 4, 79, 80, 81, 2503, 4995, 4999 };
+  uint8_t encoded[ENCODED_SIZE];
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  for (size_t k = 0; k < dimof (offsets); ++k)
+  {
+    size_t offset = offsets[k];
+    for (size_t i = 0; i < ENCODED_SIZE; ++i)
+      encoded[i] = '0' + i % 40;
+
+    encoded[offset] = 'x';
+    B85_TRY (check_decode_error (
+      encoded, ENCODED_SIZE, B85_E_INVALID_CHAR, offset + 1, offset / 5 * 4
+    ))
+
+    size_t group = offset / 5 * 5;
+    memcpy (encoded + group, "s8W-\"", 5);
+    B85_TRY (check_decode_error (
+      encoded, ENCODED_SIZE, B85_E_OVERFLOW, group + 5, group / 5 * 4
+    ))
+  }
+
+error_exit:
+  return rv;
+}
+
+static b85_result_t
+check_line_hint (
+  const uint8_t *encoded, size_t cb, size_t hint, size_t chunk,
+  const uint8_t *expected, size_t expected_cb
+)
+{
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_SET_LINE_LENGTH (&ctx, hint))
+  for (size_t i = 0; i < cb; i += chunk)
+    B85_TRY (B85_DECODE (encoded + i, cb - i < chunk ? cb - i : chunk, &ctx))
+  B85_TRY (B85_DECODE_LAST (&ctx))
+
+  size_t out_cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &out_cb);
+  B85_TRY (check_cb (out_cb, expected_cb))
+  B85_TRY (check_bytes (out, expected, out_cb))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+b85_test_line_hint ()
+{
+  static const size_t INPUT_SIZE = 6001;
+  uint8_t input[INPUT_SIZE];
+  for (size_t i = 0; i < INPUT_SIZE; ++i)
+    input[i] = (uint8_t) (i * 31 + i / 7);
+
+  struct base85_context_t ctx;
+  uint8_t *lf = NULL;
+  uint8_t *crlf = NULL;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_ENCODE (input, INPUT_SIZE, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb, lf_cb, crlf_cb;
+  uint8_t *encoded = B85_GET_OUTPUT (&ctx, &cb);
+  lf = wrap_lines (encoded, cb, 80, "\n", &lf_cb);
+  crlf = wrap_lines (encoded, cb, 76, "\r\n", &crlf_cb);
+  if (!lf || !crlf)
+    goto error_exit;
+
+  // Matching hints, whole input and in chunks that split lines.
+  B85_TRY (check_line_hint (lf, lf_cb, 80, lf_cb, input, INPUT_SIZE))
+  B85_TRY (check_line_hint (lf, lf_cb, 80, 1000, input, INPUT_SIZE))
+  B85_TRY (check_line_hint (crlf, crlf_cb, 76, crlf_cb, input, INPUT_SIZE))
+  B85_TRY (check_line_hint (crlf, crlf_cb, 76, 333, input, INPUT_SIZE))
+
+  // Wrong hints fall back to the general path.
+  B85_TRY (check_line_hint (lf, lf_cb, 76, 1000, input, INPUT_SIZE))
+  B85_TRY (check_line_hint (crlf, crlf_cb, 80, crlf_cb, input, INPUT_SIZE))
+
+  // Errors inside a predicted line are reported at the exact position.
+  static const size_t BAD_OFFSET = 81 * 20 + 17;
+  lf[BAD_OFFSET] = 'x';
+  B85_CONTEXT_RESET (&ctx);
+  B85_TRY (B85_CONTEXT_SET_LINE_LENGTH (&ctx, 80))
+  if (B85_E_INVALID_CHAR != B85_DECODE (lf, lf_cb, &ctx))
+    rv = B85_E_UNSPECIFIED;
+  else
+    rv = check_cb (B85_GET_PROCESSED (&ctx), BAD_OFFSET + 1);
+
+error_exit:
+  free (lf);
+  free (crlf);
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+b85_test_transcode ()
+{
+  static const char ascii85[] = "<~BOu!rD]j7\nBEbo80z@:B~>";
+  static const char z85[] = "xK#0@zY<mxA+]nf00000vpx";
+
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+
+  // Split in the middle of a group and in the middle of the footer.
+  B85_TRY (B85_TRANSCODE ((const uint8_t *) ascii85, 9, &ctx))
+  B85_TRY (B85_TRANSCODE ((const uint8_t *) ascii85 + 9, 14, &ctx))
+  B85_TRY (
+    B85_TRANSCODE ((const uint8_t *) ascii85 + 23, sizeof (ascii85) - 24, &ctx)
+  )
+  B85_TRY (B85_TRANSCODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, sizeof (z85) - 1))
+  B85_TRY (check_bytes (out, z85, cb))
+  B85_TRY (check_cb (strlen ((char *) out), cb))
+
+  B85_CONTEXT_RESET (&ctx);
+  if (B85_E_OVERFLOW != B85_TRANSCODE ((const uint8_t *) "s8W-\"", 5, &ctx))
+    rv = B85_E_UNSPECIFIED;
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+/// Bitwise CRC-32C reference implementation.
+static uint32_t
+crc32c_reference (const uint8_t *b, size_t cb)
+{
+  uint32_t crc = 0xffffffff;
+  while (cb--)
+  {
+    crc ^= *b++;
+    for (int i = 0; i < 8; ++i)
+      crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+  }
+  return ~crc;
+}
+
+static b85_result_t
+b85_test_checksum ()
+{
+  static const size_t INPUT_SIZE = 20003;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 100);
+
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_CONTEXT_SET_CHECKSUM (&ctx, 1))
+  B85_TRY (B85_CONTEXT_SET_CHECKSUM (&ctx2, 1))
+
+  // Standard check value.
+  B85_TRY (B85_ENCODE ((const uint8_t *) "123456789", 9, &ctx))
+  B85_TRY (check_cb (B85_GET_CHECKSUM (&ctx), 0xe3069283))
+
+  // Uneven chunks on both sides.
+  B85_CONTEXT_RESET (&ctx);
+  for (size_t i = 0; i < INPUT_SIZE; i += 999)
+  {
+    size_t cb = INPUT_SIZE - i < 999 ? INPUT_SIZE - i : 999;
+    B85_TRY (B85_ENCODE (input + i, cb, &ctx))
+  }
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  for (size_t i = 0; i < cb; i += 5001)
+    B85_TRY (B85_DECODE (out + i, cb - i < 5001 ? cb - i : 5001, &ctx2))
+  B85_TRY (B85_DECODE_LAST (&ctx2))
+
+  uint32_t expected = crc32c_reference (input, INPUT_SIZE);
+  B85_TRY (check_cb (B85_GET_CHECKSUM (&ctx), expected))
+  B85_TRY (check_cb (B85_GET_CHECKSUM (&ctx2), expected))
+
+  // On failure, the checksum covers the output up to the error.
+  B85_CONTEXT_RESET (&ctx2);
+  B85_TRY (check_cb (
+    B85_DECODE ((const uint8_t *) "BOu!rD]j7BEbo80x", 16, &ctx2),
+    B85_E_INVALID_CHAR
+  ))
+  out = B85_GET_OUTPUT (&ctx2, &cb);
+  B85_TRY (check_cb (B85_GET_CHECKSUM (&ctx2), crc32c_reference (out, cb)))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+check_ranges (
+  const uint8_t *encoded, size_t cb, const struct base85_index_t *index,
+  const uint8_t *expected, size_t expected_cb
+)
+{
+  static const size_t offsets[] = { 0, 1, 3, 4, 255, 256, 257, 1000, 4099 };
+  static const size_t lengths[] = { 0, 1, 5, 300, 100000 };
+
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  for (size_t i = 0; i <= dimof (offsets); ++i)
+  {
+    // The last offsets are relative to the end.
+    size_t offset = i < dimof (offsets) ? offsets[i] : expected_cb;
+    for (size_t j = 0; j < 2; ++j, offset = expected_cb - offset)
+    {
+      for (size_t k = 0; k < dimof (lengths); ++k)
+      {
+        size_t length = lengths[k];
+        if (length > expected_cb - offset)
+          length = expected_cb - offset;
+
+        B85_TRY (B85_DECODE_RANGE (
+          encoded, cb, index, offset, lengths[k], &ctx
+        ))
+        size_t out_cb;
+        uint8_t *out = B85_GET_OUTPUT (&ctx, &out_cb);
+        B85_TRY (check_cb (out_cb, length))
+        B85_TRY (check_bytes (out, expected + offset, length))
+      }
+    }
+  }
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+static b85_result_t
+b85_test_index ()
+{
+  static const size_t INPUT_SIZE = 10007;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 50);
+
+  struct base85_context_t ctx;
+  struct base85_index_t index = { .offsets = NULL };
+  struct base85_index_t loaded = { .offsets = NULL };
+  uint8_t *framed = NULL;
+  uint8_t *sidecar = NULL;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_ENCODE (input, INPUT_SIZE, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  // Wrapped lines and a header/footer, so that checkpoints have to account
+  // for whitespace, framing and 'z' groups.
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  size_t framed_cb;
+  framed = frame_wrapped (out, cb, 75, "\r\n", 0, &framed_cb);
+  if (!framed)
+    B85_TRY (B85_E_BAD_ALLOC)
+
+  B85_TRY (check_cb (
+    B85_INDEX_BUILD (framed, framed_cb, 6, &index), B85_E_API_MISUSE
+  ))
+  B85_TRY (B85_INDEX_BUILD (framed, framed_cb, 256, &index))
+  B85_TRY (check_cb (index.decoded_length, INPUT_SIZE))
+  B85_TRY (check_cb (index.count, INPUT_SIZE / 256))
+  B85_TRY (check_ranges (framed, framed_cb, &index, input, INPUT_SIZE))
+
+  // Sidecar round trip.
+  size_t sidecar_cb;
+  B85_TRY (check_cb (
+    B85_INDEX_SAVE (&index, NULL, 0, &sidecar_cb), B85_E_BUFFER_TOO_SMALL
+  ))
+  sidecar = malloc (sidecar_cb);
+  if (!sidecar)
+    B85_TRY (B85_E_BAD_ALLOC)
+  B85_TRY (B85_INDEX_SAVE (&index, sidecar, sidecar_cb, &sidecar_cb))
+  B85_TRY (check_cb (
+    B85_INDEX_LOAD (sidecar, sidecar_cb - 1, &loaded), B85_E_BAD_INDEX
+  ))
+  B85_TRY (B85_INDEX_LOAD (sidecar, sidecar_cb, &loaded))
+  B85_TRY (check_cb (loaded.count, index.count))
+  B85_TRY (check_bytes (
+    loaded.offsets, index.offsets, index.count * sizeof (*index.offsets)
+  ))
+  B85_TRY (check_ranges (framed, framed_cb, &loaded, input, INPUT_SIZE))
+
+  // The index does not match the input.
+  B85_TRY (check_cb (
+    B85_DECODE_RANGE (framed, framed_cb - 1, &index, 0, 1, &ctx),
+    B85_E_BAD_INDEX
+  ))
+
+error_exit:
+  B85_INDEX_DESTROY (&index);
+  B85_INDEX_DESTROY (&loaded);
+  B85_CONTEXT_DESTROY (&ctx);
+  free (framed);
+  free (sidecar);
+  return rv;
+}
+
+/// Patches the encoded stream in @a b (with room for @a cap bytes) to match
+/// @a data after the @a n @a ranges have changed, and checks the stream and
+/// the index against a full decode and a rebuilt index.
+static b85_result_t
+check_patch (
+  uint8_t *b, size_t *cb, size_t cap, const uint8_t *data, size_t cb_data,
+  const struct base85_range_t *ranges, size_t n
+)
+{
+  struct base85_context_t ctx;
+  struct base85_index_t index = { .offsets = NULL };
+  struct base85_index_t rebuilt = { .offsets = NULL };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_INDEX_BUILD (b, *cb, 256, &index))
+  B85_TRY (B85_ENCODE_PATCH (
+    b, *cb, cap, &index, data, cb_data, ranges, n, cb
+  ))
+
+  B85_TRY (B85_DECODE (b, *cb, &ctx))
+  B85_TRY (B85_DECODE_LAST (&ctx))
+  size_t out_cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &out_cb);
+  B85_TRY (check_cb (out_cb, cb_data))
+  B85_TRY (check_bytes (out, data, cb_data))
+
+  B85_TRY (B85_INDEX_BUILD (b, *cb, 256, &rebuilt))
+  B85_TRY (check_cb (index.encoded_length, *cb))
+  B85_TRY (check_cb (index.count, rebuilt.count))
+  B85_TRY (check_bytes (
+    index.offsets, rebuilt.offsets, index.count * sizeof (*index.offsets)
+  ))
+  B85_TRY (check_ranges (b, *cb, &index, data, cb_data))
+
+error_exit:
+  B85_INDEX_DESTROY (&index);
+  B85_INDEX_DESTROY (&rebuilt);
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+/// Stores the @a n (at most 3) bytes at @a data, encoded and framed with
+/// leading whitespace, in @a b.
+static b85_result_t
+frame_short (const uint8_t *data, size_t n, uint8_t *b, size_t *cb)
+{
+  memcpy (b, " <~", 3);
+  memcpy (b + 3, data, n);
+  b85_result_t rv = B85_ENCODE_INPLACE (b + 3, n, 8, cb);
+  if (rv)
+    return rv;
+  memcpy (b + 3 + *cb, "~>", 2);
+  *cb += 5;
+  return B85_E_OK;
+}
+
+static b85_result_t
+b85_test_patch ()
+{
+  static const size_t INPUT_SIZE = 10007;
+  static const size_t SLACK = 64;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 50);
+
+  struct base85_context_t ctx;
+  struct base85_index_t index = { .offsets = NULL };
+  uint8_t *plain = NULL;
+  uint8_t *framed = NULL;
+  uint8_t *copy = NULL;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_ENCODE (input, INPUT_SIZE, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+
+  size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  size_t plain_cb = cb;
+  plain = malloc (plain_cb + SLACK);
+  if (!plain)
+    B85_TRY (B85_E_BAD_ALLOC)
+  memcpy (plain, out, plain_cb);
+
+  size_t framed_cb;
+  framed = frame_wrapped (out, cb, 75, "\r\n", SLACK, &framed_cb);
+  copy = framed ? malloc (framed_cb) : NULL;
+  if (!copy)
+    B85_TRY (B85_E_BAD_ALLOC)
+  memcpy (copy, framed, framed_cb);
+
+  // A 'z' group that grows: nothing is written if it does not fit.
+  input[0] = 0xff;
+  static const struct base85_range_t grow = { 0, 1 };
+  B85_TRY (B85_INDEX_BUILD (framed, framed_cb, 256, &index))
+  B85_TRY (check_cb (
+    B85_ENCODE_PATCH (
+      framed, framed_cb, framed_cb, &index, input, INPUT_SIZE, &grow, 1, &cb
+    ),
+    B85_E_BUFFER_TOO_SMALL
+  ))
+  B85_TRY (check_cb (cb, framed_cb + 4))
+  B85_TRY (check_bytes (framed, copy, framed_cb))
+
+  // Groups that become 'z' groups, groups that keep their width (with
+  // overlapping ranges), and the final partial group.
+  memset (input + 60, 0, 8);
+  input[5000] ^= 0x55;
+  input[5003] ^= 0x55;
+  input[INPUT_SIZE - 1] ^= 1;
+  static const struct base85_range_t ranges[] = {
+    { 5000, 1 }, { 60, 8 }, { 4998, 6 }, { 0, 1 }, { 10006, 1 }, { 300, 0 },
+  };
+  B85_TRY (check_patch (
+    framed, &framed_cb, framed_cb + SLACK, input, INPUT_SIZE, ranges,
+    dimof (ranges)
+  ))
+
+  // Without whitespace, the result is the same as a full encode.
+  B85_TRY (check_patch (
+    plain, &plain_cb, plain_cb + SLACK, input, INPUT_SIZE, ranges,
+    dimof (ranges)
+  ))
+  B85_CONTEXT_RESET (&ctx);
+  B85_TRY (B85_ENCODE (input, INPUT_SIZE, &ctx))
+  B85_TRY (B85_ENCODE_LAST (&ctx))
+  out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (plain_cb, cb))
+  B85_TRY (check_bytes (plain, out, cb))
+
+  // Ranges past the end of the data.
+  static const struct base85_range_t past = { INPUT_SIZE - 1, 2 };
+  B85_INDEX_DESTROY (&index);
+  B85_TRY (B85_INDEX_BUILD (plain, plain_cb, 256, &index))
+  B85_TRY (check_cb (
+    B85_ENCODE_PATCH (
+      plain, plain_cb, plain_cb, &index, input, INPUT_SIZE, &past, 1, &cb
+    ),
+    B85_E_API_MISUSE
+  ))
+
+  // Framed streams shorter than a group, whose index has no checkpoints.
+  static const struct base85_range_t first = { 0, 1 };
+  for (size_t n = 1; n < 4; ++n)
+  {
+    uint8_t data[3];
+    uint8_t b[16];
+    uint8_t expected[16];
+    size_t b_cb;
+    size_t expected_cb;
+    memcpy (data, helloworld, n);
+    B85_TRY (frame_short (data, n, b, &b_cb))
+    data[0] ^= 1;
+    B85_TRY (frame_short (data, n, expected, &expected_cb))
+
+    B85_INDEX_DESTROY (&index);
+    B85_TRY (B85_INDEX_BUILD (b, b_cb, 256, &index))
+    B85_TRY (B85_ENCODE_PATCH (
+      b, b_cb, sizeof (b), &index, data, n, &first, 1, &cb
+    ))
+    B85_TRY (check_cb (cb, expected_cb))
+    B85_TRY (check_bytes (b, expected, cb))
+  }
+
+error_exit:
+  B85_INDEX_DESTROY (&index);
+  B85_CONTEXT_DESTROY (&ctx);
+  free (plain);
+  free (framed);
+  free (copy);
+  return rv;
+}
+
+/// Filter chain sink that appends everything it receives to a buffer.
+struct collect_t
+{
+  uint8_t *b;
+  size_t cb;
+  size_t cap;
+};
 
 static b85_result_t
-check_cb (size_t cb0, size_t cb1)
+collect (void *user, const uint8_t *b, size_t cb)
 {
-  return cb0 == cb1 ? B85_E_OK : B85_E_UNSPECIFIED;
+  struct collect_t *c = user;
+  if (c->cb + cb > c->cap)
+  {
+    size_t cap = 2 * (c->cb + cb);
+    uint8_t *p = realloc (c->b, cap);
+    if (!p)
+      return B85_E_BAD_ALLOC;
+    c->b = p;
+    c->cap = cap;
+  }
+  memcpy (c->b + c->cb, b, cb);
+  c->cb += cb;
+  return B85_E_OK;
 }
 
+/// Runs @a fn over @a cb bytes from @a b, interrupting the job after @a split
+/// bytes: the state is saved, and the rest of the input is processed with a
+/// new context restored from it. The output of both halves is collected in
+/// @a out.
 static b85_result_t
-check_bytes (const void *b0, const void *b1, size_t cb)
+check_resume (
+  b85_result_t (*fn) (const uint8_t *, size_t, struct base85_context_t *),
+  b85_result_t (*last) (struct base85_context_t *),
+  const uint8_t *b, size_t cb, size_t split, struct collect_t *out
+)
 {
-  if (memcmp (b0, b1, cb))
-    return B85_E_UNSPECIFIED;
-  return B85_E_OK;
+  struct base85_context_t ctx;
+  struct base85_context_t ctx2 = { .out = NULL };
+  uint8_t state[B85_CONTEXT_STATE_SIZE];
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  B85_TRY (B85_CONTEXT_SET_CHECKSUM (&ctx, 1))
+  B85_TRY (fn (b, split, &ctx))
+
+  size_t out_cb;
+  uint8_t *p = B85_GET_OUTPUT (&ctx, &out_cb);
+  B85_TRY (collect (out, p, out_cb))
+  B85_TRY (B85_CONTEXT_SAVE (&ctx, state))
+
+  B85_TRY (B85_CONTEXT_RESTORE (&ctx2, state))
+  size_t processed = B85_GET_PROCESSED (&ctx2);
+  B85_TRY (check_cb (processed, split))
+  B85_TRY (fn (b + processed, cb - processed, &ctx2))
+  B85_TRY (last (&ctx2))
+
+  // The checksum covers both halves.
+  B85_TRY (fn (b + processed, cb - processed, &ctx))
+  B85_TRY (last (&ctx))
+  B85_TRY (check_cb (B85_GET_CHECKSUM (&ctx), B85_GET_CHECKSUM (&ctx2)))
+
+  p = B85_GET_OUTPUT (&ctx2, &out_cb);
+  B85_TRY (collect (out, p, out_cb))
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
 }
 
 static b85_result_t
-run_decode_test (const struct b85_test_t *entry)
+b85_test_resume ()
 {
+  static const size_t INPUT_SIZE = 5003;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 40);
+
+  struct collect_t encoded = { .b = NULL };
+  struct collect_t decoded = { .b = NULL };
   struct base85_context_t ctx;
   b85_result_t rv = B85_E_UNSPECIFIED;
-
   B85_TRY (B85_CONTEXT_INIT (&ctx))
-  B85_TRY (B85_DECODE ((void *) entry->input_.b_, entry->input_.cb_b_, &ctx))
-  B85_TRY (B85_DECODE_LAST (&ctx))
 
-  size_t cb;
-  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
-  B85_TRY (check_cb (cb, entry->expected_.cb_b_))
-  B85_TRY (check_bytes (out, entry->expected_.b_, cb))
+  // Splits inside a group, and inside the header.
+  static const size_t splits[] = { 1, 2, 7, 2502 };
+  for (size_t i = 0; i < dimof (splits); ++i)
+  {
+    encoded.cb = 0;
+    decoded.cb = 0;
+    B85_TRY (check_resume (
+      B85_ENCODE, B85_ENCODE_LAST, input, INPUT_SIZE, splits[i], &encoded
+    ))
+
+    size_t framed_cb;
+    uint8_t *framed = frame_wrapped (
+      encoded.b, encoded.cb, 0, "", 0, &framed_cb
+    );
+    if (!framed)
+      B85_TRY (B85_E_BAD_ALLOC)
+    rv = check_resume (
+      B85_DECODE, B85_DECODE_LAST, framed, framed_cb, splits[i], &decoded
+    );
+    free (framed);
+    if (rv)
+      goto error_exit;
+
+    B85_TRY (check_cb (decoded.cb, INPUT_SIZE))
+    B85_TRY (check_bytes (decoded.b, input, INPUT_SIZE))
+  }
+
+  // Corrupt state is rejected.
+  uint8_t state[B85_CONTEXT_STATE_SIZE];
+  B85_TRY (B85_CONTEXT_SAVE (&ctx, state))
+  state[8] = 5;
+  B85_TRY (check_cb (B85_CONTEXT_RESTORE (&ctx, state), B85_E_BAD_STATE))
+
+  // A decoder holding 4 digits cannot continue as an encoder, and an encoder
+  // never holds 4 bytes.
+  B85_CONTEXT_RESET (&ctx);
+  B85_TRY (B85_DECODE ((const uint8_t *) "BOu!", 4, &ctx))
+  B85_TRY (B85_CONTEXT_SAVE (&ctx, state))
+  B85_TRY (B85_CONTEXT_RESTORE (&ctx, state))
+  B85_TRY (check_cb (B85_ENCODE (input, 1, &ctx), B85_E_BAD_STATE))
+  B85_TRY (check_cb (B85_ENCODE_LAST (&ctx), B85_E_BAD_STATE))
+
+  B85_CONTEXT_RESET (&ctx);
+  B85_TRY (B85_ENCODE (input + 100, 3, &ctx))
+  B85_TRY (B85_CONTEXT_SAVE (&ctx, state))
+  state[8] = 4;
+  B85_TRY (check_cb (B85_CONTEXT_RESTORE (&ctx, state), B85_E_BAD_STATE))
 
 error_exit:
   B85_CONTEXT_DESTROY (&ctx);
+  free (encoded.b);
+  free (decoded.b);
   return rv;
 }
 
+/// Encodes @a cb bytes from @a b with @a alphabet, compares the result to
+/// @a expected, and decodes it back.
 static b85_result_t
-run_encode_test (const struct b85_test_t *entry)
+check_alphabet (
+  const struct base85_alphabet_t *alphabet, const void *b, size_t cb,
+  const char *expected
+)
 {
   struct base85_context_t ctx;
-  struct base85_context_t ctx2 = { .out = NULL };
-
   b85_result_t rv = B85_E_UNSPECIFIED;
-  uint8_t *out = NULL;
   B85_TRY (B85_CONTEXT_INIT (&ctx))
-  B85_TRY (B85_CONTEXT_INIT (&ctx2))
-  B85_TRY (B85_ENCODE ((void *) entry->input_.b_, entry->input_.cb_b_, &ctx))
+  B85_TRY (B85_CONTEXT_SET_ALPHABET (&ctx, alphabet))
+  B85_TRY (B85_ENCODE (b, cb, &ctx))
   B85_TRY (B85_ENCODE_LAST (&ctx))
 
-  size_t cb;
-  out = B85_GET_OUTPUT (&ctx, &cb);
-  B85_TRY (check_cb (cb, entry->expected_.cb_b_))
-  size_t result_len = strlen ((char *) out);
-  B85_TRY (check_cb (result_len, entry->expected_.cb_b_))
-  B85_TRY (check_bytes (out, entry->expected_.b_, result_len))
-  B85_TRY (B85_DECODE (out, result_len, &ctx2))
-  B85_TRY (B85_DECODE_LAST (&ctx2))
+  size_t out_cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &out_cb);
+  if (expected)
+  {
+    B85_TRY (check_cb (out_cb, strlen (expected)))
+    B85_TRY (check_bytes (out, expected, out_cb))
+  }
 
-  size_t cb2;
-  out = B85_GET_OUTPUT (&ctx2, &cb2);
-  B85_TRY (check_cb (cb2, entry->input_.cb_b_))
-  B85_TRY (check_bytes (entry->input_.b_, out, cb2))
+  uint8_t *encoded = malloc (out_cb + 1);
+  if (!encoded)
+    B85_TRY (B85_E_BAD_ALLOC)
+  memcpy (encoded, out, out_cb);
+
+  B85_CONTEXT_RESET (&ctx);
+  rv = B85_DECODE (encoded, out_cb, &ctx);
+  free (encoded);
+  if (rv)
+    goto error_exit;
+  B85_TRY (B85_DECODE_LAST (&ctx))
+
+  out = B85_GET_OUTPUT (&ctx, &out_cb);
+  B85_TRY (check_cb (out_cb, cb))
+  B85_TRY (check_bytes (out, b, cb))
 
 error_exit:
   B85_CONTEXT_DESTROY (&ctx);
-  B85_CONTEXT_DESTROY (&ctx2);
   return rv;
 }
 
 static b85_result_t
-b85_test_allbytes ()
+b85_test_alphabet ()
 {
-  uint8_t input[256];
-  for (size_t i = 0; i < 256; ++i)
-    input[i] = (uint8_t) i;
+  static const char z85_hello[] = {
+    0x86, 0x4f, 0xd2, 0x6f, 0xb5, 0x59, 0xf7, 0x5b
+  };
+  static const size_t INPUT_SIZE = 3001;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 50);
 
-  struct base85_context_t ctx;
-  struct base85_context_t ctx2 = { .out = NULL };
+  struct base85_context_t ctx = { .out = NULL };
+  struct base85_index_t index = { .offsets = NULL };
   b85_result_t rv = B85_E_UNSPECIFIED;
-  uint8_t *out = NULL;
+
+  // Built-in alphabets, from one library.
+  const struct base85_alphabet_t *rfc1924 = B85_ALPHABET_RFC1924 ();
+  B85_TRY (check_alphabet (rfc1924, helloworld, 12, "Xk~0{Zy<MXa%^NF"))
+  B85_TRY (check_alphabet (rfc1924, helloworld, 5, "Xk~0{Zv"))
+  B85_TRY (check_alphabet (rfc1924, zeros, 8, "0000000000"))
+  B85_TRY (check_alphabet (rfc1924, input, INPUT_SIZE, NULL))
+  B85_TRY (check_alphabet (B85_ALPHABET_Z85 (), z85_hello, 8, "HelloWorld"))
+  B85_TRY (check_alphabet (B85_ALPHABET_Z85 (), input, INPUT_SIZE, NULL))
+  B85_TRY (check_alphabet (B85_ALPHABET_ASCII85 (), zeros, 8, "zz"))
+
+  // Custom alphabet (the generic kernels): Ascii85 reversed, 'y' groups.
+  struct base85_alphabet_t custom;
+  char chars[86];
+  for (int i = 0; i < 85; ++i)
+    chars[i] = (char) ('u' - i);
+  chars[85] = 0;
+  B85_TRY (B85_ALPHABET_INIT (&custom, chars, 'y', 1))
+  B85_TRY (check_alphabet (&custom, zeros, 8, "yy"))
+  B85_TRY (check_alphabet (&custom, input, INPUT_SIZE, NULL))
+
+  // Framing, whitespace and transcoding follow the context's alphabet.
   B85_TRY (B85_CONTEXT_INIT (&ctx))
-  B85_TRY (B85_CONTEXT_INIT (&ctx2))
-  B85_TRY (B85_ENCODE (input, 256, &ctx))
-  B85_TRY (B85_ENCODE_LAST (&ctx))
+  B85_TRY (B85_CONTEXT_SET_ALPHABET (&ctx, &custom))
+  static const char framed[] = "<~y uu\nuuu ~>";
+  B85_TRY (B85_DECODE ((const uint8_t *) framed, strlen (framed), &ctx))
+  B85_TRY (B85_DECODE_LAST (&ctx))
   size_t cb;
+  uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, 8))
+  B85_TRY (check_bytes (out, zeros, 8))
+
+  B85_CONTEXT_RESET (&ctx);
+  B85_TRY (B85_TRANSCODE ((const uint8_t *) framed, strlen (framed), &ctx))
+  B85_TRY (B85_TRANSCODE_LAST (&ctx))
   out = B85_GET_OUTPUT (&ctx, &cb);
-  B85_TRY (B85_DECODE (out, cb, &ctx2))
-  B85_TRY (B85_DECODE_LAST (&ctx2))
+  B85_TRY (check_cb (cb, 2))
+  B85_TRY (check_bytes (out, "zz", 2))
 
-  size_t cb2;
-  out = B85_GET_OUTPUT (&ctx2, &cb2);
+  // Invalid alphabets, and switching alphabets mid stream.
+  B85_TRY (check_cb (
+    B85_CONTEXT_SET_ALPHABET (&ctx, rfc1924), B85_E_API_MISUSE
+  ))
+  chars[3] = chars[4];
+  B85_TRY (check_cb (
+    B85_ALPHABET_INIT (&custom, chars, 0, 0), B85_E_API_MISUSE
+  ))
+  B85_TRY (check_cb (
+    B85_ALPHABET_INIT (&custom, (const char *) rfc1924->encode, 0, 1),
+    B85_E_API_MISUSE
+  ))
+  B85_TRY (check_cb (
+    B85_ALPHABET_INIT (&custom, (const char *) rfc1924->encode, 'A', 0),
+    B85_E_API_MISUSE
+  ))
 
-  B85_TRY (check_cb (256, cb2))
-  B85_TRY (check_bytes (input, out, cb2))
+  // Saved state is tied to the alphabet.
+  uint8_t state[B85_CONTEXT_STATE_SIZE];
+  B85_TRY (B85_CONTEXT_SAVE (&ctx, state))
+  B85_CONTEXT_DESTROY (&ctx);
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (B85_CONTEXT_SET_ALPHABET (&ctx, rfc1924))
+  B85_TRY (check_cb (B85_CONTEXT_RESTORE (&ctx, state), B85_E_BAD_STATE))
+
+  // So is an index, which is built with the default alphabet.
+  static const char encoded[] = "BOu!rD]j7BEbo80";
+  B85_TRY (B85_INDEX_BUILD (
+    (const uint8_t *) encoded, strlen (encoded), 4, &index
+  ))
+  B85_TRY (check_cb (
+    B85_DECODE_RANGE (
+      (const uint8_t *) encoded, strlen (encoded), &index, 4, 4, &ctx
+    ),
+    B85_E_API_MISUSE
+  ))
+  B85_TRY (B85_CONTEXT_SET_ALPHABET (&ctx, B85_ALPHABET_ASCII85 ()))
+  B85_TRY (B85_DECODE_RANGE (
+    (const uint8_t *) encoded, strlen (encoded), &index, 4, 4, &ctx
+  ))
+  out = B85_GET_OUTPUT (&ctx, &cb);
+  B85_TRY (check_cb (cb, 4))
+  B85_TRY (check_bytes (out, helloworld + 4, 4))
 
 error_exit:
+  B85_INDEX_DESTROY (&index);
   B85_CONTEXT_DESTROY (&ctx);
-  B85_CONTEXT_DESTROY (&ctx2);
   return rv;
 }
 
+/// Builds the chain stage (next) using @a create, and destroys @a next on
+/// failure.
+#define B85_FILTER_TRY(create, next) do { \
+  rv = create; \
+  if (rv) { B85_FILTER_DESTROY (next); next = NULL; goto error_exit; } \
+} while (0);
+
+/// Pushes @a cb bytes from @a b into @a f in uneven chunks, then finishes.
 static b85_result_t
-b85_test_more_data ()
+filter_run (struct b85_filter_t *f, const uint8_t *b, size_t cb)
 {
-  static const size_t INPUT_CHUNK_SIZE = 2048;
-  static const size_t N_ITERATIONS = 2000;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  for (size_t i = 0; i < cb; i += 777)
+    B85_TRY (b85_filter_push (f, b + i, cb - i < 777 ? cb - i : 777))
+  B85_TRY (b85_filter_finish (f))
 
-  uint8_t input[INPUT_CHUNK_SIZE];
-  for (size_t i = 0; i < INPUT_CHUNK_SIZE; ++i)
-    input[i] = (uint8_t) i;
+error_exit:
+  return rv;
+}
+
+static b85_result_t
+b85_test_filter ()
+{
+  static const size_t INPUT_SIZE = 100003;
+  uint8_t *input = malloc (INPUT_SIZE);
+  if (!input)
+    return B85_E_BAD_ALLOC;
+  fill_input (input, INPUT_SIZE, 1000);
+
+  static const char encoded[] = "<~BOu!rD]j7BEbo80~>";
+  struct collect_t out = { .b = NULL };
+  struct collect_t out2 = { .b = NULL };
+  struct b85_filter_t *chain = NULL;
+  struct b85_filter_t *chain2 = NULL;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+
+  // Decoder -> sink.
+  B85_TRY (B85_FILTER_SINK (collect, &out, &chain))
+  B85_FILTER_TRY (B85_FILTER_DECODER (chain, &chain), chain)
+  B85_TRY (filter_run (chain, (const uint8_t *) encoded, strlen (encoded)))
+  B85_TRY (check_cb (out.cb, 12))
+  B85_TRY (check_bytes (out.b, helloworld, 12))
+
+  // Errors are reported through the chain.
+  B85_FILTER_DESTROY (chain);
+  chain = NULL;
+  out.cb = 0;
+  B85_TRY (B85_FILTER_SINK (collect, &out, &chain))
+  B85_FILTER_TRY (B85_FILTER_DECODER (chain, &chain), chain)
+  B85_TRY (check_cb (
+    b85_filter_push (chain, (const uint8_t *) "<~BOu!r~~>", 10),
+    B85_E_BAD_FOOTER
+  ))
+
+  // Encoder -> decoder -> sink.
+  B85_FILTER_DESTROY (chain);
+  chain = NULL;
+  out.cb = 0;
+  B85_TRY (B85_FILTER_SINK (collect, &out, &chain))
+  B85_FILTER_TRY (B85_FILTER_DECODER (chain, &chain), chain)
+  B85_FILTER_TRY (B85_FILTER_ENCODER (chain, &chain), chain)
+  B85_TRY (filter_run (chain, input, INPUT_SIZE))
+  B85_TRY (check_cb (out.cb, INPUT_SIZE))
+  B85_TRY (check_bytes (out.b, input, INPUT_SIZE))
+
+#if defined (B85_HAVE_ZLIB)
+  // Deflate -> encoder -> sink, then decoder -> inflate -> sink.
+  B85_FILTER_DESTROY (chain);
+  chain = NULL;
+  out.cb = 0;
+  B85_TRY (B85_FILTER_SINK (collect, &out, &chain))
+  B85_FILTER_TRY (B85_FILTER_ENCODER (chain, &chain), chain)
+  B85_FILTER_TRY (B85_FILTER_DEFLATE (-1, chain, &chain), chain)
+  B85_TRY (filter_run (chain, input, INPUT_SIZE))
+
+  B85_TRY (B85_FILTER_SINK (collect, &out2, &chain2))
+  B85_FILTER_TRY (B85_FILTER_INFLATE (chain2, &chain2), chain2)
+  B85_FILTER_TRY (B85_FILTER_DECODER (chain2, &chain2), chain2)
+  B85_TRY (filter_run (chain2, out.b, out.cb))
+  B85_TRY (check_cb (out2.cb, INPUT_SIZE))
+  B85_TRY (check_bytes (out2.b, input, INPUT_SIZE))
+
+  // A truncated zlib stream is an error.
+  B85_FILTER_DESTROY (chain2);
+  chain2 = NULL;
+  out2.cb = 0;
+  B85_TRY (B85_FILTER_SINK (collect, &out2, &chain2))
+  B85_FILTER_TRY (B85_FILTER_INFLATE (chain2, &chain2), chain2)
+  B85_FILTER_TRY (B85_FILTER_DECODER (chain2, &chain2), chain2)
+  B85_TRY (check_cb (
+    filter_run (chain2, out.b, out.cb / 2), B85_E_FILTER
+  ))
+#endif
+
+error_exit:
+  B85_FILTER_DESTROY (chain);
+  B85_FILTER_DESTROY (chain2);
+  free (out.b);
+  free (out2.b);
+  free (input);
+  return rv;
+}
+
+/// Checks the segments found in @a doc, decoded with @a threads threads. Of
+/// the @a n segments, the first 100 decode to @a input (of increasing length),
+/// then come helloworld, an invalid footer and an unterminated segment.
+static b85_result_t
+check_segments (
+  const uint8_t *doc, size_t doc_cb, const uint8_t *input, size_t threads
+)
+{
+  struct base85_segments_t segments;
+  b85_result_t rv = B85_SEGMENTS_SCAN (doc, doc_cb, &segments);
+  if (rv)
+    return rv;
 
+  B85_TRY (B85_SEGMENTS_DECODE (doc, &segments, threads))
+  B85_TRY (check_cb (segments.count, 103))
+
+  size_t out_offset = 0;
+  for (size_t k = 0; k < 100; ++k)
+  {
+    const struct base85_segment_t *s = &segments.segments[k];
+    B85_TRY (s->rv)
+    B85_TRY (check_cb (s->processed, s->cb))
+    B85_TRY (check_cb (s->out_offset, out_offset))
+    B85_TRY (check_cb (s->out_cb, k * 37))
+    B85_TRY (check_bytes (segments.arena + s->out_offset, input, s->out_cb))
+    out_offset += s->out_cb;
+  }
+
+  const struct base85_segment_t *s = &segments.segments[100];
+  B85_TRY (s->rv)
+  B85_TRY (check_cb (s->cb, 19))
+  B85_TRY (check_bytes (segments.arena + s->out_offset, helloworld, 12))
+
+  s = &segments.segments[101];
+  B85_TRY (check_cb (s->rv, B85_E_BAD_FOOTER))
+  B85_TRY (check_cb (s->out_cb, 0))
+  B85_TRY (check_bytes (doc + s->offset, "<~BOu~x", s->cb))
+
+  s = &segments.segments[102];
+  B85_TRY (check_cb (s->rv, B85_E_BAD_FOOTER))
+  B85_TRY (check_cb (s->offset + s->cb, doc_cb))
+  B85_TRY (check_cb (segments.arena_cb, out_offset + 12))
+
+error_exit:
+  B85_SEGMENTS_DESTROY (&segments);
+  return rv;
+}
+
+static b85_result_t
+b85_test_segments ()
+{
+  static const size_t INPUT_SIZE = 100 * 37;
+  static const size_t DOC_SIZE = 512 * 1024;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 40);
+
+  uint8_t *doc = malloc (DOC_SIZE);
+  if (!doc)
+    return B85_E_BAD_ALLOC;
+
+  // Segments with wrapped lines, separated by text with stray '<' and '~'.
   struct base85_context_t ctx;
-  struct base85_context_t ctx2 = { .out = NULL };
+  size_t doc_cb = 0;
   b85_result_t rv = B85_E_UNSPECIFIED;
-  uint8_t *out = NULL;
   B85_TRY (B85_CONTEXT_INIT (&ctx))
-  B85_TRY (B85_CONTEXT_INIT (&ctx2))
+  for (size_t k = 0; k < 100; ++k)
+  {
+    B85_CONTEXT_RESET (&ctx);
+    B85_TRY (B85_ENCODE (input, k * 37, &ctx))
+    B85_TRY (B85_ENCODE_LAST (&ctx))
+
+    size_t cb;
+    uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+    doc_cb += sprintf ((char *) doc + doc_cb, "stream %zu < x ~> y <", k);
+    size_t framed_cb;
+    uint8_t *framed = frame_wrapped (out, cb, 64, "\n", 0, &framed_cb);
+    if (!framed)
+      B85_TRY (B85_E_BAD_ALLOC)
+    memcpy (doc + doc_cb, framed, framed_cb);
+    doc_cb += framed_cb;
+    free (framed);
+    memcpy (doc + doc_cb, "\nendstream\n", 11);
+    doc_cb += 11;
+  }
+  static const char tail[] =
+    "<~BOu!rD]j7BEbo80~> <~BOu~x <~~ <~BOu!rD";
+  memcpy (doc + doc_cb, tail, sizeof (tail) - 1);
+  doc_cb += sizeof (tail) - 1;
+
+  // "<~~" is an empty segment with a bad footer, see check_segments().
+  struct base85_segments_t segments;
+  B85_TRY (B85_SEGMENTS_SCAN (doc, doc_cb, &segments))
+  B85_TRY (check_cb (segments.count, 104))
+  B85_SEGMENTS_DESTROY (&segments);
+
+  doc_cb -= sizeof (" <~~ <~BOu!rD") - 1;
+  memcpy (doc + doc_cb, " <~BOu!rD", 9);
+  doc_cb += 9;
+  B85_TRY (check_segments (doc, doc_cb, input, 1))
+  B85_TRY (check_segments (doc, doc_cb, input, 4))
+
+  // Nothing to find.
+  B85_TRY (B85_SEGMENTS_SCAN (input, 100, &segments))
+  B85_TRY (check_cb (segments.count, 0))
+  B85_TRY (B85_SEGMENTS_DECODE (input, &segments, 2))
+  B85_TRY (check_cb (segments.arena_cb, 0))
+  B85_SEGMENTS_DESTROY (&segments);
+
+error_exit:
+  B85_CONTEXT_DESTROY (&ctx);
+  free (doc);
+  return rv;
+}
+
+/// Values converted by the workers of b85_test_cache().
+struct cache_job_t
+{
+  struct b85_cache_t *cache;
+  const uint8_t *input;
+  b85_result_t rv;
+};
 
+/// Pool task: counts its runs, and records the worker that ran it.
+struct pool_task_t
+{
+  size_t runs;
+  size_t worker;
+};
+
+static void
+pool_worker (void *user, size_t worker, void *task)
+{
+  struct pool_task_t *t = task;
+  t->runs++;
+  t->worker = worker;
+  (void) user;
+}
+
+/// Runs @a n tasks on @a threads threads, and checks that each ran exactly
+/// once on a valid worker.
+static b85_result_t
+check_pool (size_t threads, size_t n)
+{
+  struct pool_task_t *items = calloc (n ? n : 1, sizeof (*items));
+  void **tasks = malloc ((n ? n : 1) * sizeof (*tasks));
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  if (!items || !tasks)
+    B85_TRY (B85_E_BAD_ALLOC)
+
+  for (size_t k = 0; k < n; ++k)
+    tasks[k] = &items[k];
+  B85_TRY (check_cb (b85_pool_run (threads, tasks, n, pool_worker, NULL), 0))
+  for (size_t k = 0; k < n; ++k)
+  {
+    B85_TRY (check_cb (items[k].runs, 1))
+    if (items[k].worker >= threads)
+      B85_TRY (B85_E_UNSPECIFIED)
+  }
+
+error_exit:
+  free (items);
+  free (tasks);
+  return rv;
+}
+
+static b85_result_t
+b85_test_pool ()
+{
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_pool (1, 0))
+  B85_TRY (check_pool (1, 10))
+  B85_TRY (check_pool (4, 0))
+  B85_TRY (check_pool (4, 1000))
+  B85_TRY (check_pool (8, 3))
+
+error_exit:
+  return rv;
+}
+
+/// Encodes and decodes values that are shared with the other workers. Tasks
+/// are numbered from 1, since NULL ends a queue.
+static void
+cache_worker (void *user, size_t worker, void *task)
+{
+  struct cache_job_t *job = user;
+  size_t k = (size_t) (uintptr_t) task;
+  uint8_t encoded[64];
+  uint8_t decoded[64];
   size_t cb;
-  for (size_t i = 0; i < N_ITERATIONS; ++i)
+  size_t decoded_cb;
+  b85_result_t rv = B85_CACHE_ENCODE (
+    job->cache, job->input + k % 50, 32, encoded, sizeof (encoded), &cb
+  );
+  if (B85_E_OK == rv)
   {
-    B85_TRY (B85_ENCODE (input, INPUT_CHUNK_SIZE, &ctx))
-    out = B85_GET_OUTPUT (&ctx, &cb);
+    rv = B85_CACHE_DECODE (
+      job->cache, encoded, cb, decoded, sizeof (decoded), &decoded_cb
+    );
+  }
+  if (B85_E_OK == rv && (32 != decoded_cb
+    || memcmp (decoded, job->input + k % 50, 32)))
+  {
+    rv = B85_E_LOGIC_ERROR;
+  }
+  if (rv)
+    job->rv = rv;
+  (void) worker;
+}
 
-    B85_TRY (B85_DECODE (out, cb, &ctx2))
-    out = B85_GET_OUTPUT (&ctx2, &cb);
-    B85_TRY (check_cb (cb, INPUT_CHUNK_SIZE))
-    B85_TRY (check_bytes (out, input, cb))
-    B85_CLEAR_OUTPUT (&ctx);
-    B85_CLEAR_OUTPUT (&ctx2);
+static b85_result_t
+b85_test_cache ()
+{
+  static const size_t INPUT_SIZE = 1000;
+  uint8_t input[INPUT_SIZE];
+  fill_input (input, INPUT_SIZE, 8);
+
+  struct base85_context_t ctx;
+  struct b85_cache_t *cache = NULL;
+  struct b85_cache_stats_t stats;
+  uint8_t out[1300];
+  size_t cb;
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  B85_TRY (check_cb (B85_CACHE_CREATE (0, 4, &cache), B85_E_API_MISUSE))
+  B85_TRY (B85_CACHE_CREATE (1024 * 1024, 4, &cache))
+
+  // Same results as the codec, the second time from the cache.
+  for (size_t round = 0; round < 2; ++round)
+  {
+    for (size_t n = 0; n <= INPUT_SIZE; n += 37)
+    {
+      B85_CONTEXT_RESET (&ctx);
+      B85_TRY (B85_ENCODE (input, n, &ctx))
+      B85_TRY (B85_ENCODE_LAST (&ctx))
+      size_t expected_cb;
+      uint8_t *expected = B85_GET_OUTPUT (&ctx, &expected_cb);
+      B85_TRY (B85_CACHE_ENCODE (cache, input, n, out, sizeof (out), &cb))
+      B85_TRY (check_cb (cb, expected_cb))
+      B85_TRY (check_bytes (out, expected, cb))
+
+      uint8_t decoded[INPUT_SIZE];
+      B85_TRY (B85_CACHE_DECODE (
+        cache, expected, expected_cb, decoded, sizeof (decoded), &cb
+      ))
+      B85_TRY (check_cb (cb, n))
+      B85_TRY (check_bytes (decoded, input, n))
+    }
   }
-  B85_TRY (B85_ENCODE_LAST (&ctx))
-  B85_TRY (B85_DECODE_LAST (&ctx2))
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.misses, 2 * 28))
+  B85_TRY (check_cb (stats.hits, 2 * 28))
+  B85_TRY (check_cb (stats.evictions, 0))
 
-  // Sanity check on buffer size.
-  if (ctx.out_cb > INPUT_CHUNK_SIZE * 2 || ctx2.out_cb > INPUT_CHUNK_SIZE * 2)
-    rv = B85_E_UNSPECIFIED;
+  // The length is reported with a short buffer, and the retry is a hit.
+  B85_TRY (check_cb (
+    B85_CACHE_ENCODE (cache, input, 100, out, 10, &cb), B85_E_BUFFER_TOO_SMALL
+  ))
+  size_t needed = cb;
+  B85_TRY (B85_CACHE_ENCODE (cache, input, 100, out, needed, &cb))
+  B85_TRY (check_cb (cb, needed))
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.hits, 2 * 28 + 1))
+
+  // Errors are not cached.
+  for (size_t round = 0; round < 2; ++round)
+  {
+    B85_TRY (check_cb (
+      B85_CACHE_DECODE (cache, (const uint8_t *) "ab\x01", 3, out, 10, &cb),
+      B85_E_INVALID_CHAR
+    ))
+  }
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.hits, 2 * 28 + 1))
+
+  // 'z' groups grow the output beyond the input.
+  B85_TRY (B85_CACHE_DECODE (
+    cache, (const uint8_t *) "zzz", 3, out, sizeof (out), &cb
+  ))
+  B85_TRY (check_cb (cb, 12))
+  B85_TRY (check_bytes (out, zeros, 12))
+
+  // The memory cap is kept by evicting the least recently used entries.
+  B85_CACHE_DESTROY (cache);
+  cache = NULL;
+  B85_TRY (B85_CACHE_CREATE (4096, 1, &cache))
+  for (size_t k = 0; k < 200; ++k)
+    B85_TRY (B85_CACHE_ENCODE (cache, input + k, 16, out, sizeof (out), &cb))
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.bytes <= 4096, 1))
+  B85_TRY (check_cb (stats.evictions, 200 - stats.entries))
+  B85_TRY (B85_CACHE_ENCODE (cache, input + 199, 16, out, sizeof (out), &cb))
+  B85_TRY (B85_CACHE_ENCODE (cache, input, 16, out, sizeof (out), &cb))
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.hits, 1))
+
+  // Concurrent use.
+  B85_CACHE_DESTROY (cache);
+  cache = NULL;
+  B85_TRY (B85_CACHE_CREATE (64 * 1024, 0, &cache))
+  struct cache_job_t job = { .cache = cache, .input = input };
+  void *tasks[400];
+  for (size_t k = 0; k < dimof (tasks); ++k)
+    tasks[k] = (void *) (uintptr_t) (k + 1);
+  B85_TRY (check_cb (
+    b85_pool_run (4, tasks, dimof (tasks), cache_worker, &job), 0
+  ))
+  B85_TRY (job.rv)
+  B85_CACHE_STATS (cache, &stats);
+  B85_TRY (check_cb (stats.hits + stats.misses, 2 * dimof (tasks)))
+  B85_TRY (check_cb (stats.entries, 100))
 
 error_exit:
+  B85_CACHE_DESTROY (cache);
   B85_CONTEXT_DESTROY (&ctx);
-  B85_CONTEXT_DESTROY (&ctx2);
+  return rv;
+}
+
+static b85_result_t
+b85_test_tuning ()
+{
+  char path[] = "/tmp/b85_tune_XXXXXX";
+  int fd = mkstemp (path);
+  if (-1 == fd)
+    return B85_E_IO;
+  FILE *fh = fdopen (fd, "w");
+  if (!fh)
+  {
+    close (fd);
+    remove (path);
+    return B85_E_IO;
+  }
+
+  // The section of another CPU model is kept by B85_TUNING_SAVE().
+  fprintf (fh, "[some other cpu]\ncompact sse2\nthreads 64\n");
+  fclose (fh);
+
+  b85_compact_kernel_t kernel = B85_GET_COMPACT_KERNEL ();
+  struct b85_tuning_t loaded;
+  struct b85_tuning_t tuning = {
+    .compact = B85_COMPACT_GENERIC,
+    .chunk = { 4096, 65536 },
+    .threads = 3,
+  };
+  b85_result_t rv = B85_E_UNSPECIFIED;
+  B85_TRY (check_cb (B85_TUNING_LOAD (path, &loaded), B85_E_BAD_STATE))
+  B85_TRY (B85_TUNING_SAVE (path, &tuning))
+  B85_TRY (B85_TUNING_LOAD (path, &loaded))
+  B85_TRY (check_cb (loaded.compact, B85_COMPACT_GENERIC))
+  B85_TRY (check_cb (loaded.chunk[B85_TUNE_ASCII85], 4096))
+  B85_TRY (check_cb (loaded.chunk[B85_TUNE_Z85], 65536))
+  B85_TRY (check_cb (loaded.threads, 3))
+
+  // Saving again replaces the section of this CPU model.
+  tuning.threads = 5;
+  B85_TRY (B85_TUNING_SAVE (path, &tuning))
+  B85_TRY (B85_TUNING_LOAD (path, &loaded))
+  B85_TRY (check_cb (loaded.threads, 5))
+  fh = fopen (path, "r");
+  if (!fh)
+    B85_TRY (B85_E_IO)
+  char file[512];
+  size_t file_cb = fread (file, 1, sizeof (file) - 1, fh);
+  fclose (fh);
+  file[file_cb] = 0;
+  B85_TRY (check_cb (!strstr (file, "[some other cpu]\ncompact sse2\n"), 0))
+  B85_TRY (check_cb (!strstr (file, "threads 3"), 1))
+
+  B85_TRY (check_cb (
+    strcmp (B85_TUNING_KERNEL_NAME (B85_COMPACT_GENERIC), "generic"), 0
+  ))
+  B85_TRY (check_cb (!B85_TUNING_KERNEL_NAME (B85_COMPACT_END), 1))
+
+  B85_TRY (B85_TUNING_APPLY (&loaded))
+  B85_TRY (check_cb (B85_GET_COMPACT_KERNEL (), B85_COMPACT_GENERIC))
+  B85_TRY (check_cb (
+    B85_SET_COMPACT_KERNEL (B85_COMPACT_END), B85_E_API_MISUSE
+  ))
+  B85_TRY (B85_SET_COMPACT_KERNEL (B85_COMPACT_AUTO))
+  B85_TRY (check_cb (B85_GET_COMPACT_KERNEL () != B85_COMPACT_AUTO, 1))
+
+  B85_TRY (check_cb (
+    B85_TUNING_LOAD ("/nonexistent/b85_tune", &loaded), B85_E_IO
+  ))
+
+error_exit:
+  B85_SET_COMPACT_KERNEL (kernel);
+  remove (path);
   return rv;
 }
 
@@ -194,8 +1967,6 @@ static b85_result_t b85_test_##name () { \
 
 #define B85_RUN_EXPECT_SUCCESS(name) B85_RUN_TEST (name, B85_E_OK)
 
-static const char helloworld[] = "hello world!";
-
 B85_CREATE_TEST (s0, run_encode_test, helloworld, 0, "", 0)
 B85_CREATE_TEST (s1, run_encode_test, helloworld, 1, "BE", 2)
 B85_CREATE_TEST (s2, run_encode_test, helloworld, 2, "BOq", 3)
@@ -232,6 +2003,11 @@ B85_CREATE_TEST (z6, run_encode_test, zeros, 24, "zzzzzz", 6)
 B85_CREATE_TEST (z7, run_encode_test, zeros, 28, "zzzzzzz", 7)
 B85_CREATE_TEST (z8, run_encode_test, zeros, 32, "zzzzzzzz", 8)
 
+// A trailing partial group is never abbreviated to 'z'.
+B85_CREATE_TEST (zt1, run_encode_test, zeros, 1, "!!", 2)
+B85_CREATE_TEST (zt2, run_encode_test, zeros, 6, "z!!!", 4)
+B85_CREATE_TEST (zt3, run_encode_test, zeros, 11, "zz!!!!", 6)
+
 B85_CREATE_TEST (bin1, run_encode_test, binary1, 4,"s4IA0", 5)
 B85_CREATE_TEST (bin2, run_encode_test, binary2, 4,"s8W-!", 5)
 
@@ -264,6 +2040,10 @@ run_tests (int argc, char *argv[])
 
   start = clock ();
 
+  // Runs before anything else initializes the library.
+  printf ("first use:\n");
+  B85_RUN_EXPECT_SUCCESS (first_use)
+
   printf ("small tests:\n");
   B85_RUN_EXPECT_SUCCESS (s0)
   B85_RUN_EXPECT_SUCCESS (s1)
@@ -286,6 +2066,9 @@ run_tests (int argc, char *argv[])
   B85_RUN_EXPECT_SUCCESS (z6)
   B85_RUN_EXPECT_SUCCESS (z7)
   B85_RUN_EXPECT_SUCCESS (z8)
+  B85_RUN_EXPECT_SUCCESS (zt1)
+  B85_RUN_EXPECT_SUCCESS (zt2)
+  B85_RUN_EXPECT_SUCCESS (zt3)
   B85_RUN_EXPECT_SUCCESS (bin1)
   B85_RUN_EXPECT_SUCCESS (bin2)
 
@@ -303,6 +2086,12 @@ run_tests (int argc, char *argv[])
   printf ("decode whitespace:\n");
   B85_RUN_EXPECT_SUCCESS (ws1)
   B85_RUN_EXPECT_SUCCESS (ws2)
+  B85_RUN_EXPECT_SUCCESS (ws_error)
+  B85_RUN_EXPECT_SUCCESS (bulk_errors)
+  B85_RUN_EXPECT_SUCCESS (line_hint)
+
+  printf ("zero runs:\n");
+  B85_RUN_EXPECT_SUCCESS (zero_runs)
 
   printf ("all bytes:\n");
   B85_RUN_EXPECT_SUCCESS (allbytes)
@@ -310,6 +2099,49 @@ run_tests (int argc, char *argv[])
   printf ("larger:\n");
   B85_RUN_EXPECT_SUCCESS (more_data)
 
+  printf ("iovec:\n");
+  B85_RUN_EXPECT_SUCCESS (iovec)
+
+  printf ("validate:\n");
+  B85_RUN_EXPECT_SUCCESS (validate)
+
+  printf ("decoded length:\n");
+  B85_RUN_EXPECT_SUCCESS (decoded_length)
+
+  printf ("in place:\n");
+  B85_RUN_EXPECT_SUCCESS (inplace)
+
+  printf ("transcode:\n");
+  B85_RUN_EXPECT_SUCCESS (transcode)
+
+  printf ("checksum:\n");
+  B85_RUN_EXPECT_SUCCESS (checksum)
+
+  printf ("resume:\n");
+  B85_RUN_EXPECT_SUCCESS (resume)
+
+  printf ("index:\n");
+  B85_RUN_EXPECT_SUCCESS (index)
+  B85_RUN_EXPECT_SUCCESS (patch)
+
+  printf ("alphabets:\n");
+  B85_RUN_EXPECT_SUCCESS (alphabet)
+
+  printf ("filter chain:\n");
+  B85_RUN_EXPECT_SUCCESS (filter)
+
+  printf ("segments:\n");
+  B85_RUN_EXPECT_SUCCESS (segments)
+
+  printf ("thread pool:\n");
+  B85_RUN_EXPECT_SUCCESS (pool)
+
+  printf ("cache:\n");
+  B85_RUN_EXPECT_SUCCESS (cache)
+
+  printf ("tuning:\n");
+  B85_RUN_EXPECT_SUCCESS (tuning)
+
   printf ("failure cases:\n");
   B85_RUN_TEST (f1, B85_E_INVALID_CHAR)
   B85_RUN_TEST (f2, B85_E_OVERFLOW)
@@ -333,5 +2165,7 @@ run_tests (int argc, char *argv[])
 int
 main (int argc, char *argv[])
 {
+  // Keep the tuning cache of the user out of the tests.
+  setenv ("B85_TUNE_FILE", "", 1);
   return run_tests (argc, argv);
 }
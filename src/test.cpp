@@ -0,0 +1,169 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "base85.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+#define B85_TRY(expr) do { b85_result_t rv_ = (expr); if (rv_) return rv_; } \
+  while (0);
+
+#define B85_CHECK(cond) do { if (!(cond)) return B85_E_UNSPECIFIED; } \
+  while (0);
+
+std::vector<std::uint8_t>
+make_input (std::size_t cb)
+{
+  std::vector<std::uint8_t> input (cb);
+  for (std::size_t i = 0; i < cb; ++i)
+    input[i] = (i / 30) % 3 ? static_cast<std::uint8_t> (i * 7 + i / 5) : 0;
+  return input;
+}
+
+/// Encodes @a input with the C library.
+b85_result_t
+c_encode (const std::vector<std::uint8_t> &input, std::string &encoded)
+{
+  struct base85_context_t ctx;
+  B85_TRY (B85_CONTEXT_INIT (&ctx))
+  b85_result_t rv = B85_ENCODE (input.data (), input.size (), &ctx);
+  if (B85_E_OK == rv)
+    rv = B85_ENCODE_LAST (&ctx);
+
+  std::size_t cb;
+  const uint8_t *out = B85_GET_OUTPUT (&ctx, &cb);
+  encoded.assign (reinterpret_cast<const char *> (out), cb);
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+b85_result_t
+test_encode ()
+{
+  for (std::size_t cb = 0; cb < 300; cb += 7)
+  {
+    auto input = make_input (cb);
+    std::string expected;
+    B85_TRY (c_encode (input, expected))
+
+    std::string encoded;
+    for (char c : input | base85::views::encode<>)
+      encoded.push_back (c);
+    B85_CHECK (encoded == expected)
+
+    // std::byte input.
+    std::vector<std::byte> bytes (cb);
+    std::transform (
+      input.begin (), input.end (), bytes.begin (),
+      [] (std::uint8_t b) { return std::byte { b }; }
+    );
+    B85_CHECK (std::ranges::equal (
+      base85::views::encode<> (bytes), expected
+    ))
+  }
+  return B85_E_OK;
+}
+
+b85_result_t
+test_decode ()
+{
+  for (std::size_t cb = 0; cb < 300; cb += 7)
+  {
+    auto input = make_input (cb);
+    std::string encoded;
+    B85_TRY (c_encode (input, encoded))
+
+    // Framed and wrapped, to exercise the header/footer and whitespace.
+    std::string framed = "<~";
+    for (std::size_t i = 0; i < encoded.size (); i += 10)
+      framed += encoded.substr (i, 10) + "\r\n";
+    framed += "~> trailing garbage";
+
+    base85::decode_view view (framed);
+    std::vector<std::uint8_t> decoded;
+    std::ranges::copy (view, std::back_inserter (decoded));
+    B85_CHECK (B85_E_OK == view.error ())
+    B85_CHECK (decoded == input)
+  }
+
+  // Single pass input ranges.
+  std::istringstream stream ("BOu!rD]j7BEbo80");
+  auto view = std::views::istream<char> (stream) | base85::views::decode<>;
+  B85_CHECK (std::ranges::equal (view, std::string ("hello world!")))
+  return B85_E_OK;
+}
+
+b85_result_t
+test_decode_errors ()
+{
+  static const struct
+  {
+    const char *input;
+    b85_result_t expected;
+  } cases[] = {
+    { "abcx", B85_E_INVALID_CHAR },
+    { "s8W-\"", B85_E_OVERFLOW },
+    { "<~", B85_E_BAD_FOOTER },
+    { "<~s4IA0 ", B85_E_BAD_FOOTER },
+    { "<~~~>", B85_E_BAD_FOOTER },
+    { "<~B~E~>", B85_E_BAD_FOOTER },
+  };
+
+  for (const auto &c : cases)
+  {
+    std::string input = c.input;
+    auto view = input | base85::views::decode<>;
+    for (auto it = view.begin (); it != view.end (); ++it)
+      ;
+    B85_CHECK (c.expected == view.error ())
+  }
+  return B85_E_OK;
+}
+
+b85_result_t
+test_lazy ()
+{
+  // Comparison stops at the first mismatch: the invalid input after it is
+  // never decoded.
+  std::string token = "BOu!rD]j7BEbo80\x01\x01\x01\x01\x01";
+  std::string expected = "hello there!";
+  auto view = token | base85::views::decode<>;
+  auto [decoded, _] = std::ranges::mismatch (view, expected);
+  B85_CHECK (decoded != view.end ())
+  B85_CHECK (static_cast<char> (*decoded) == 'w')
+  B85_CHECK (B85_E_OK == view.error ())
+  B85_CHECK (view.processed () == 10)
+  return B85_E_OK;
+}
+
+} // namespace
+
+#define B85_RUN_TEST(name) do { \
+  b85_result_t result = test_##name (); \
+  printf ("  %s -> %s\n", result ? "FAIL" : "PASS", #name); \
+  count += !result; \
+  ++total; \
+} while (0);
+
+int
+main ()
+{
+  std::size_t count = 0;
+  std::size_t total = 0;
+
+  printf ("range views:\n");
+  B85_RUN_TEST (encode)
+  B85_RUN_TEST (decode)
+  B85_RUN_TEST (decode_errors)
+  B85_RUN_TEST (lazy)
+
+  printf ("\n%zu TOTAL %zu FAILED\n", total, total - count);
+  return total != count;
+}
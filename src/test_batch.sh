@@ -0,0 +1,102 @@
+#!/bin/sh
+# Copyright 2015 Judson Weissert; See LICENSE file.
+#
+# Tests of the --batch mode of the command line tool.
+# Usage: test_batch.sh path/to/ascii85
+
+set -u
+
+# Keep the tuning cache of the user out of the tests.
+export B85_TUNE_FILE=
+
+BIN=$1
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+FAILED=0
+
+fail ()
+{
+  echo "  FAIL -> $1"
+  FAILED=1
+}
+
+pass ()
+{
+  echo "  PASS -> $1"
+}
+
+mkdir "$DIR/in" "$DIR/other" "$DIR/enc" "$DIR/dec"
+printf 'hello world!' > "$DIR/in/a"
+head -c 100000 /dev/urandom > "$DIR/in/b"
+: > "$DIR/in/empty"
+printf 'other' > "$DIR/other/a"
+
+echo "batch:"
+
+# Round trip with more threads than files.
+if "$BIN" -e --batch -j 4 -o "$DIR/enc" "$DIR/in/a" "$DIR/in/b" \
+    "$DIR/in/empty" \
+  && "$BIN" -d --batch -j 4 -o "$DIR/dec" "$DIR/enc/a" "$DIR/enc/b" \
+    "$DIR/enc/empty" \
+  && cmp -s "$DIR/in/a" "$DIR/dec/a" && cmp -s "$DIR/in/b" "$DIR/dec/b" \
+  && cmp -s "$DIR/in/empty" "$DIR/dec/empty"
+then
+  pass roundtrip
+else
+  fail roundtrip
+fi
+
+# A thread count far above the file count only starts a thread per file.
+rm -f "$DIR/enc/"*
+if "$BIN" -e --batch -j 1000000000 -o "$DIR/enc" "$DIR/in/a" "$DIR/in/b" \
+  && [ -s "$DIR/enc/a" ] && [ -s "$DIR/enc/b" ]
+then
+  pass many_threads
+else
+  fail many_threads
+fi
+
+# File names from stdin.
+rm -f "$DIR/dec/"*
+if printf '%s\n' "$DIR/enc/a" "$DIR/enc/b" \
+    | "$BIN" -d --batch -o "$DIR/dec" \
+  && cmp -s "$DIR/in/a" "$DIR/dec/a" && cmp -s "$DIR/in/b" "$DIR/dec/b"
+then
+  pass stdin
+else
+  fail stdin
+fi
+
+# A bad input is reported, the others are still converted.
+rm -f "$DIR/dec/"*
+if ! "$BIN" -d --batch -o "$DIR/dec" "$DIR/in/a" "$DIR/enc/b" 2> /dev/null \
+  && cmp -s "$DIR/in/b" "$DIR/dec/b"
+then
+  pass errors
+else
+  fail errors
+fi
+
+# An output directory that holds the inputs is rejected, without touching
+# them.
+cp "$DIR/in/b" "$DIR/b.orig"
+if ! "$BIN" -e --batch -o "$DIR/in" "$DIR/in/b" 2> /dev/null \
+  && cmp -s "$DIR/in/b" "$DIR/b.orig"
+then
+  pass same_file
+else
+  fail same_file
+fi
+
+# Inputs with the same name are rejected before anything is written.
+rm -f "$DIR/enc/"*
+if ! "$BIN" -e --batch -o "$DIR/enc" "$DIR/in/a" "$DIR/other/a" 2> /dev/null \
+  && [ ! -e "$DIR/enc/a" ]
+then
+  pass same_name
+else
+  fail same_name
+fi
+
+exit $FAILED
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Copyright 2015 Judson Weissert; See LICENSE file.
+#
+# Tests of the encode/decode daemon, driven by the load generator.
+# Usage: test_daemon.sh path/to/ascii85d path/to/b85load
+
+set -u
+
+# Keep the tuning cache of the user out of the tests.
+export B85_TUNE_FILE=
+
+DAEMON=$1
+LOAD=$2
+DIR=$(mktemp -d) || exit 1
+PID=
+trap '[ -n "$PID" ] && kill "$PID" 2> /dev/null; rm -rf "$DIR"' EXIT
+
+FAILED=0
+
+# Starts the daemon with the options "$@" and waits for its socket.
+start ()
+{
+  "$DAEMON" "$@" "$DIR/sock" 2> "$DIR/log" &
+  PID=$!
+  i=0
+  while [ ! -S "$DIR/sock" ] && [ $i -lt 50 ]
+  do
+    sleep 0.1
+    i=$((i + 1))
+  done
+}
+
+# Stops the daemon, and checks that it exits cleanly.
+stop ()
+{
+  kill -TERM "$PID"
+  wait "$PID"
+  STATUS=$?
+  PID=
+  return $STATUS
+}
+
+# Runs round trips of several sizes against a daemon started with "$@".
+check ()
+{
+  name=$1
+  shift
+  start "$@"
+  ok=1
+  for size in 0 1 100 4096 65536
+  do
+    "$LOAD" -c 4 -n 50 -s $size "$DIR/sock" > /dev/null || ok=0
+  done
+  stop || ok=0
+  if [ $ok = 1 ]
+  then
+    echo "  PASS -> $name"
+  else
+    echo "  FAIL -> $name"
+    cat "$DIR/log"
+    FAILED=1
+  fi
+}
+
+echo "daemon:"
+check threads -j 4
+check single -j 1
+check cache -j 4 -c 1048576
+
+exit $FAILED
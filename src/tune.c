@@ -0,0 +1,561 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#include "tune.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define dimof(x) (sizeof(x) / sizeof(*x))
+
+/// Size of the binary data used by the benchmarks.
+#define B85_TUNE_INPUT (1024 * 1024)
+
+/// Runs per candidate; the fastest run counts.
+#define B85_TUNE_ROUNDS 5
+
+/// A candidate must be faster than the current winner by this factor to
+/// replace it. Keeps the results stable on noisy machines, and near ties go to
+/// the candidate tried first (the static default).
+#define B85_TUNE_MARGIN 0.97
+
+/// Line length of the wrapped input of the compaction benchmark.
+#define B85_TUNE_LINE 76
+
+/// Chunk size candidates, from the default of the CLI up.
+static const size_t g_tune_chunks[] = {
+  1024, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024,
+};
+
+/// Names of the compaction kernels, see B85_TUNING_KERNEL_NAME().
+static const char *const g_compact_names[B85_COMPACT_END] = {
+  "auto", "generic", "sse2", "ssse3",
+};
+
+/// Names of the alphabets in the cache file.
+static const char *const g_alphabet_names[B85_TUNE_ALPHABETS] = {
+  "ascii85", "z85",
+};
+
+static double
+base85_tune_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// CPU model of B85_TUNING_CPU(), read once.
+static char g_cpu_model[128];
+static pthread_once_t g_cpu_once = PTHREAD_ONCE_INIT;
+
+static void
+base85_tuning_cpu_init (void)
+{
+  snprintf (g_cpu_model, sizeof (g_cpu_model), "unknown");
+
+  FILE *fh = fopen ("/proc/cpuinfo", "r");
+  if (!fh)
+    return;
+
+  // "model name : ..." on x86, "Model : ..." on some ARM systems.
+  char line[256];
+  while (fgets (line, sizeof (line), fh))
+  {
+    char *colon = strchr (line, ':');
+    if (!colon
+      || (strncmp (line, "model name", 10) && strncmp (line, "Model", 5)))
+    {
+      continue;
+    }
+
+    char *value = colon + 1;
+    value += strspn (value, " \t");
+    value[strcspn (value, "\r\n[]")] = 0;
+    if (*value)
+    {
+      snprintf (g_cpu_model, sizeof (g_cpu_model), "%s", value);
+      break;
+    }
+  }
+
+  fclose (fh);
+}
+
+const char *
+B85_TUNING_CPU (void)
+{
+  pthread_once (&g_cpu_once, base85_tuning_cpu_init);
+  return g_cpu_model;
+}
+
+const char *
+B85_TUNING_KERNEL_NAME (b85_compact_kernel_t kernel)
+{
+  if (kernel < B85_COMPACT_AUTO || kernel >= B85_COMPACT_END)
+    return NULL;
+  return g_compact_names[kernel];
+}
+
+/// Encodes the @a cb bytes at @a data with @a alphabet, and returns a copy of
+/// the output (freed by the caller) with its length in @a cb_out, or NULL on
+/// failure.
+static uint8_t *
+base85_tune_encode (
+  const uint8_t *data, size_t cb, const struct base85_alphabet_t *alphabet,
+  size_t *cb_out
+)
+{
+  struct base85_context_t ctx;
+  if (B85_CONTEXT_INIT (&ctx))
+    return NULL;
+
+  uint8_t *encoded = NULL;
+  if (!B85_CONTEXT_SET_ALPHABET (&ctx, alphabet)
+    && !B85_ENCODE (data, cb, &ctx) && !B85_ENCODE_LAST (&ctx))
+  {
+    uint8_t *out = B85_GET_OUTPUT (&ctx, cb_out);
+    encoded = malloc (*cb_out + 1);
+    if (encoded)
+      memcpy (encoded, out, *cb_out);
+  }
+
+  B85_CONTEXT_DESTROY (&ctx);
+  return encoded;
+}
+
+/// Decodes the @a cb bytes at @a b in one call, and returns the time taken,
+/// or a negative value on failure.
+static double
+base85_tune_decode (
+  struct base85_context_t *ctx, const uint8_t *b, size_t cb
+)
+{
+  B85_CONTEXT_RESET (ctx);
+  double start = base85_tune_now ();
+  if (B85_DECODE (b, cb, ctx) || B85_DECODE_LAST (ctx))
+    return -1;
+  return base85_tune_now () - start;
+}
+
+/// Encodes @a data and decodes @a encoded, @a chunk bytes per call, and
+/// returns the time taken, or a negative value on failure.
+static double
+base85_tune_stream (
+  struct base85_context_t *ctx, const uint8_t *data, size_t cb,
+  const uint8_t *encoded, size_t cb_encoded, size_t chunk
+)
+{
+  double start = base85_tune_now ();
+
+  B85_CONTEXT_RESET (ctx);
+  for (size_t i = 0; i < cb; i += chunk)
+  {
+    if (B85_ENCODE (data + i, cb - i < chunk ? cb - i : chunk, ctx))
+      return -1;
+    B85_CLEAR_OUTPUT (ctx);
+  }
+  if (B85_ENCODE_LAST (ctx))
+    return -1;
+
+  B85_CONTEXT_RESET (ctx);
+  for (size_t i = 0; i < cb_encoded; i += chunk)
+  {
+    size_t n = cb_encoded - i < chunk ? cb_encoded - i : chunk;
+    if (B85_DECODE (encoded + i, n, ctx))
+      return -1;
+    B85_CLEAR_OUTPUT (ctx);
+  }
+  if (B85_DECODE_LAST (ctx))
+    return -1;
+
+  return base85_tune_now () - start;
+}
+
+/// Returns true if a candidate that took @a t seconds beats the winner so
+/// far, which took @a best seconds (0 if there is none).
+static bool
+base85_tune_better (double t, double best)
+{
+  return !best || t < best * B85_TUNE_MARGIN;
+}
+
+/// Picks the fastest available compaction kernel for line wrapped input.
+static b85_result_t
+base85_tune_compact (
+  const uint8_t *data, size_t cb, struct base85_context_t *ctx,
+  b85_compact_kernel_t *best
+)
+{
+  size_t cb_encoded;
+  uint8_t *encoded = base85_tune_encode (
+    data, cb, B85_ALPHABET_ASCII85 (), &cb_encoded
+  );
+  uint8_t *wrapped = malloc (cb_encoded + cb_encoded / B85_TUNE_LINE + 1);
+  if (!encoded || !wrapped)
+  {
+    free (encoded);
+    free (wrapped);
+    return B85_E_BAD_ALLOC;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < cb_encoded; i += B85_TUNE_LINE)
+  {
+    size_t line = cb_encoded - i < B85_TUNE_LINE ? cb_encoded - i
+      : B85_TUNE_LINE;
+    memcpy (wrapped + n, encoded + i, line);
+    n += line;
+    wrapped[n++] = '\n';
+  }
+
+  b85_result_t rv = B85_CONTEXT_SET_ALPHABET (ctx, B85_ALPHABET_ASCII85 ());
+  if (B85_E_OK == rv)
+    rv = B85_SET_COMPACT_KERNEL (B85_COMPACT_AUTO);
+
+  // The kernel of the static heuristics goes first, then the others.
+  int first = B85_GET_COMPACT_KERNEL ();
+  double best_time = 0;
+  for (int i = 0; B85_E_OK == rv && i < B85_COMPACT_END; ++i)
+  {
+    int k = i ? i : first;
+    if ((i && i == first) || B85_SET_COMPACT_KERNEL ((b85_compact_kernel_t) k))
+      continue;
+
+    double t = 0;
+    for (int round = 0; round < B85_TUNE_ROUNDS; ++round)
+    {
+      double r = base85_tune_decode (ctx, wrapped, n);
+      if (r < 0)
+      {
+        rv = B85_E_LOGIC_ERROR;
+        break;
+      }
+      t = !t || r < t ? r : t;
+    }
+
+    if (B85_E_OK == rv && base85_tune_better (t, best_time))
+    {
+      best_time = t;
+      *best = (b85_compact_kernel_t) k;
+    }
+  }
+
+  free (encoded);
+  free (wrapped);
+  return rv;
+}
+
+/// Picks the fastest chunk size for streaming with @a alphabet.
+static b85_result_t
+base85_tune_chunk (
+  const uint8_t *data, size_t cb, const struct base85_alphabet_t *alphabet,
+  size_t *best
+)
+{
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_CONTEXT_INIT (&ctx);
+  if (rv)
+    return rv;
+
+  size_t cb_encoded;
+  uint8_t *encoded = base85_tune_encode (data, cb, alphabet, &cb_encoded);
+  rv = encoded ? B85_CONTEXT_SET_ALPHABET (&ctx, alphabet) : B85_E_BAD_ALLOC;
+
+  double best_time = 0;
+  for (size_t c = 0; B85_E_OK == rv && c < dimof (g_tune_chunks); ++c)
+  {
+    double t = 0;
+    for (int round = 0; round < B85_TUNE_ROUNDS; ++round)
+    {
+      double r = base85_tune_stream (
+        &ctx, data, cb, encoded, cb_encoded, g_tune_chunks[c]
+      );
+      if (r < 0)
+      {
+        rv = B85_E_LOGIC_ERROR;
+        break;
+      }
+      t = !t || r < t ? r : t;
+    }
+
+    if (B85_E_OK == rv && base85_tune_better (t, best_time))
+    {
+      best_time = t;
+      *best = g_tune_chunks[c];
+    }
+  }
+
+  free (encoded);
+  B85_CONTEXT_DESTROY (&ctx);
+  return rv;
+}
+
+b85_result_t
+B85_TUNE (struct b85_tuning_t *tuning)
+{
+  if (!tuning)
+    return B85_E_API_MISUSE;
+
+  // Random data, with the occasional zero group.
+  uint8_t *data = malloc (B85_TUNE_INPUT);
+  if (!data)
+    return B85_E_BAD_ALLOC;
+
+  uint32_t x = 2463534242u;
+  for (size_t i = 0; i < B85_TUNE_INPUT; ++i)
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    data[i] = (i / 4) % 61 ? (uint8_t) x : 0;
+  }
+
+  struct base85_context_t ctx;
+  b85_result_t rv = B85_CONTEXT_INIT (&ctx);
+  if (B85_E_OK == rv)
+  {
+    b85_compact_kernel_t compact = B85_GET_COMPACT_KERNEL ();
+    rv = base85_tune_compact (data, B85_TUNE_INPUT, &ctx, &compact);
+    if (B85_E_OK == rv)
+      tuning->compact = compact;
+
+    // Also restores the kernel if the benchmark failed.
+    b85_result_t rv2 = B85_SET_COMPACT_KERNEL (compact);
+    if (B85_E_OK == rv)
+      rv = rv2;
+    B85_CONTEXT_DESTROY (&ctx);
+  }
+
+  const struct base85_alphabet_t *alphabets[B85_TUNE_ALPHABETS] = {
+    [B85_TUNE_ASCII85] = B85_ALPHABET_ASCII85 (),
+    [B85_TUNE_Z85] = B85_ALPHABET_Z85 (),
+  };
+  for (size_t a = 0; B85_E_OK == rv && a < B85_TUNE_ALPHABETS; ++a)
+  {
+    rv = base85_tune_chunk (
+      data, B85_TUNE_INPUT, alphabets[a], &tuning->chunk[a]
+    );
+  }
+
+  free (data);
+  return rv;
+}
+
+/// Gets the path of the cache file into @a b: @a path if not NULL, else the
+/// default location. If @a create is true, the directory of the default
+/// location is created. Returns false if there is no cache file.
+static bool
+base85_tuning_path (const char *path, bool create, char *b, size_t cb)
+{
+  if (path)
+    return (size_t) snprintf (b, cb, "%s", path) < cb;
+
+  const char *env = getenv ("B85_TUNE_FILE");
+  if (env)
+    return *env && (size_t) snprintf (b, cb, "%s", env) < cb;
+
+  const char *home = getenv ("HOME");
+  const char *cache = getenv ("XDG_CACHE_HOME");
+  int n;
+  if (cache && *cache)
+    n = snprintf (b, cb, "%s/base85", cache);
+  else if (home && *home)
+    n = snprintf (b, cb, "%s/.cache/base85", home);
+  else
+    return false;
+
+  if (n < 0 || (size_t) n + sizeof ("/tune") > cb)
+    return false;
+
+  if (create)
+  {
+    // Create the missing parents too ($HOME/.cache may not exist yet); only
+    // the last mkdir() decides.
+    for (char *p = b + 1; *p; ++p)
+    {
+      if ('/' != *p)
+        continue;
+      *p = 0;
+      mkdir (b, 0755);
+      *p = '/';
+    }
+    if (mkdir (b, 0755) && EEXIST != errno)
+      return false;
+  }
+
+  strcat (b, "/tune");
+  return true;
+}
+
+/// Returns true if @a line is a section header, and stores its CPU model in
+/// @a model.
+static bool
+base85_tuning_section (char *line, const char **model)
+{
+  if ('[' != line[0])
+    return false;
+
+  char *end = strrchr (line, ']');
+  if (!end)
+    return false;
+
+  *end = 0;
+  *model = line + 1;
+  return true;
+}
+
+b85_result_t
+B85_TUNING_LOAD (const char *path, struct b85_tuning_t *tuning)
+{
+  if (!tuning)
+    return B85_E_API_MISUSE;
+
+  char file[4096];
+  if (!base85_tuning_path (path, false, file, sizeof (file)))
+    return B85_E_IO;
+
+  FILE *fh = fopen (file, "r");
+  if (!fh)
+    return B85_E_IO;
+
+  const char *cpu = B85_TUNING_CPU ();
+  struct b85_tuning_t t = { .compact = B85_COMPACT_AUTO };
+  bool found = false;
+  bool in_section = false;
+  bool valid = true;
+  char line[512];
+  while (fgets (line, sizeof (line), fh))
+  {
+    line[strcspn (line, "\r\n")] = 0;
+
+    const char *model;
+    if (base85_tuning_section (line, &model))
+    {
+      in_section = !strcmp (model, cpu);
+      found |= in_section;
+      continue;
+    }
+
+    char key[64];
+    char value[64];
+    if (!in_section || 2 != sscanf (line, "%63s %63s", key, value))
+      continue;
+
+    char *end;
+    unsigned long long v = strtoull (value, &end, 10);
+    bool number = !*end && v <= SIZE_MAX;
+
+    if (!strcmp (key, "compact"))
+    {
+      int k = 0;
+      while (k < B85_COMPACT_END && strcmp (value, g_compact_names[k]))
+        ++k;
+      valid &= k < B85_COMPACT_END;
+      if (k < B85_COMPACT_END)
+        t.compact = (b85_compact_kernel_t) k;
+    }
+    else if (!strcmp (key, "threads"))
+    {
+      valid &= number;
+      t.threads = (size_t) v;
+    }
+    else if (!strncmp (key, "chunk.", 6))
+    {
+      // Unknown alphabets are ignored, like unknown keys.
+      for (int a = 0; a < B85_TUNE_ALPHABETS; ++a)
+      {
+        if (!strcmp (key + 6, g_alphabet_names[a]))
+        {
+          valid &= number;
+          t.chunk[a] = (size_t) v;
+        }
+      }
+    }
+  }
+
+  bool failed = ferror (fh);
+  fclose (fh);
+  if (failed)
+    return B85_E_IO;
+
+  if (!found || !valid)
+    return B85_E_BAD_STATE;
+
+  *tuning = t;
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_TUNING_SAVE (const char *path, const struct b85_tuning_t *tuning)
+{
+  if (!tuning || tuning->compact < B85_COMPACT_AUTO
+    || tuning->compact >= B85_COMPACT_END)
+  {
+    return B85_E_API_MISUSE;
+  }
+
+  char file[4096];
+  char tmp[4096 + 8];
+  if (!base85_tuning_path (path, true, file, sizeof (file)))
+    return B85_E_IO;
+  snprintf (tmp, sizeof (tmp), "%s.tmp", file);
+
+  FILE *out = fopen (tmp, "w");
+  if (!out)
+    return B85_E_IO;
+
+  // Keep the sections of other CPU models.
+  const char *cpu = B85_TUNING_CPU ();
+  FILE *in = fopen (file, "r");
+  if (in)
+  {
+    bool keep = false;
+    char line[512];
+    while (fgets (line, sizeof (line), in))
+    {
+      char header[512];
+      const char *model;
+      memcpy (header, line, sizeof (line));
+      header[strcspn (header, "\r\n")] = 0;
+      if (base85_tuning_section (header, &model))
+        keep = !!strcmp (model, cpu);
+      if (keep)
+        fputs (line, out);
+    }
+    fclose (in);
+  }
+
+  fprintf (out, "[%s]\ncompact %s\n", cpu, g_compact_names[tuning->compact]);
+  for (int a = 0; a < B85_TUNE_ALPHABETS; ++a)
+  {
+    if (tuning->chunk[a])
+      fprintf (out, "chunk.%s %zu\n", g_alphabet_names[a], tuning->chunk[a]);
+  }
+  if (tuning->threads)
+    fprintf (out, "threads %zu\n", tuning->threads);
+
+  bool failed = ferror (out);
+  failed |= 0 != fclose (out);
+  if (failed || rename (tmp, file))
+  {
+    remove (tmp);
+    return B85_E_IO;
+  }
+
+  return B85_E_OK;
+}
+
+b85_result_t
+B85_TUNING_APPLY (const struct b85_tuning_t *tuning)
+{
+  if (!tuning)
+    return B85_E_API_MISUSE;
+
+  return B85_SET_COMPACT_KERNEL (tuning->compact);
+}
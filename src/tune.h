@@ -0,0 +1,99 @@
+/* Copyright 2015 Judson Weissert; See LICENSE file. */
+
+#if !defined (TUNE_H__INCLUDED__)
+#define TUNE_H__INCLUDED__
+
+#include "base85.h"
+
+#define B85_TUNE B85_NAME (tune)
+#define B85_TUNING_CPU B85_NAME (tuning_cpu)
+#define B85_TUNING_LOAD B85_NAME (tuning_load)
+#define B85_TUNING_SAVE B85_NAME (tuning_save)
+#define B85_TUNING_APPLY B85_NAME (tuning_apply)
+#define B85_TUNING_KERNEL_NAME B85_NAME (tuning_kernel_name)
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/// Alphabets with separately tuned parameters, see b85_tuning_t::chunk.
+enum
+{
+  B85_TUNE_ASCII85 = 0,
+  B85_TUNE_Z85,
+  B85_TUNE_ALPHABETS
+};
+
+/// B85_TUNE_DEFAULT is the index of the default alphabet of this build.
+#if defined (B85_ZEROMQ)
+#define B85_TUNE_DEFAULT B85_TUNE_Z85
+#else
+#define B85_TUNE_DEFAULT B85_TUNE_ASCII85
+#endif
+
+/// Parameters that are tuned per CPU model. Zero values (B85_COMPACT_AUTO)
+/// mean "not tuned", i.e. use the static heuristics.
+///
+/// The tuning is cached in a text file, in a section per CPU model, so that a
+/// file shared by different machines keeps the results of each:
+///
+///   [Intel(R) Xeon(R) CPU E5-2680 v4 @ 2.40GHz]
+///   compact ssse3
+///   chunk.ascii85 65536
+///   chunk.z85 65536
+///   threads 8
+///
+/// The default location is $B85_TUNE_FILE, or $XDG_CACHE_HOME/base85/tune, or
+/// $HOME/.cache/base85/tune. An empty $B85_TUNE_FILE disables the cache.
+struct b85_tuning_t
+{
+  /// Whitespace compaction kernel of the decoder.
+  b85_compact_kernel_t compact;
+
+  /// Number of bytes to pass per B85_ENCODE()/B85_DECODE() call when
+  /// streaming, by alphabet.
+  size_t chunk[B85_TUNE_ALPHABETS];
+
+  /// Worker threads for parallel jobs, e.g. --batch or B85_SEGMENTS_DECODE()
+  /// (tuned by the caller, see the --tune mode of the CLI).
+  size_t threads;
+};
+
+/// Gets the CPU model that the tuning is keyed by ("unknown" if the platform
+/// does not tell).
+const char *
+B85_TUNING_CPU (void);
+
+/// Microbenchmarks the compaction kernels and the chunk sizes of both
+/// alphabets on this machine (for well under a second), stores the winners in
+/// @a tuning and selects the winning compaction kernel. @a tuning->threads is
+/// left as is.
+b85_result_t
+B85_TUNE (struct b85_tuning_t *tuning);
+
+/// Loads the tuning of this CPU model from the cache file at @a path (NULL for
+/// the default location). Returns B85_E_IO if the file cannot be read, and
+/// B85_E_BAD_STATE if it has no valid entry for this CPU model.
+b85_result_t
+B85_TUNING_LOAD (const char *path, struct b85_tuning_t *tuning);
+
+/// Stores @a tuning as the entry of this CPU model in the cache file at
+/// @a path (NULL for the default location, whose directory is created). The
+/// entries of other CPU models are kept. Returns B85_E_IO on failure.
+b85_result_t
+B85_TUNING_SAVE (const char *path, const struct b85_tuning_t *tuning);
+
+/// Applies the library parameters of @a tuning (the compaction kernel).
+b85_result_t
+B85_TUNING_APPLY (const struct b85_tuning_t *tuning);
+
+/// Gets the name of the compaction kernel @a kernel in the cache file (e.g.
+/// "ssse3"), or NULL if @a kernel is out of range.
+const char *
+B85_TUNING_KERNEL_NAME (b85_compact_kernel_t kernel);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // !defined (TUNE_H__INCLUDED__)